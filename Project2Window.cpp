@@ -8,6 +8,7 @@
 #include <QVBoxLayout>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QTimer>
 #include <opencv2/opencv.hpp>
 
 Project2Window::Project2Window(QWidget *parent) : QMainWindow(parent) {
@@ -20,10 +21,21 @@ Project2Window::Project2Window(QWidget *parent) : QMainWindow(parent) {
     editDir = new QLineEdit();
     btnLoadImages = new QPushButton("Choose Image Directory");
     btnExtract = new QPushButton("Extract Features (All)");
+    btnBuildGraphs = new QPushButton("Build k-NN Graphs");
+
+    // histogram descriptors barely change at lower resolution, so they
+    // can be extracted from a cheaper reduced JPEG decode
+    comboDecode = new QComboBox();
+    comboDecode->addItem("Histograms: full-resolution decode", 1);
+    comboDecode->addItem("Histograms: 1/2 decode", 2);
+    comboDecode->addItem("Histograms: 1/4 decode", 4);
+    comboDecode->addItem("Histograms: 1/8 decode", 8);
 
     extLayout->addWidget(btnLoadImages);
     extLayout->addWidget(editDir);
+    extLayout->addWidget(comboDecode);
     extLayout->addWidget(btnExtract);
+    extLayout->addWidget(btnBuildGraphs);
     extractTab->setLayout(extLayout);
 
     matchTab = new QWidget();
@@ -38,6 +50,9 @@ Project2Window::Project2Window(QWidget *parent) : QMainWindow(parent) {
     editN = new QLineEdit();
     editN->setPlaceholderText("N (top matches)");
 
+    editEf = new QLineEdit();
+    editEf->setPlaceholderText(QString("HNSW search width ef (default %1)").arg(HNSW_QUERY_EF));
+
     btnMatch = new QPushButton("Run Match");
 
     listResults = new QListWidget();
@@ -45,19 +60,145 @@ Project2Window::Project2Window(QWidget *parent) : QMainWindow(parent) {
     matLayout->addWidget(editTarget);
     matLayout->addWidget(editCSVMatch);
     matLayout->addWidget(editN);
+    matLayout->addWidget(editEf);
     matLayout->addWidget(btnMatch);
     matLayout->addWidget(listResults);
     matchTab->setLayout(matLayout);
 
+    metricsTab = new QWidget();
+    auto *metLayout = new QVBoxLayout();
+
+    textMetrics = new QPlainTextEdit();
+    textMetrics->setReadOnly(true);
+    textMetrics->setFont(QFont("monospace"));
+    btnResetMetrics = new QPushButton("Reset Metrics");
+
+    metLayout->addWidget(textMetrics);
+    metLayout->addWidget(btnResetMetrics);
+    metricsTab->setLayout(metLayout);
+
     tabs->addTab(extractTab, "Extract");
     tabs->addTab(matchTab, "Match");
-
-    setCentralWidget(tabs);
+    tabs->addTab(metricsTab, "Metrics");
+
+    progressBar = new QProgressBar();
+    labelStatus = new QLabel("Idle");
+    btnCancel = new QPushButton("Cancel");
+    btnCancel->setEnabled(false);
+
+    auto *central = new QWidget();
+    auto *mainLayout = new QVBoxLayout();
+    mainLayout->addWidget(tabs);
+    mainLayout->addWidget(labelStatus);
+    mainLayout->addWidget(progressBar);
+    mainLayout->addWidget(btnCancel);
+    central->setLayout(mainLayout);
+
+    setCentralWidget(central);
     setWindowTitle("Project 2 GUI");
 
+    jobPool.setMaxThreadCount(1);
+
     connect(btnLoadImages, &QPushButton::clicked, this, &Project2Window::onLoadImages);
     connect(btnExtract, &QPushButton::clicked, this, &Project2Window::onExtractFeatures);
+    connect(btnBuildGraphs, &QPushButton::clicked, this, &Project2Window::onBuildGraphs);
     connect(btnMatch, &QPushButton::clicked, this, &Project2Window::onRunMatch);
+    connect(btnCancel, &QPushButton::clicked, this, &Project2Window::onCancel);
+    connect(btnResetMetrics, &QPushButton::clicked, this, [this] {
+        resetMetrics();
+        onRefreshMetrics();
+    });
+
+    auto *metricsTimer = new QTimer(this);
+    connect(metricsTimer, &QTimer::timeout, this, &Project2Window::onRefreshMetrics);
+    metricsTimer->start(1000);
+
+    connect(this, &Project2Window::jobProgress, this, &Project2Window::onJobProgress);
+    connect(this, &Project2Window::matchUpdated, this, &Project2Window::onMatchUpdated);
+    connect(this, &Project2Window::jobFinished, this, &Project2Window::onJobFinished);
+}
+
+// stop the running job and wait for the queue before the window goes away
+Project2Window::~Project2Window() {
+    jobPool.clear();
+    cancelRequested = true;
+    jobPool.waitForDone();
+}
+
+// queue a job on the background thread; jobs run in the order queued
+void Project2Window::enqueue(const QString &name, std::function<void()> job) {
+    queuedJobs++;
+    btnCancel->setEnabled(true);
+    if (queuedJobs > 1) {
+        labelStatus->setText(QString("%1 queued (%2 jobs pending)").arg(name).arg(queuedJobs));
+    }
+
+    jobPool.start([this, name, job] {
+        cancelRequested = false;
+        emit jobProgress(0, 0, name);
+        job();
+    });
+}
+
+// cancel the job that is currently running
+void Project2Window::onCancel() {
+    cancelRequested = true;
+}
+
+void Project2Window::onJobProgress(int done, int total, QString status) {
+    progressBar->setRange(0, total);
+    progressBar->setValue(done);
+    labelStatus->setText(total > 0 ? QString("%1 (%2 / %3)").arg(status).arg(done).arg(total)
+                                   : status);
+}
+
+void Project2Window::onMatchUpdated(QStringList lines) {
+    ScopedTimer timer(STAGE_RENDER);
+    listResults->clear();
+    listResults->addItems(lines);
+}
+
+// show per-stage timings and counters while the Metrics tab is open
+void Project2Window::onRefreshMetrics() {
+    if (tabs->currentWidget() != metricsTab) return;
+
+    QString text = QString("%1 %2 %3 %4 %5 %6\n")
+                       .arg("stage", -28).arg("count", 8).arg("total ms", 12)
+                       .arg("mean ms", 10).arg("p50 ms", 10).arg("p99 ms", 10);
+    for (auto &m : metricSummaries()) {
+        text += QString("%1 %2 %3 %4 %5 %6\n")
+                    .arg(QString::fromStdString(m.name), -28).arg(m.count, 8)
+                    .arg(m.totalMs, 12, 'f', 1).arg(m.meanMs, 10, 'f', 3)
+                    .arg(m.p50Ms, 10, 'f', 3).arg(m.p99Ms, 10, 'f', 3);
+    }
+    text += "\n";
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        text += QString("%1 %2\n").arg(metricCounterName(MetricCounter(c)), -28)
+                                   .arg(metricCount(MetricCounter(c)));
+    }
+    if (!metricsEnabled()) text += "\n(metrics disabled by CBIR_METRICS=0)\n";
+    textMetrics->setPlainText(text);
+}
+
+void Project2Window::onJobFinished(QString title, QString message, bool ok) {
+    queuedJobs--;
+    btnCancel->setEnabled(queuedJobs > 0);
+    progressBar->setRange(0, 1);
+    progressBar->setValue(ok ? 1 : 0);
+    labelStatus->setText(queuedJobs > 0 ? QString("%1 jobs pending").arg(queuedJobs) : "Idle");
+
+    if (message.isEmpty()) return;
+    if (ok) QMessageBox::information(this, title, message);
+    else QMessageBox::warning(this, title, message);
+}
+
+// format matches for the results list
+static QStringList matchLines(const std::vector<Match> &matches) {
+    QStringList lines;
+    for (auto &m : matches) {
+        lines << QString::fromStdString(m.name + "  dist=" + std::to_string(m.dist));
+    }
+    return lines;
 }
 
 //open file dialog to choose image directory
@@ -77,79 +218,109 @@ void Project2Window::onExtractFeatures() {
         return;
     }
 
-    auto baseline = extractDirFeatures(imageDir, BASELINE);
-    writeFeatureCSV("baseline.csv", baseline);
-
-    auto hist = extractDirFeatures(imageDir, COLOR);
-    writeFeatureCSV("hist.csv", hist);
+    std::string dir = imageDir;
+    int factor = comboDecode->currentData().toInt();
+    enqueue("Extracting features", [this, dir, factor] {
+        ExtractOptions opts;
+        opts.decode.factor = factor;
+        opts.cancel = &cancelRequested;
+        opts.progress = [this](size_t done, size_t total) {
+            if (done % 16 == 0 || done == total) {
+                emit jobProgress(int(done), int(total), "Extracting features");
+            }
+        };
 
-    auto multihist = extractDirFeatures(imageDir, MULTIHIST);
-    writeFeatureCSV("multihist.csv", multihist);
+        UpdateStats stats = updateFeatureStores(dir, defaultStoreSpecs(), opts);
+        if (stats.cancelled) {
+            emit jobFinished("Cancelled", "Extraction cancelled; stores were left unchanged.", false);
+            return;
+        }
+        if (!stats.listError.empty()) {
+            emit jobFinished("Error", QString::fromStdString(stats.listError) +
+                             "\nStores were left unchanged.", false);
+            return;
+        }
 
-    auto ct = extractDirFeatures(imageDir, COLOR_TEXTURE);
-    writeFeatureCSV("ct.csv", ct);
+        QString summary = QString("Features extracted!\n%1 added, %2 modified, %3 removed, %4 unchanged")
+                              .arg(stats.added).arg(stats.modified)
+                              .arg(stats.removed).arg(stats.unchanged);
+        emit jobFinished("Done", summary, true);
+    });
+}
 
-    auto custom = extractDirFeatures(imageDir, CUSTOM);
-    writeFeatureCSV("custom.csv", custom);
+// precompute the k-NN graph of every extracted binary store
+void Project2Window::onBuildGraphs() {
+    enqueue("Building k-NN graphs", [this] {
+        const vector<StoreSpec> &specs = defaultStoreSpecs();
+        int built = 0;
+        for (size_t s = 0; s < specs.size() && !cancelRequested; s++) {
+            FeatureStore store;
+            if (!store.open(specs[s].stem + ".bin")) continue;
+            QString label = QString("Building k-NN graph %1 of %2 (%3)")
+                                .arg(s + 1).arg(specs.size()).arg(QString::fromStdString(specs[s].stem));
+            auto progress = [this, label](size_t done, size_t total) {
+                emit jobProgress(int(done), int(total), label);
+                return !cancelRequested;
+            };
+            KnnGraph graph = buildKnnGraph(store.view(), DEFAULT_GRAPH_K, 0, progress);
+            if (cancelRequested) break;
+            if (replaceFile(specs[s].stem + ".knn", [&](const std::string &tmp) {
+                    return writeKnnGraph(tmp, graph);
+                })) {
+                built++;
+            }
+        }
 
-    QMessageBox::information(this, "Done", "Features extracted!");
+        if (cancelRequested) {
+            emit jobFinished("Cancelled", QString("Cancelled after %1 k-NN graphs.").arg(built), false);
+        }
+        else if (built == 0) {
+            emit jobFinished("Error", "No feature stores found. Extract features first.", false);
+        }
+        else {
+            emit jobFinished("Done", QString("Built %1 k-NN graphs.").arg(built), true);
+        }
+    });
 }
 
-//run matching against database CSV
+//run matching against a feature CSV or binary store; databases, target
+//features and recent results stay resident in the cache between clicks,
+//and the running top-N of a long scan streams into the results list
 void Project2Window::onRunMatch() {
     std::string target = editTarget->text().trimmed().toStdString();
-    std::string csv = editCSVMatch->text().trimmed().toStdString();
-    int N = std::stoi(editN->text().trimmed().toStdString());
-
-    listResults->clear();
-
-    FeatureType type = BASELINE;
-
-    if (csv.find("baseline") != std::string::npos) type = BASELINE;
-    else if (csv.find("hist") != std::string::npos) type = COLOR;
-    else if (csv.find("multihist") != std::string::npos) type = MULTIHIST;
-    else if (csv.find("ct") != std::string::npos) type = COLOR_TEXTURE;
-    else if (csv.find("custom") != std::string::npos) type = CUSTOM;
-    else if (csv.find("dnn") != std::string::npos) type = DNN_EMB;
-
-    vector<ImageFeature> db;
-    ImageFeature targetFeat;
-
-    if (type == DNN_EMB) {
-        db = readDNNCSV(csv);
-
-        bool found = false;
-        for (auto &f : db) {
-            if (f.name == target) {
-                targetFeat = f;
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            QMessageBox::warning(this, "Error", "Target not found in DNN CSV.");
-            return;
-        }
+    std::string path = editCSVMatch->text().trimmed().toStdString();
+    bool nOk = false;
+    int N = editN->text().trimmed().toInt(&nOk);
+    if (!nOk || N <= 0) {
+        QMessageBox::warning(this, "Error", "Number of matches must be a positive integer!");
+        return;
     }
-    else {
-        cv::Mat targetImg = cv::imread(imageDir + "/" + target);
-        if (targetImg.empty()) {
-            QMessageBox::warning(this, "Error", "Target image not found in image folder.");
+    std::string dir = imageDir;
+
+    //a blank or invalid width falls back to the default
+    bool efOk = false;
+    int ef = editEf->text().trimmed().toInt(&efOk);
+    size_t hnswEf = efOk && ef > 0 ? size_t(ef) : HNSW_QUERY_EF;
+
+    enqueue("Matching", [this, target, path, N, dir, hnswEf] {
+        emit matchUpdated(QStringList());
+        cache.setHnswEf(hnswEf);
+
+        std::vector<Match> matches;
+        std::string error;
+        auto progress = [this](const std::vector<Match> &best, size_t done, size_t total) {
+            emit matchUpdated(matchLines(best));
+            emit jobProgress(int(done), int(total), "Matching");
+            return !cancelRequested;
+        };
+
+        if (!cache.query(path, target, dir, N, matches, error, progress)) {
+            emit jobFinished(cancelRequested ? "Cancelled" : "Error",
+                             QString::fromStdString(error), false);
             return;
         }
-        targetFeat = computeFeatures(targetImg, type, target);
-        db = readFeatureCSV(csv, type);
-    }
-
-    db.erase(std::remove_if(db.begin(), db.end(),
-                        [&](const ImageFeature &f) {
-                            return f.name == target;
-                        }),
-         db.end());
 
-    auto matches = matchFeatures(targetFeat, db, type, N);
-
-    for (auto &m : matches) {
-        listResults->addItem(QString::fromStdString(m.name + "  dist=" + std::to_string(m.dist)));
-    }
+        emit matchUpdated(matchLines(matches));
+        emit jobFinished("Done", QString(), true);
+    });
 }
@@ -12,28 +12,58 @@
 #include <QListWidget>
 #include <QLineEdit>
 #include <QTabWidget>
+#include <QProgressBar>
+#include <QPlainTextEdit>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
 #include <opencv2/opencv.hpp>
 #include "feature_utils.h"
+#include "extract_pipeline.h"
+#include "manifest_utils.h"
+#include "knn_graph.h"
+#include "hnsw_index.h"
+#include "feature_store.h"
 #include "matcher_utils.h"
+#include "feature_cache.h"
+#include "metrics.h"
 
 class Project2Window : public QMainWindow {
     Q_OBJECT
 
 public:
     Project2Window(QWidget *parent = nullptr);
+    ~Project2Window();
+
+signals:
+    // Emitted from the job thread.
+    void jobProgress(int done, int total, QString status);
+    void matchUpdated(QStringList lines);
+    void jobFinished(QString title, QString message, bool ok);
 
 private slots:
     void onLoadImages();
     void onExtractFeatures();
+    void onBuildGraphs();
     void onRunMatch();
+    void onCancel();
+
+    void onJobProgress(int done, int total, QString status);
+    void onMatchUpdated(QStringList lines);
+    void onJobFinished(QString title, QString message, bool ok);
+    void onRefreshMetrics();
 
 private:
+    void enqueue(const QString &name, std::function<void()> job);
+
     QTabWidget *tabs;
     QWidget *extractTab;
     QWidget *matchTab;
 
     QPushButton *btnLoadImages;
     QPushButton *btnExtract;
+    QPushButton *btnBuildGraphs;
+    QComboBox *comboDecode;
     QLineEdit *editDir;
     QLineEdit *editCSV;
 
@@ -41,7 +71,22 @@ private:
     QLineEdit *editTarget;
     QLineEdit *editCSVMatch;
     QLineEdit *editN;
+    QLineEdit *editEf;
     QListWidget *listResults;
 
+    QWidget *metricsTab;
+    QPlainTextEdit *textMetrics;
+    QPushButton *btnResetMetrics;
+
+    QProgressBar *progressBar;
+    QLabel *labelStatus;
+    QPushButton *btnCancel;
+
     std::string imageDir;
+
+    // Jobs run one at a time off the GUI thread; only that thread touches cache.
+    QThreadPool jobPool;
+    std::atomic<bool> cancelRequested{false};
+    int queuedJobs = 0;
+    FeatureCache cache;
 };
@@ -0,0 +1,738 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: benchmark.cpp
+//
+// Microbenchmark for the distance kernels and feature extractors. For
+// every kernel set the CPU supports, checks the results against the
+// scalar reference and reports the scan rate in GB/s of database rows
+// read; then times each extractor on a synthetic 12 MP image in MP/s.
+// Exits non-zero if any kernel is further from the reference than its
+// tolerance.
+//
+// With --hnsw <dnn.csv|dnn.bin> [N], instead prints the recall@N-vs-latency
+// report of the HNSW index next to the store (built by Project2Cli index).
+// With --quantize <dnn.csv|dnn.bin> [N], writes SQ8 and PQ copies of the
+// store and prints their memory use and recall@N with and without re-rank.
+//
+// With --suite, runs the regression suite instead: extractors on the
+// images/ directory and synthetic frames, every distance function across
+// dimensions, CSV write and load rates, matchFeatures from 1K to 100K rows
+// (1M with --max-rows 1000000, which needs about 2 GB) and the
+// near-duplicate search against comparing every pair, and sharded
+// stores streamed from disk under memory budgets. Results
+// are CSV rows of group,name,param,value,unit; with --baseline <file> they
+// are compared against an earlier run and regressions fail the run. A CSV
+// file that does not read back whole, or a duplicate search or sharded
+// ranking that differs from its exhaustive reference, fails it too.
+//   --suite [--images DIR] [--max-rows N] [--out FILE]
+//           [--baseline FILE] [--tolerance 0.10]
+
+#include "csv_utils.h"
+#include "dedup_utils.h"
+#include "distance_kernels.h"
+#include "feature_matrix.h"
+#include "hnsw_index.h"
+#include "matcher_utils.h"
+#include "quantize_utils.h"
+#include "shard_store.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Database of random rows shared by every kernel set.
+struct BenchData {
+    size_t dim, rows;
+    vector<uint8_t> u8;
+    vector<float> f32;
+};
+
+static BenchData makeData(size_t dim, size_t rows, bool histogram) {
+    BenchData d{dim, rows, {}, {}};
+    mt19937 rng(42);
+    uniform_int_distribution<int> byte(0, 255);
+    uniform_real_distribution<float> real(histogram ? 0.0f : -1.0f, 1.0f);
+
+    d.u8.resize(dim * (rows + 1));
+    for (auto &v : d.u8) v = uint8_t(byte(rng));
+
+    d.f32.resize(dim * (rows + 1));
+    for (size_t r = 0; r <= rows; r++) {
+        float *row = &d.f32[r * dim];
+        double sum = 0;
+        for (size_t i = 0; i < dim; i++) {
+            row[i] = real(rng);
+            sum += row[i];
+        }
+        if (histogram) {
+            for (size_t i = 0; i < dim; i++) row[i] = float(row[i] / sum);
+        }
+    }
+    return d;
+}
+
+// Largest difference from the scalar reference accepted for each kernel.
+// SSD sums exact integers; the float kernels only reorder float sums, which
+// stays far inside these on the benchmark's rows.
+static const double TOL_EXACT = 0;
+static const double TOL_HIST = 1e-5;
+static const double TOL_COSINE = 1e-5;
+static const double TOL_DOT = 1e-4;
+
+// Print one kernel's CSV row; false, with a note on stderr, if its largest
+// error is over tolerance.
+static bool reportKernel(const char *kernel, const char *isa, const BenchData &d, size_t elemBytes,
+                         int reps, double secs, double maxErr, double tolerance) {
+    double bytes = double(reps) * d.rows * d.dim * elemBytes;
+    double nsPerRow = secs * 1e9 / (double(reps) * d.rows);
+    printf("%s,%s,%zu,%zu,%.2f,%.2f,%.3g,%.3g\n",
+           kernel, isa, d.dim, d.rows, nsPerRow, bytes / secs / 1e9, maxErr, tolerance);
+    if (maxErr <= tolerance) return true;
+    fprintf(stderr, "FAIL %s %s dim %zu: error %.3g exceeds %.3g\n", kernel, isa, d.dim, maxErr, tolerance);
+    return false;
+}
+
+// Time one kernel over every row of the database; the last row is the query.
+template <typename T, typename F>
+static bool runKernel(const char *kernel, const char *isa, const BenchData &d,
+                      const vector<T> &data, F fn, F ref, double tolerance) {
+    const T *query = &data[d.rows * d.dim];
+
+    double maxErr = 0;
+    for (size_t r = 0; r < d.rows; r++) {
+        const T *row = &data[r * d.dim];
+        maxErr = max(maxErr, fabs(fn(query, row, d.dim) - ref(query, row, d.dim)));
+    }
+
+    const int reps = 20;
+    volatile double sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int rep = 0; rep < reps; rep++) {
+        double acc = 0;
+        for (size_t r = 0; r < d.rows; r++) acc += fn(query, &data[r * d.dim], d.dim);
+        sink = sink + acc;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return reportKernel(kernel, isa, d, sizeof(T), reps, secs, maxErr, tolerance);
+}
+
+// Check a bounded kernel, fn(query, row, n, bound, &done), as the scans use
+// it. With no bound each row must get the reference distance; with half
+// that distance as the bound, a row stopped early must come back above the
+// bound and no further than the distance. Timed at the median distance,
+// where about half the rows are abandoned.
+template <typename T, typename F, typename R>
+static bool runBounded(const char *kernel, const char *isa, const BenchData &d,
+                       const vector<T> &data, F fn, R ref, double tolerance) {
+    const T *query = &data[d.rows * d.dim];
+
+    double maxErr = 0;
+    vector<double> dists(d.rows);
+    for (size_t r = 0; r < d.rows; r++) {
+        const T *row = &data[r * d.dim];
+        double want = dists[r] = ref(query, row, d.dim);
+        size_t done;
+        maxErr = max(maxErr, fabs(fn(query, row, d.dim, INFINITY, &done) - want));
+
+        double bound = want / 2;
+        double got = fn(query, row, d.dim, bound, &done);
+        maxErr = max(maxErr, done < d.dim ? max({0.0, got - want, bound - got}) : fabs(got - want));
+    }
+    nth_element(dists.begin(), dists.begin() + d.rows / 2, dists.end());
+    double median = dists[d.rows / 2];
+
+    const int reps = 20;
+    volatile double sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int rep = 0; rep < reps; rep++) {
+        double acc = 0;
+        size_t done;
+        for (size_t r = 0; r < d.rows; r++) acc += fn(query, &data[r * d.dim], d.dim, median, &done);
+        sink = sink + acc;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return reportKernel(kernel, isa, d, sizeof(T), reps, secs, maxErr, tolerance);
+}
+
+// Open <stem>.bin as a DNN_EMB store, converting a DNN CSV first if needed.
+static bool openDnnStore(const string &path, FeatureStore &store, string &stem) {
+    stem = path.substr(0, path.find_last_of('.'));
+    string binPath = stem + ".bin";
+    if (path != binPath && !writeFeatureStore(binPath, readDNNCSV(path).view())) {
+        fprintf(stderr, "could not convert %s\n", path.c_str());
+        return false;
+    }
+    if (!store.open(binPath) || store.view().type != DNN_EMB) {
+        fprintf(stderr, "%s is not a DNN_EMB store\n", binPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Write <stem>.sq8 and <stem>.pq and report memory and recall@N for each.
+static int runQuantizeReport(const string &path, size_t N) {
+    FeatureStore store;
+    string stem;
+    if (!openDnnStore(path, store, stem)) return 1;
+    const FeatureView &db = store.view();
+
+    size_t m = db.dim % 64 == 0 ? 64 : db.dim % 32 == 0 ? 32 : db.dim;
+    struct Variant { const char *ext; QuantizedStore q; };
+    Variant variants[] = {
+        {".sq8", quantizeSQ8(db)},
+        {".pq", quantizePQ(db, m)},
+    };
+
+    size_t fullBytes = db.dim * sizeof(double);
+    printf("format,bytes_per_row,reduction_vs_double,rerank,recall_at_%zu,us_per_query\n", N);
+    for (auto &v : variants) {
+        writeQuantizedStore(stem + v.ext, v.q);
+        for (auto &row : quantizedRecallReport(v.q, db, N, {2 * N, 5 * N, 20 * N})) {
+            printf("%s,%zu,%.1f,%zu,%.4f,%.1f\n", v.ext + 1, v.q.bytesPerRow(),
+                   double(fullBytes) / v.q.bytesPerRow(), row.rerank, row.recall, row.usPerQuery);
+        }
+    }
+    return 0;
+}
+
+// Report recall@N of <stem>.hnsw against the exact cosine scan of its
+// DNN_EMB store for a range of ef values.
+static int runHnswReport(const string &path, size_t N) {
+    FeatureStore store;
+    string stem;
+    if (!openDnnStore(path, store, stem)) return 1;
+    const FeatureView &db = store.view();
+
+    HnswIndex index;
+    if (!index.open(stem + ".hnsw") || index.dim() != db.dim) {
+        fprintf(stderr, "no usable %s.hnsw; build it with: Project2Cli index --hnsw %s.bin\n",
+                stem.c_str(), stem.c_str());
+        return 1;
+    }
+    if (index.size() != db.count) {
+        fprintf(stderr, "# %s.hnsw holds %zu of %zu rows; Project2Cli index --hnsw adds the rest\n",
+                stem.c_str(), index.size(), db.count);
+    }
+
+    printf("# hnsw %s: %zu rows\n", stem.c_str(), index.size());
+    printf("ef,recall_at_%zu,us_per_query,exact_us_per_query\n", N);
+    for (auto &row : hnswRecallReport(index, db, N, {10, 20, 40, 80, 160, 320})) {
+        printf("%zu,%.4f,%.1f,%.1f\n", row.ef, row.recall, row.usPerQuery, row.exactUsPerQuery);
+    }
+    return 0;
+}
+
+// Time computeFeatures for every extractable type on a random image.
+static void runExtractors() {
+    const int rows = 3000, cols = 4000;
+    Mat img(rows, cols, CV_8UC3);
+    randu(img, 0, 256);
+    double mp = rows * cols / 1e6;
+
+    printf("extractor,megapixels,ms,MP_per_s\n");
+    for (FeatureType type : {BASELINE, COLOR, MULTIHIST, COLOR_TEXTURE, CUSTOM, GRID_3X3, PYRAMID, DHASH, PHASH}) {
+        const int reps = 5;
+        auto t0 = chrono::steady_clock::now();
+        for (int rep = 0; rep < reps; rep++) computeFeatures(img, type, "synthetic");
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / reps;
+        printf("%s,%.1f,%.2f,%.1f\n", featureTypeName(type), mp, ms, mp / (ms / 1e3));
+    }
+}
+
+// One measurement of the --suite run. Rows with the same group, name and
+// param are compared against the baseline file.
+struct BenchResult {
+    string group, name, param;
+    double value;
+    string unit;
+};
+
+// Larger is better for rates, smaller for times.
+static bool higherIsBetter(const string &unit) {
+    return unit.find("_per_s") != string::npos || unit == "pct_values_skipped";
+}
+
+static double secondsSince(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+// Extractor throughput on every image in dir and on synthetic frames.
+static void suiteExtractors(const string &dir, vector<BenchResult> &out) {
+    vector<Mat> images;
+    double imageMP = 0;
+    auto t0 = chrono::steady_clock::now();
+    error_code ec;
+    for (auto &p : filesystem::directory_iterator(dir, ec)) {
+        if (!p.is_regular_file() || !isImageExtension(p.path().extension().string())) continue;
+        Mat img = imread(p.path().string());
+        if (img.empty()) continue;
+        imageMP += img.rows * img.cols / 1e6;
+        images.push_back(img);
+    }
+    if (!images.empty()) {
+        out.push_back({"extract", "decode", "images", imageMP / secondsSince(t0), "MP_per_s"});
+    }
+
+    struct Frame { string param; vector<Mat> imgs; double mp; };
+    vector<Frame> frames;
+    if (!images.empty()) frames.push_back({"images", images, imageMP});
+    for (auto size : {Size(640, 480), Size(1920, 1080), Size(4000, 3000)}) {
+        Mat img(size, CV_8UC3);
+        randu(img, 0, 256);
+        frames.push_back({"synthetic_" + to_string(size.width) + "x" + to_string(size.height),
+                          {img}, size.width * size.height / 1e6});
+    }
+
+    for (auto &frame : frames) {
+        for (FeatureType type : {BASELINE, COLOR, MULTIHIST, COLOR_TEXTURE, CUSTOM, GRID_3X3, PYRAMID, DHASH, PHASH}) {
+            int reps = max(1, int(20 / frame.mp));
+            auto start = chrono::steady_clock::now();
+            for (int rep = 0; rep < reps; rep++) {
+                for (auto &img : frame.imgs) computeFeatures(img, type, "bench");
+            }
+            double secs = secondsSince(start);
+            out.push_back({"extract", featureTypeName(type), frame.param,
+                           reps * frame.mp / secs, "MP_per_s"});
+        }
+    }
+}
+
+// ns per row of fn(i) over `rows` rows, repeated until ~0.2 s has passed.
+template <typename F>
+static double nsPerRow(size_t rows, F fn) {
+    volatile double sink = 0;
+    size_t done = 0;
+    auto t0 = chrono::steady_clock::now();
+    do {
+        double acc = 0;
+        for (size_t r = 0; r < rows; r++) acc += fn(r);
+        sink = sink + acc;
+        done += rows;
+    } while (secondsSince(t0) < 0.2);
+    return secondsSince(t0) * 1e9 / done;
+}
+
+// Every distance function, legacy and per kernel set, across dimensions.
+static void suiteDistances(vector<BenchResult> &out) {
+    for (size_t dim : {16, 64, 147, 256, 512, 528, 2048}) {
+        size_t rows = max<size_t>(256, (4 << 20) / dim);
+        BenchData d = makeData(dim, rows, true);
+        string param = "dim_" + to_string(dim);
+
+        vector<vector<int>> ints(rows + 1, vector<int>(dim));
+        vector<vector<double>> dbls(rows + 1, vector<double>(dim));
+        for (size_t r = 0; r <= rows; r++) {
+            for (size_t i = 0; i < dim; i++) {
+                ints[r][i] = d.u8[r * dim + i];
+                dbls[r][i] = d.f32[r * dim + i];
+            }
+        }
+        const vector<int> &qi = ints[rows];
+        const vector<double> &qd = dbls[rows];
+        out.push_back({"distance", "computeSSD", param,
+                       nsPerRow(rows, [&](size_t r) { return computeSSD(qi, ints[r]); }), "ns_per_row"});
+        out.push_back({"distance", "histIntersection", param,
+                       nsPerRow(rows, [&](size_t r) { return histIntersection(qd, dbls[r]); }), "ns_per_row"});
+        out.push_back({"distance", "cosineDistance", param,
+                       nsPerRow(rows, [&](size_t r) { return cosineDistance(qd, dbls[r]); }), "ns_per_row"});
+
+        const uint8_t *q8 = &d.u8[rows * dim];
+        const float *qf = &d.f32[rows * dim];
+        for (const DistanceKernels *k : availableKernels()) {
+            string isa = k->name;
+            out.push_back({"distance", isa + "_ssd_u8", param,
+                           nsPerRow(rows, [&](size_t r) { return k->ssdU8(q8, &d.u8[r * dim], dim); }),
+                           "ns_per_row"});
+            out.push_back({"distance", isa + "_hist_intersection_f32", param,
+                           nsPerRow(rows, [&](size_t r) {
+                               return k->histIntersectionF32(qf, &d.f32[r * dim], dim);
+                           }), "ns_per_row"});
+            out.push_back({"distance", isa + "_cosine_f32", param,
+                           nsPerRow(rows, [&](size_t r) {
+                               return k->cosineDistanceF32(qf, &d.f32[r * dim], dim);
+                           }), "ns_per_row"});
+        }
+    }
+}
+
+// Random rows of a feature type, shaped like the extractor's output:
+// histograms sum to 1, embeddings are unnormalized.
+static FeatureMatrix syntheticFeatures(FeatureType type, size_t dim, size_t rows,
+                                       float fill = 1.0f) {
+    mt19937 rng(11);
+    uniform_real_distribution<float> real(0.0f, 1.0f);
+
+    FeatureMatrix db(type, dim);
+    db.reserve(rows);
+    vector<uint8_t> u8(dim);
+    vector<float> f32(dim);
+    char name[48];
+    for (size_t r = 0; r < rows; r++) {
+        snprintf(name, sizeof(name), "synthetic.%07zu.jpg", r);
+        if (type == BASELINE) {
+            for (auto &v : u8) v = uint8_t(rng());
+            db.addRow(name, u8.data(), dim);
+        } else {
+            float sum = 0;
+            for (auto &v : f32) sum += v = real(rng) < fill ? real(rng) : 0.0f;
+            if (type != DNN_EMB) {
+                for (auto &v : f32) v /= sum;
+            }
+            db.addRow(name, f32.data(), dim);
+        }
+    }
+    return db;
+}
+
+// Row counts and dimensions of the store types the suite exercises.
+struct SuiteType {
+    FeatureType type;
+    size_t dim;
+};
+static const SuiteType SUITE_TYPES[] = {
+    {BASELINE, 147}, {COLOR, 256}, {COLOR_TEXTURE, 528}, {PYRAMID, 1344}, {DNN_EMB, 512},
+};
+
+// writeFeatureCSV / readFeatureCSV rates on a synthetic file per type.
+// Returns the number of files that did not read back whole.
+static size_t suiteCsvLoad(vector<BenchResult> &out) {
+    const size_t rows = 20000;
+    size_t failures = 0;
+    string path = (filesystem::temp_directory_path() / "cbir_bench.csv").string();
+
+    for (auto &st : SUITE_TYPES) {
+        FeatureMatrix db = syntheticFeatures(st.type, st.dim, rows);
+        auto t0 = chrono::steady_clock::now();
+        writeFeatureCSV(path, db.view());
+        double writeSecs = secondsSince(t0);
+        double mb = filesystem::file_size(path) / 1e6;
+        out.push_back({"csv_write", featureTypeName(st.type), "rows_" + to_string(rows),
+                       mb / writeSecs, "MB_per_s"});
+
+        t0 = chrono::steady_clock::now();
+        size_t loaded = readFeatureCSV(path, st.type).count();
+        double secs = secondsSince(t0);
+        if (loaded != rows) {
+            fprintf(stderr, "csv %s: read %zu of %zu rows\n", featureTypeName(st.type), loaded, rows);
+            failures++;
+        }
+
+        out.push_back({"csv_load", featureTypeName(st.type), "rows_" + to_string(rows),
+                       rows / secs, "rows_per_s"});
+        out.push_back({"csv_load", featureTypeName(st.type), "rows_" + to_string(rows),
+                       mb / secs, "MB_per_s"});
+    }
+    filesystem::remove(path);
+    return failures;
+}
+
+// matchFeatures latency against in-memory databases of growing size.
+static void suiteMatch(size_t maxRows, vector<BenchResult> &out) {
+    const int N = 10;
+
+    for (auto &st : SUITE_TYPES) {
+        for (size_t rows = 1000; rows <= maxRows; rows *= 10) {
+            string param = "rows_" + to_string(rows);
+            int queries = rows >= 1000000 ? 5 : rows >= 100000 ? 20 : 100;
+
+            FeatureMatrix db = syntheticFeatures(st.type, st.dim, rows);
+            ImageFeature target = db.feature(rows / 2);
+            auto t0 = chrono::steady_clock::now();
+            for (int q = 0; q < queries; q++) matchFeatures(target, db.view(), N);
+            out.push_back({"match_store", featureTypeName(st.type), param,
+                           secondsSince(t0) * 1e3 / queries, "ms_per_query"});
+
+            // Share of row values the early-abandoning distances skipped.
+            if (st.type != DNN_EMB) {
+                bool wasOn = metricsEnabled();
+                setMetricsEnabled(true);
+                uint64_t before = metricCount(COUNTER_VALUES_SKIPPED);
+                matchFeatures(target, db.view(), N);
+                double skipped = double(metricCount(COUNTER_VALUES_SKIPPED) - before);
+                setMetricsEnabled(wasOn);
+                out.push_back({"match_pruned", featureTypeName(st.type), param,
+                               100.0 * skipped / (double(rows) * st.dim), "pct_values_skipped"});
+            }
+        }
+    }
+
+    // Dense and sparse scans of multi-histograms about as empty as real ones.
+    for (size_t rows = 1000; rows <= maxRows; rows *= 10) {
+        string param = "rows_" + to_string(rows);
+        int queries = rows >= 1000000 ? 5 : rows >= 100000 ? 20 : 100;
+
+        FeatureMatrix dense = syntheticFeatures(MULTIHIST, 1024, rows, 0.25f);
+        FeatureMatrix sparse = sparseCopy(dense.view());
+        ImageFeature target = dense.feature(rows / 2);
+        for (const FeatureMatrix *db : {&dense, &sparse}) {
+            const char *name = db->sparse() ? "match_sparse" : "match_dense";
+            auto t0 = chrono::steady_clock::now();
+            for (int q = 0; q < queries; q++) matchFeatures(target, db->view(), N);
+            out.push_back({name, "multihist_fill25", param,
+                           secondsSince(t0) * 1e3 / queries, "ms_per_query"});
+            out.push_back({name, "multihist_fill25", param,
+                           double(db->rowBytes()) / rows, "bytes_per_row"});
+        }
+    }
+}
+
+static vector<BenchResult> readResults(const string &filename) {
+    vector<BenchResult> results;
+    ifstream in(filename);
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#' || line.rfind("group,", 0) == 0) continue;
+        stringstream ss(line);
+        BenchResult r;
+        string value;
+        getline(ss, r.group, ',');
+        getline(ss, r.name, ',');
+        getline(ss, r.param, ',');
+        getline(ss, value, ',');
+        getline(ss, r.unit, ',');
+        r.value = atof(value.c_str());
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Print the change of every result present in the baseline; returns the
+// number that got worse by more than tolerance.
+static int compareResults(const vector<BenchResult> &current, const vector<BenchResult> &baseline,
+                          double tolerance) {
+    map<string, double> before;
+    for (auto &r : baseline) before[r.group + "," + r.name + "," + r.param + "," + r.unit] = r.value;
+
+    int regressions = 0;
+    fprintf(stderr, "group,name,param,unit,baseline,current,change,status\n");
+    for (auto &r : current) {
+        string key = r.group + "," + r.name + "," + r.param + "," + r.unit;
+        auto it = before.find(key);
+        if (it == before.end() || it->second <= 0) continue;
+
+        double change = r.value / it->second - 1;
+        double worse = higherIsBetter(r.unit) ? -change : change;
+        bool regressed = worse > tolerance;
+        regressions += regressed;
+        fprintf(stderr, "%s,%.4g,%.4g,%+.1f%%,%s\n", key.c_str(), it->second, r.value,
+                change * 100, regressed ? "REGRESSION" : worse < -tolerance ? "improved" : "ok");
+    }
+    fprintf(stderr, "# %d regressions beyond %.0f%%\n", regressions, tolerance * 100);
+    return regressions;
+}
+
+// Value of option `name` after --suite, or def if absent.
+static const char *suiteOption(int argc, char *argv[], const char *name, const char *def) {
+    for (int i = 2; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return def;
+}
+
+// All near-duplicate pairs among random hashes with 1% planted copies
+// a few bits off, against comparing every pair where that is affordable.
+// Returns the number of sizes at which the two disagree.
+static size_t suiteDuplicates(size_t maxRows, vector<BenchResult> &out) {
+    mt19937_64 rng(13);
+    size_t failures = 0;
+    for (size_t rows = 10000; rows <= maxRows; rows *= 10) {
+        vector<uint64_t> hashes(rows);
+        for (auto &h : hashes) h = rng();
+        for (size_t i = 0; i < rows / 100; i++) {
+            uint64_t h = hashes[rng() % rows];
+            for (int f = int(rng() % 5); f > 0; f--) h ^= uint64_t(1) << (rng() % 64);
+            hashes[rng() % rows] = h;
+        }
+
+        string param = "rows_" + to_string(rows);
+        size_t found = 0;
+        for (int radius : {4, DEFAULT_DUP_RADIUS}) {
+            DuplicateStats stats;
+            auto t0 = chrono::steady_clock::now();
+            found = findNearDuplicates(hashes, radius, 0, &stats).size();
+            double ms = secondsSince(t0) * 1e3;
+            string name = "radius_" + to_string(radius);
+            out.push_back({"dedup_index", name, param, ms, "ms"});
+            out.push_back({"dedup_index", name, param, double(stats.candidates) / rows, "compares_per_row"});
+        }
+        if (rows <= 100000) {
+            auto t0 = chrono::steady_clock::now();
+            size_t pairs = 0;
+            for (size_t a = 0; a < rows; a++) {
+                for (size_t b = a + 1; b < rows; b++) pairs += hammingDistance(hashes[a], hashes[b]) <= DEFAULT_DUP_RADIUS;
+            }
+            double ms = secondsSince(t0) * 1e3;
+            if (pairs != found) {
+                fprintf(stderr, "dedup: index found %zu of %zu pairs\n", found, pairs);
+                failures++;
+            }
+            out.push_back({"dedup_exhaustive", "radius_" + to_string(DEFAULT_DUP_RADIUS), param, ms, "ms"});
+        }
+    }
+    return failures;
+}
+
+// matchSharded over a store cut into 16 MB shards, at a budget of one shard
+// and of several, against matchFeatures on the same store mapped whole.
+// Returns the number of queries that ranked differently, or 1 if the
+// shards could not be written.
+static size_t suiteShards(size_t maxRows, vector<BenchResult> &out) {
+    const int N = 10;
+    const size_t shardBytes = size_t(16) << 20;
+    size_t rows = min<size_t>(maxRows, 250000);
+    string stem = (filesystem::temp_directory_path() / "cbir_bench_shards").string();
+
+    FeatureMatrix db = syntheticFeatures(COLOR, 256, rows);
+    ShardedStore shards;
+    if (!writeShardedStore(stem, db.view(), shardBytes) || !readShardManifest(stem + ".shards", shards)) {
+        fprintf(stderr, "shards: could not write %s.shards\n", stem.c_str());
+        return 1;
+    }
+    ImageFeature target = db.feature(rows / 2);
+    vector<Match> expected = matchFeatures(target, db.view(), N);
+
+    string param = "rows_" + to_string(rows);
+    size_t failures = 0;
+    for (size_t budget : {shardBytes, 8 * shardBytes}) {
+        string name = "budget_" + to_string(budget >> 20) + "mb";
+        const int queries = 5;
+        uint64_t bytes = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int q = 0; q < queries; q++) {
+            ShardScanStats stats;
+            vector<Match> matches = matchSharded(target, shards, N, budget, 0, NO_ROW, &stats);
+            bytes += stats.bytes;
+            bool same = matches.size() == expected.size();
+            for (size_t i = 0; same && i < matches.size(); i++) same = matches[i].name == expected[i].name;
+            if (!same) {
+                fprintf(stderr, "shards: %s ranking differs from matchFeatures\n", name.c_str());
+                failures++;
+            }
+        }
+        double secs = secondsSince(t0);
+        out.push_back({"shard_stream", name, param, secs * 1e3 / queries, "ms_per_query"});
+        out.push_back({"shard_stream", name, param, bytes / 1e6 / secs, "MB_per_s"});
+    }
+
+    for (auto &s : shards.shards) filesystem::remove(s.path);
+    filesystem::remove(stem + ".shards");
+    return failures;
+}
+
+static int runSuite(int argc, char *argv[]) {
+    string imagesDir = suiteOption(argc, argv, "--images", "images");
+    size_t maxRows = strtoull(suiteOption(argc, argv, "--max-rows", "100000"), nullptr, 10);
+    const char *outPath = suiteOption(argc, argv, "--out", nullptr);
+    const char *baselinePath = suiteOption(argc, argv, "--baseline", nullptr);
+    double tolerance = atof(suiteOption(argc, argv, "--tolerance", "0.10"));
+
+    vector<BenchResult> results;
+    suiteExtractors(imagesDir, results);
+    suiteDistances(results);
+    size_t failures = suiteCsvLoad(results);
+    suiteMatch(maxRows, results);
+    failures += suiteDuplicates(maxRows, results);
+    failures += suiteShards(maxRows, results);
+
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "could not write %s\n", outPath);
+        return 1;
+    }
+    fprintf(out, "# kernels=%s threads=%u\n", activeKernels().name, thread::hardware_concurrency());
+    fprintf(out, "group,name,param,value,unit\n");
+    for (auto &r : results) {
+        fprintf(out, "%s,%s,%s,%.6g,%s\n", r.group.c_str(), r.name.c_str(), r.param.c_str(),
+                r.value, r.unit.c_str());
+    }
+    if (out != stdout) fclose(out);
+
+    // Results that disagree with their reference fail the run like
+    // timing regressions do.
+    int status = 0;
+    if (failures > 0) {
+        fprintf(stderr, "# %zu correctness checks failed\n", failures);
+        status = 1;
+    }
+    if (baselinePath) {
+        vector<BenchResult> baseline = readResults(baselinePath);
+        if (baseline.empty()) {
+            fprintf(stderr, "no results in %s\n", baselinePath);
+            return 1;
+        }
+        if (compareResults(results, baseline, tolerance) > 0) status = 1;
+    }
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--suite") == 0) {
+        return runSuite(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--hnsw") == 0) {
+        return runHnswReport(argv[2], argc >= 4 ? size_t(atoi(argv[3])) : 10);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--quantize") == 0) {
+        return runQuantizeReport(argv[2], argc >= 4 ? size_t(atoi(argv[3])) : 10);
+    }
+
+    const size_t rows = 1 << 16;
+    BenchData baseline = makeData(147, rows, false);
+    BenchData hist = makeData(256, rows, true);
+    BenchData ct = makeData(528, rows, true);
+    BenchData emb = makeData(512, rows, false);
+
+    const DistanceKernels &ref = scalarKernels();
+
+    // A kernel set that disagrees with the scalar reference fails the run.
+    bool ok = true;
+    vector<double> ctRest = suffixMass(&ct.f32[ct.rows * ct.dim], ct.dim);
+    printf("kernel,isa,dim,rows,ns_per_row,GBps,max_abs_err,tolerance\n");
+    for (const DistanceKernels *k : availableKernels()) {
+        ok &= runKernel("ssd_u8", k->name, baseline, baseline.u8, k->ssdU8, ref.ssdU8, TOL_EXACT);
+        ok &= runKernel("hist_intersection_f32", k->name, hist, hist.f32,
+                        k->histIntersectionF32, ref.histIntersectionF32, TOL_HIST);
+        ok &= runKernel("hist_intersection_f32", k->name, ct, ct.f32,
+                        k->histIntersectionF32, ref.histIntersectionF32, TOL_HIST);
+        ok &= runKernel("cosine_f32", k->name, emb, emb.f32,
+                        k->cosineDistanceF32, ref.cosineDistanceF32, TOL_COSINE);
+        ok &= runKernel("dot_f32", k->name, emb, emb.f32, k->dotF32, ref.dotF32, TOL_DOT);
+
+        ok &= runBounded("ssd_u8_bounded", k->name, baseline, baseline.u8, k->ssdU8Bounded,
+                         ref.ssdU8, TOL_EXACT);
+        auto histBounded = k->histIntersectionF32Bounded;
+        ok &= runBounded("hist_intersection_f32_bounded", k->name, ct, ct.f32,
+                         [&](const float *a, const float *b, size_t n, double bound, size_t *done) {
+                             return histBounded(a, b, n, ctRest.data(), bound, done);
+                         }, ref.histIntersectionF32, TOL_HIST);
+
+        // The four-row kernels get the query four times; a row's time
+        // covers all four results and is checked by the last.
+        typedef function<double(const float *, const float *, size_t)> F32Kernel;
+        auto lastOfFour = [](void (*x4)(const float *const[4], const float *, size_t, double[4])) {
+            return F32Kernel([x4](const float *q, const float *row, size_t n) {
+                const float *rows[4] = {q, q, q, q};
+                double out[4];
+                x4(rows, row, n, out);
+                return out[3];
+            });
+        };
+        ok &= runKernel("hist_intersection_f32_x4", k->name, ct, ct.f32,
+                        lastOfFour(k->histIntersectionF32x4), F32Kernel(ref.histIntersectionF32), TOL_HIST);
+        ok &= runKernel("dot_f32_x4", k->name, emb, emb.f32, lastOfFour(k->dotF32x4),
+                        F32Kernel(ref.dotF32), TOL_DOT);
+    }
+    printf("# active kernels: %s\n", activeKernels().name);
+
+    runExtractors();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,704 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: cli.cpp
+//
+// Headless front end to the retrieval core, for servers without Qt.
+//
+//   Project2Cli extract <imageDir> [--threads T] [--graphs]
+//                       [--decode-scale 1|2|4|8] [--max-side S]
+//       Brings the default feature stores in the working directory up to
+//       date with imageDir, as "Extract Features (All)" does in the GUI.
+//       The histogram stores can be extracted from a reduced decode.
+//
+//   Project2Cli query <store.bin|features.csv|dnn.sq8|dnn.pq> <targets.txt>
+//                     [--n N] [--image-dir DIR] [--format csv|jsonl] [--out FILE]
+//                     [--cascade COARSE [--shortlist K]] [--rerank R] [--ef E]
+//   Project2Cli query <store.shards> <targets.txt> [--memory-mb M] [...]
+//       Runs every target named in targets.txt (one per line) against the
+//       store and writes the top N of each as CSV or JSON lines. Prints
+//       queries/sec and p50/p99 latency to stderr. With --cascade, each
+//       query shortlists K images by the COARSE database and re-ranks only
+//       those by the store. A quantized DNN store (written by
+//       Project2Bench --quantize) is searched by its codes, and the best R
+//       (default 100) are re-ranked exactly against the .bin store beside
+//       it; --rerank 0 skips that. A DNN store with a current .hnsw index
+//       is searched with width E (default 64). A sharded store is streamed
+//       from disk per query with at most M MB of shards mapped (default
+//       256), and the disk rate is printed as well.
+//
+//   Project2Cli index --hnsw <dnn.bin> [--m M] [--ef-construction E]
+//       Builds <dnn>.hnsw for a DNN_EMB store, or inserts the rows added
+//       since it was last built; rows removed or changed since then force
+//       a rebuild. M and E apply to a new index only.
+//
+//   Project2Cli shard <store.bin> [--shard-mb S]
+//       Splits a binary store into shard files of at most S MB (default
+//       64) listed by <store>.shards, for stores too large to keep mapped.
+//
+//   Project2Cli cascade-report <coarse> <fine> [--n N] [--shortlist K,K,...]
+//                              [--queries Q] [--threads T]
+//       Compares cascade rankings at each shortlist size with exhaustive
+//       rankings by the fine database: recall of the top N, time per query
+//       and the row values a cascade query compares (after early
+//       abandoning) as a fraction of those an exhaustive query compares.
+//
+//   Project2Cli duplicates <dhash|phash store> [--radius R] [--out FILE]
+//                          [--threads T] [--exhaustive]
+//       Finds every pair of images whose perceptual hashes differ in at
+//       most R bits and writes the clusters they form as CSV (default
+//       duplicates.csv). --exhaustive also compares every pair directly
+//       and checks that the indexed search found the same pairs.
+//
+//   Project2Cli decode-report <imageDir> [--n N] [--queries Q] [--threads T]
+//       Extracts the histogram descriptors at full resolution and at each
+//       reduced decode scale, and prints how well the reduced rankings
+//       agree with the full-resolution ones along with the extraction time.
+//
+//   A CSV database's feature type is guessed from its file name ("hist",
+//   "multihist", "ct", ...); query, cascade-report and duplicates take
+//   --type T (and --coarse-type T for the coarse database) to name it, T
+//   being baseline, color, multihist, color_texture, custom, dnn_emb,
+//   grid_2x2, grid_3x3, pyramid, dhash or phash.
+//
+//   Any command also accepts --metrics json|prometheus [--metrics-out FILE]
+//   to dump the per-stage timings and counters when it finishes.
+
+#include "dedup_utils.h"
+#include "distance_kernels.h"
+#include "extract_pipeline.h"
+#include "feature_cache.h"
+#include "knn_graph.h"
+#include "manifest_utils.h"
+#include "metrics.h"
+#include "shard_store.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sys/mman.h>
+
+using namespace std;
+
+static int usage() {
+    fprintf(stderr,
+            "usage: Project2Cli extract <imageDir> [--threads T] [--graphs]\n"
+            "                           [--decode-scale 1|2|4|8] [--max-side S]\n"
+            "       Project2Cli query <store.bin|features.csv|dnn.sq8|dnn.pq> <targets.txt>\n"
+            "                         [--n N] [--image-dir DIR] [--format csv|jsonl] [--out FILE]\n"
+            "                         [--cascade COARSE [--shortlist K]] [--rerank R] [--ef E]\n"
+            "       Project2Cli query <store.shards> <targets.txt> [--memory-mb M] [...]\n"
+            "       Project2Cli index --hnsw <dnn.bin> [--m M] [--ef-construction E]\n"
+            "       Project2Cli shard <store.bin> [--shard-mb S]\n"
+            "       Project2Cli cascade-report <coarse> <fine> [--n N] [--shortlist K,K,...]\n"
+            "                                  [--queries Q] [--threads T]\n"
+            "       Project2Cli duplicates <dhash|phash store> [--radius R] [--out FILE]\n"
+            "                              [--threads T] [--exhaustive]\n"
+            "       Project2Cli decode-report <imageDir> [--n N] [--queries Q] [--threads T]\n"
+            "       CSV databases: [--type T] [--coarse-type T]\n"
+            "       any command: [--metrics json|prometheus] [--metrics-out FILE]\n");
+    return 2;
+}
+
+// Value of option `name` in argv[first..argc), or def if absent.
+static const char *option(int argc, char *argv[], int first, const char *name, const char *def) {
+    for (int i = first; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return def;
+}
+
+static bool flag(int argc, char *argv[], int first, const char *name) {
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return true;
+    }
+    return false;
+}
+
+// Set the CSV feature type of path from option `name` (a featureTypeName
+// such as "color_texture"), if given. Returns false if it names no type.
+static bool typeOption(int argc, char *argv[], int first, const char *name,
+                       const string &path, FeatureCache &cache) {
+    const char *value = option(argc, argv, first, name, nullptr);
+    if (!value) return true;
+    for (int t = 0; t <= LAST_FEATURE_TYPE; t++) {
+        if (strcmp(value, featureTypeName(FeatureType(t))) == 0) {
+            cache.setFeatureType(path, FeatureType(t));
+            return true;
+        }
+    }
+    return false;
+}
+
+static int runExtract(int argc, char *argv[]) {
+    if (argc < 3) return usage();
+    string dir = argv[2];
+
+    ExtractOptions opts;
+    opts.threads = atoi(option(argc, argv, 3, "--threads", "0"));
+    opts.decode.factor = atoi(option(argc, argv, 3, "--decode-scale", "1"));
+    opts.decode.maxSide = atoi(option(argc, argv, 3, "--max-side", "0"));
+    int f = opts.decode.factor;
+    if ((f != 1 && f != 2 && f != 4 && f != 8) || opts.decode.maxSide < 0) return usage();
+
+    auto start = chrono::steady_clock::now();
+    UpdateStats stats = updateFeatureStores(dir, defaultStoreSpecs(), opts);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!stats.listError.empty()) {
+        fprintf(stderr, "%s\n", stats.listError.c_str());
+        return 1;
+    }
+
+    fprintf(stderr, "%zu added, %zu modified, %zu removed, %zu unchanged in %.2f s\n",
+            stats.added, stats.modified, stats.removed, stats.unchanged, secs);
+
+    if (flag(argc, argv, 3, "--graphs")) {
+        for (auto &spec : defaultStoreSpecs()) {
+            FeatureStore store;
+            if (!store.open(spec.stem + ".bin")) continue;
+            KnnGraph graph = buildKnnGraph(store.view(), DEFAULT_GRAPH_K, opts.threads);
+            if (!replaceFile(spec.stem + ".knn", [&](const string &tmp) { return writeKnnGraph(tmp, graph); })) {
+                fprintf(stderr, "could not write %s.knn\n", spec.stem.c_str());
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Extract types from dir at one decode scale; returns the wall time in seconds.
+static double timedExtract(const string &dir, const vector<FeatureType> &types,
+                           const DecodeScale &decode, int threads,
+                           map<FeatureType, FeatureMatrix> &out) {
+    ExtractOptions opts;
+    opts.threads = threads;
+    opts.decode = decode;
+    auto start = chrono::steady_clock::now();
+    out = extractDirParallel(dir, types, opts);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static int runDecodeReport(int argc, char *argv[]) {
+    if (argc < 3) return usage();
+    string dir = argv[2];
+    int N = atoi(option(argc, argv, 3, "--n", "10"));
+    size_t maxQueries = size_t(atol(option(argc, argv, 3, "--queries", "200")));
+    int threads = atoi(option(argc, argv, 3, "--threads", "0"));
+    if (N <= 0 || maxQueries == 0) return usage();
+
+    vector<FeatureType> types;
+    for (auto &spec : defaultStoreSpecs()) {
+        if (scaleTolerant(spec.type)) types.push_back(spec.type);
+    }
+
+    map<FeatureType, FeatureMatrix> full;
+    double fullSecs = timedExtract(dir, types, DecodeScale(), threads, full);
+    if (full.empty()) {
+        fprintf(stderr, "could not list %s\n", dir.c_str());
+        return 1;
+    }
+    size_t images = full.at(types[0]).count();
+    if (images < 2) {
+        fprintf(stderr, "need at least two images in %s\n", dir.c_str());
+        return 1;
+    }
+    fprintf(stderr, "full resolution: %zu images in %.2f s\n", images, fullSecs);
+
+    printf("scale,descriptor,queries,overlap_at_n,top1_agree,extract_s,speedup\n");
+    for (int factor : {2, 4, 8}) {
+        DecodeScale decode;
+        decode.factor = factor;
+        map<FeatureType, FeatureMatrix> reduced;
+        double secs = timedExtract(dir, types, decode, threads, reduced);
+        if (reduced.empty()) {
+            fprintf(stderr, "could not list %s\n", dir.c_str());
+            return 1;
+        }
+
+        for (FeatureType type : types) {
+            // Compare only the images both passes decoded, in the same order.
+            const FeatureView &all = reduced.at(type).view();
+            map<string, size_t> reducedRow;
+            for (size_t i = 0; i < all.count; i++) reducedRow[string(all.name(i))] = i;
+
+            const FeatureView &src = full.at(type).view();
+            FeatureMatrix a(type), b(type);
+            for (size_t i = 0; i < src.count; i++) {
+                auto it = reducedRow.find(string(src.name(i)));
+                if (it == reducedRow.end()) continue;
+                a.addRow(src, i);
+                b.addRow(all, it->second);
+            }
+
+            size_t queries = min(maxQueries, a.count());
+            size_t step = max<size_t>(1, a.count() / max<size_t>(1, queries));
+            double overlap = 0;
+            size_t top1 = 0, run = 0;
+            for (size_t q = 0; q < a.count() && run < queries; q += step, run++) {
+                vector<Match> ma = matchFeatures(a.feature(q), a.view(), N, threads, q);
+                vector<Match> mb = matchFeatures(b.feature(q), b.view(), N, threads, q);
+                set<string> names;
+                for (auto &m : ma) names.insert(m.name);
+                size_t shared = 0;
+                for (auto &m : mb) shared += names.count(m.name);
+                overlap += ma.empty() ? 1.0 : double(shared) / ma.size();
+                if (!ma.empty() && !mb.empty() && ma[0].name == mb[0].name) top1++;
+            }
+
+            printf("1/%d,%s,%zu,%.4f,%.4f,%.3f,%.2f\n", factor, featureTypeName(type), run,
+                   run ? overlap / run : 0.0, run ? double(top1) / run : 0.0,
+                   secs, secs > 0 ? fullSecs / secs : 0.0);
+        }
+    }
+    return 0;
+}
+
+static double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static int runCascadeReport(int argc, char *argv[]) {
+    if (argc < 4) return usage();
+    string coarsePath = argv[2], finePath = argv[3];
+    int N = atoi(option(argc, argv, 4, "--n", "10"));
+    string sizes = option(argc, argv, 4, "--shortlist", "50,100,200,500,1000");
+    size_t maxQueries = size_t(atol(option(argc, argv, 4, "--queries", "200")));
+    int threads = atoi(option(argc, argv, 4, "--threads", "0"));
+    if (N <= 0 || maxQueries == 0) return usage();
+
+    vector<size_t> shortlists;
+    for (size_t pos = 0; pos < sizes.size();) {
+        size_t comma = sizes.find(',', pos);
+        if (comma == string::npos) comma = sizes.size();
+        long k = atol(sizes.substr(pos, comma - pos).c_str());
+        if (k <= 0) return usage();
+        shortlists.push_back(size_t(k));
+        pos = comma + 1;
+    }
+
+    FeatureCache cache;
+    if (!typeOption(argc, argv, 4, "--coarse-type", coarsePath, cache)
+        || !typeOption(argc, argv, 4, "--type", finePath, cache)) return usage();
+    const ResidentDatabase *coarse = cache.database(coarsePath);
+    const ResidentDatabase *fine = cache.database(finePath);
+    if (!coarse || !fine) {
+        fprintf(stderr, "could not open %s\n", !coarse ? coarsePath.c_str() : finePath.c_str());
+        return 1;
+    }
+    const FeatureView &coarseRows = coarse->view(), &fineRows = fine->view();
+    vector<size_t> rowMap = alignRows(coarseRows, fineRows);
+
+    // Query with every step-th coarse row that the fine database also holds.
+    vector<size_t> queryRows;
+    size_t step = max<size_t>(1, coarseRows.count / maxQueries);
+    for (size_t i = 0; i < coarseRows.count && queryRows.size() < maxQueries; i += step) {
+        if (rowMap[i] != NO_ROW) queryRows.push_back(i);
+    }
+    if (queryRows.empty()) {
+        fprintf(stderr, "no images in common between %s and %s\n", coarsePath.c_str(), finePath.c_str());
+        return 1;
+    }
+
+    // Work is counted in row values compared: each exhaustive query's
+    // values less those its early-abandoning distances skipped.
+    uint64_t fineValues = 0;
+    for (size_t i = 0; i < fineRows.count; i++) fineValues += fineRows.values(i);
+    bool wasOn = metricsEnabled();
+    setMetricsEnabled(true);
+    uint64_t skippedBefore = metricCount(COUNTER_VALUES_SKIPPED);
+
+    vector<vector<Match>> exact;
+    double exactValues = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t q : queryRows) {
+        exact.push_back(matchFeatures(fine->row(rowMap[q]), fineRows, N, threads, rowMap[q]));
+        exactValues += double(fineValues - fineRows.values(rowMap[q]));
+    }
+    double exactMs = msSince(start) / queryRows.size();
+    exactValues -= double(metricCount(COUNTER_VALUES_SKIPPED) - skippedBefore);
+    setMetricsEnabled(wasOn);
+    fprintf(stderr, "%zu queries; exhaustive %s over %zu rows: %.3f ms/query\n", queryRows.size(),
+            featureTypeName(fineRows.type), fineRows.count, exactMs);
+
+    printf("shortlist,coarse,fine,queries,recall_at_n,top1_agree,exhaustive_ms,cascade_ms,speedup,work_fraction\n");
+    for (size_t k : shortlists) {
+        double recall = 0, cascadeMs = 0, cascadeValues = 0;
+        size_t top1 = 0;
+        for (size_t j = 0; j < queryRows.size(); j++) {
+            size_t q = queryRows[j];
+            ImageFeature coarseTarget = coarse->row(q), fineTarget = fine->row(rowMap[q]);
+            CascadeStats work;
+            auto t0 = chrono::steady_clock::now();
+            vector<Match> got = matchCascade(coarseTarget, coarseRows, fineTarget, fineRows, rowMap, N, k,
+                                             threads, q, &work);
+            cascadeMs += msSince(t0);
+            cascadeValues += double(work.coarseValues + work.fineValues);
+
+            set<string> names;
+            for (auto &m : exact[j]) names.insert(m.name);
+            size_t shared = 0;
+            for (auto &m : got) shared += names.count(m.name);
+            recall += exact[j].empty() ? 1.0 : double(shared) / exact[j].size();
+            if (!exact[j].empty() && !got.empty() && exact[j][0].name == got[0].name) top1++;
+        }
+        cascadeMs /= queryRows.size();
+
+        printf("%zu,%s,%s,%zu,%.4f,%.4f,%.3f,%.3f,%.2f,%.4f\n", k, featureTypeName(coarseRows.type),
+               featureTypeName(fineRows.type), queryRows.size(), recall / queryRows.size(),
+               double(top1) / queryRows.size(), exactMs, cascadeMs,
+               cascadeMs > 0 ? exactMs / cascadeMs : 0.0, exactValues > 0 ? cascadeValues / exactValues : 0.0);
+    }
+    return 0;
+}
+
+static int runDuplicates(int argc, char *argv[]) {
+    if (argc < 3) return usage();
+    string path = argv[2];
+    int radius = atoi(option(argc, argv, 3, "--radius", to_string(DEFAULT_DUP_RADIUS).c_str()));
+    string out = option(argc, argv, 3, "--out", "duplicates.csv");
+    int threads = atoi(option(argc, argv, 3, "--threads", "0"));
+    if (radius < 0 || radius > 64) return usage();
+
+    FeatureCache cache;
+    if (!typeOption(argc, argv, 3, "--type", path, cache)) return usage();
+    const ResidentDatabase *db = cache.database(path);
+    if (!db) {
+        fprintf(stderr, "could not open %s\n", path.c_str());
+        return 1;
+    }
+    vector<uint64_t> hashes = rowHashes(db->view());
+    if (hashes.size() != db->view().count) {
+        fprintf(stderr, "%s is not a dhash or phash store\n", path.c_str());
+        return 1;
+    }
+
+    DuplicateStats stats;
+    auto start = chrono::steady_clock::now();
+    vector<DuplicatePair> pairs = findNearDuplicates(hashes, radius, threads, &stats);
+    double ms = msSince(start);
+    auto clusters = clusterDuplicates(hashes.size(), pairs);
+
+    size_t clustered = 0;
+    for (auto &c : clusters) clustered += c.size();
+    fprintf(stderr, "%zu images, radius %d: %zu pairs, %zu clusters holding %zu images\n",
+            hashes.size(), radius, pairs.size(), clusters.size(), clustered);
+    fprintf(stderr, "%d tables probed to %d bits: %zu candidates compared in %.2f ms\n",
+            stats.tables, stats.subRadius, stats.candidates, ms);
+
+    if (flag(argc, argv, 3, "--exhaustive")) {
+        start = chrono::steady_clock::now();
+        size_t found = 0, missed = 0, next = 0;
+        for (size_t a = 0; a < hashes.size(); a++) {
+            for (size_t b = a + 1; b < hashes.size(); b++) {
+                if (hammingDistance(hashes[a], hashes[b]) > radius) continue;
+                found++;
+                while (next < pairs.size() && (pairs[next].a < a || (pairs[next].a == a && pairs[next].b < b))) next++;
+                if (next == pairs.size() || pairs[next].a != a || pairs[next].b != b) missed++;
+            }
+        }
+        fprintf(stderr, "exhaustive: %zu pairs in %.2f ms, %zu missed by the index\n",
+                found, msSince(start), missed);
+        if (missed || found != pairs.size()) return 1;
+    }
+
+    if (!writeDuplicateReport(out, db->view(), hashes, clusters)) {
+        fprintf(stderr, "could not write %s\n", out.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static int runShard(int argc, char *argv[]) {
+    if (argc < 3) return usage();
+    string path = argv[2];
+    double shardMb = atof(option(argc, argv, 3, "--shard-mb", to_string(DEFAULT_SHARD_BYTES >> 20).c_str()));
+    if (shardMb <= 0) return usage();
+    string stem = path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0
+        ? path.substr(0, path.size() - 4) : path;
+
+    FeatureStore store;
+    if (!store.open(path)) {
+        fprintf(stderr, "could not open %s\n", path.c_str());
+        return 1;
+    }
+    store.advise(MADV_SEQUENTIAL);
+
+    auto start = chrono::steady_clock::now();
+    ShardedStore shards;
+    if (!writeShardedStore(stem, store.view(), size_t(shardMb * (1 << 20)))
+        || !readShardManifest(stem + ".shards", shards)) {
+        fprintf(stderr, "could not write %s.shards\n", stem.c_str());
+        return 1;
+    }
+    fprintf(stderr, "%zu rows in %zu shards listed in %s.shards, written in %.2f s\n",
+            shards.count, shards.shards.size(), stem.c_str(), msSince(start) / 1e3);
+    return 0;
+}
+
+static int runIndex(int argc, char *argv[]) {
+    if (argc < 4 || strcmp(argv[2], "--hnsw") != 0) return usage();
+    string path = argv[3];
+    HnswParams params;
+    params.M = atoi(option(argc, argv, 4, "--m", to_string(params.M).c_str()));
+    params.efConstruction = atoi(option(argc, argv, 4, "--ef-construction", to_string(params.efConstruction).c_str()));
+    if (params.M <= 0 || params.efConstruction <= 0) return usage();
+    string stem = path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0
+        ? path.substr(0, path.size() - 4) : path;
+    string indexPath = stem + ".hnsw";
+
+    FeatureStore store;
+    if (!store.open(path) || store.view().type != DNN_EMB || store.view().elem != ELEM_F32) {
+        fprintf(stderr, "%s is not a DNN_EMB store\n", path.c_str());
+        return 1;
+    }
+    const FeatureView &db = store.view();
+
+    // Extend the index already built, unless it cannot be read.
+    HnswIndex index(db.dim, params);
+    if (ifstream(indexPath) && !index.open(indexPath)) {
+        fprintf(stderr, "%s is unreadable; rebuilding it\n", indexPath.c_str());
+    }
+    if (index.dim() != db.dim) {
+        fprintf(stderr, "%s has dim %zu but %s has dim %zu\n",
+                indexPath.c_str(), index.dim(), path.c_str(), db.dim);
+        return 1;
+    }
+    size_t before = index.size();
+
+    // Rows deleted or changed since the index was built force a rebuild.
+    auto start = chrono::steady_clock::now();
+    bool rebuilt = false;
+    if (!addStoreToHnsw(index, db, &rebuilt)) {
+        fprintf(stderr, "could not index %s\n", path.c_str());
+        return 1;
+    }
+    double secs = msSince(start) / 1e3;
+
+    // Write beside the index and rename over it, so a query never maps a
+    // half-written file.
+    if (!replaceFile(indexPath, [&](const string &tmp) { return index.save(tmp); })) {
+        fprintf(stderr, "could not write %s\n", indexPath.c_str());
+        return 1;
+    }
+    fprintf(stderr, "%zu rows in %s (%s, %zu inserted in %.2f s)\n", index.size(), indexPath.c_str(),
+            rebuilt ? "rebuilt" : "extended", rebuilt ? index.size() : index.size() - before, secs);
+    return 0;
+}
+
+// Match target against a sharded store. A target in the store is matched
+// by its stored row and left out of its own results, as FeatureCache::query
+// does; any other is decoded from imageDir at the store's decode scale.
+static bool queryShards(const ShardedStore &store, const string &target, const string &imageDir,
+                        int N, size_t budget, vector<Match> &matches, string &error,
+                        ShardScanStats &total) {
+    ImageFeature feat;
+    size_t self = findShardedRow(store, target, &feat);
+    if (self == NO_ROW) {
+        if (store.type == DNN_EMB) {
+            error = "Target not found in DNN database.";
+            return false;
+        }
+        Mat img = decodeImage(imageDir + "/" + target, store.decode);
+        if (img.empty()) {
+            error = "Target image not found in image folder.";
+            return false;
+        }
+        feat = computeFeatures(img, store.type, target);
+    }
+
+    ShardScanStats scan;
+    matches = matchSharded(feat, store, N, budget, 0, self, &scan);
+    total.shards += scan.shards;
+    total.bytes += scan.bytes;
+    total.peakMapped = max(total.peakMapped, scan.peakMapped);
+    if (scan.badShard != NO_ROW) {
+        error = "Could not read " + store.shards[scan.badShard].path + ".";
+        return false;
+    }
+    return true;
+}
+
+// Names in a targets file, one per line; blank lines are skipped.
+static vector<string> readTargets(const string &filename) {
+    vector<string> targets;
+    ifstream in(filename);
+    string line;
+    while (getline(in, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (!line.empty()) targets.push_back(line);
+    }
+    return targets;
+}
+
+static string jsonString(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Latency at quantile q of sorted samples (nearest rank).
+static double percentile(const vector<double> &sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t rank = size_t(ceil(q * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+}
+
+static int runQuery(int argc, char *argv[]) {
+    if (argc < 4) return usage();
+    string path = argv[2];
+    vector<string> targets = readTargets(argv[3]);
+    int N = atoi(option(argc, argv, 4, "--n", "10"));
+    string imageDir = option(argc, argv, 4, "--image-dir", ".");
+    string format = option(argc, argv, 4, "--format", "csv");
+    const char *outPath = option(argc, argv, 4, "--out", nullptr);
+    const char *coarsePath = option(argc, argv, 4, "--cascade", nullptr);
+    long shortlist = atol(option(argc, argv, 4, "--shortlist", to_string(DEFAULT_SHORTLIST).c_str()));
+    double memoryMb = atof(option(argc, argv, 4, "--memory-mb", to_string(DEFAULT_MEMORY_BUDGET >> 20).c_str()));
+    long rerank = atol(option(argc, argv, 4, "--rerank", to_string(DEFAULT_QUANT_RERANK).c_str()));
+    long ef = atol(option(argc, argv, 4, "--ef", to_string(HNSW_QUERY_EF).c_str()));
+    bool sharded = isShardManifest(path);
+
+    if (N <= 0 || (format != "csv" && format != "jsonl") || shortlist <= 0 || memoryMb <= 0 || rerank < 0
+        || ef <= 0 || (sharded && coarsePath)) return usage();
+
+    ofstream file;
+    if (outPath) {
+        file.open(outPath);
+        if (!file) {
+            fprintf(stderr, "could not write %s\n", outPath);
+            return 1;
+        }
+    }
+    ostream &out = outPath ? file : cout;
+
+    // Load the store (and any .knn/.hnsw beside it) before timing queries;
+    // a sharded store only has its manifest read.
+    FeatureCache cache;
+    cache.setQuantRerank(size_t(rerank));
+    cache.setHnswEf(size_t(ef));
+    if (!typeOption(argc, argv, 4, "--type", path, cache)
+        || (coarsePath && !typeOption(argc, argv, 4, "--coarse-type", coarsePath, cache))) return usage();
+    ShardedStore shards;
+    size_t budget = size_t(memoryMb * (1 << 20));
+    ShardScanStats scanned;
+    auto loadStart = chrono::steady_clock::now();
+    const ResidentDatabase *db = sharded ? nullptr : cache.database(path);
+    if (sharded ? !readShardManifest(path, shards) : !db) {
+        fprintf(stderr, "could not open %s\n", path.c_str());
+        return 1;
+    }
+    double loadSecs = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count();
+    if (sharded) {
+        fprintf(stderr, "%zu rows in %zu shards listed in %s, streamed within %.0f MB\n",
+                shards.count, shards.shards.size(), path.c_str(), memoryMb);
+    } else {
+        fprintf(stderr, "loaded %zu rows from %s in %.3f s\n", db->count(), path.c_str(), loadSecs);
+    }
+    if (db && db->csv.badRows) {
+        fprintf(stderr, "skipped %zu malformed rows (not %zu values; first at line %zu)\n",
+                db->csv.badRows, db->csv.dim, db->csv.firstBadLine);
+    }
+    if (coarsePath && !cache.database(coarsePath)) {
+        fprintf(stderr, "could not open %s\n", coarsePath);
+        return 1;
+    }
+
+    if (format == "csv") out << "target,rank,name,dist\n";
+
+    vector<double> latencies;
+    latencies.reserve(targets.size());
+    size_t failed = 0;
+
+    auto batchStart = chrono::steady_clock::now();
+    for (const string &target : targets) {
+        vector<Match> matches;
+        string error;
+
+        auto start = chrono::steady_clock::now();
+        bool ok = sharded
+            ? queryShards(shards, target, imageDir, N, budget, matches, error, scanned)
+            : coarsePath
+            ? cache.queryCascade(coarsePath, path, target, imageDir, N, size_t(shortlist), matches, error)
+            : cache.query(path, target, imageDir, N, matches, error);
+        latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+        if (!ok) {
+            fprintf(stderr, "%s: %s\n", target.c_str(), error.c_str());
+            failed++;
+            continue;
+        }
+
+        ScopedTimer timer(STAGE_RENDER);
+        if (format == "csv") {
+            for (size_t r = 0; r < matches.size(); r++) {
+                out << target << ',' << r + 1 << ',' << matches[r].name << ',' << matches[r].dist << '\n';
+            }
+        } else {
+            out << "{\"target\":" << jsonString(target) << ",\"matches\":[";
+            for (size_t r = 0; r < matches.size(); r++) {
+                if (r) out << ',';
+                out << "{\"name\":" << jsonString(matches[r].name) << ",\"dist\":" << matches[r].dist << '}';
+            }
+            out << "]}\n";
+        }
+    }
+    double batchSecs = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+
+    sort(latencies.begin(), latencies.end());
+    fprintf(stderr, "queries=%zu failed=%zu seconds=%.3f qps=%.1f p50_ms=%.3f p99_ms=%.3f\n",
+            targets.size(), failed, batchSecs,
+            batchSecs > 0 ? targets.size() / batchSecs : 0.0,
+            percentile(latencies, 0.50), percentile(latencies, 0.99));
+    if (sharded) {
+        fprintf(stderr, "streamed %zu shards, %.1f MB at %.1f MB/s; at most %.1f MB mapped\n",
+                scanned.shards, scanned.bytes / 1048576.0,
+                batchSecs > 0 ? scanned.bytes / 1048576.0 / batchSecs : 0.0, scanned.peakMapped / 1048576.0);
+    }
+    return failed == targets.size() && !targets.empty() ? 1 : 0;
+}
+
+// Write the metrics in the requested format to file, or stderr if none.
+static bool dumpMetrics(const string &format, const char *file) {
+    string text;
+    if (format == "json") text = metricsJson() + "\n";
+    else if (format == "prometheus") text = metricsPrometheus();
+    else return false;
+
+    if (!file) {
+        fputs(text.c_str(), stderr);
+        return true;
+    }
+    ofstream out(file);
+    out << text;
+    return bool(out);
+}
+
+int main(int argc, char *argv[]) {
+    const char *metrics = option(argc, argv, 2, "--metrics", nullptr);
+    const char *metricsOut = option(argc, argv, 2, "--metrics-out", nullptr);
+    if (metrics) setMetricsEnabled(true);
+
+    int status;
+    if (argc >= 2 && strcmp(argv[1], "extract") == 0) status = runExtract(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "query") == 0) status = runQuery(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "decode-report") == 0) status = runDecodeReport(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "cascade-report") == 0) status = runCascadeReport(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "duplicates") == 0) status = runDuplicates(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "shard") == 0) status = runShard(argc, argv);
+    else if (argc >= 2 && strcmp(argv[1], "index") == 0) status = runIndex(argc, argv);
+    else return usage();
+
+    if (metrics && !dumpMetrics(metrics, metricsOut)) {
+        fprintf(stderr, "could not write metrics\n");
+        return 1;
+    }
+    return status;
+}
@@ -0,0 +1,330 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: csv_utils.cpp
+//
+// Fast CSV reading and writing for feature databases. A file is mapped
+// (or read in one block if it cannot be) and cut into chunks at line
+// boundaries; each chunk is parsed on its own thread with from_chars
+// straight into matrix rows. Chunks are parsed a wave at a time and
+// appended in file order, so only one wave of parsed rows exists beyond
+// the result however large the file is.
+
+#include "csv_utils.h"
+#include "metrics.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Floating-point from_chars/to_chars: libstdc++ has them from GCC 11 but
+// only sets the feature macro later. Without them strtof/snprintf are used.
+#if defined(__cpp_lib_to_chars) || (defined(_GLIBCXX_RELEASE) && _GLIBCXX_RELEASE >= 11)
+#define CBIR_FLOAT_CHARCONV 1
+#endif
+
+// Text parsed per chunk; a wave is one chunk per thread.
+static const size_t CSV_CHUNK_BYTES = size_t(8) << 20;
+
+// Rows formatted per thread between writes.
+static const size_t CSV_WRITE_ROWS = 4096;
+
+namespace {
+
+// Contents of a file, mapped read-only or read into memory.
+class CsvInput {
+public:
+    ~CsvInput() {
+        if (map) munmap(map, len);
+    }
+
+    bool open(const string &filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+                map = p;
+                len = size_t(st.st_size);
+                ::close(fd);
+                return true;
+            }
+        }
+
+        // Pipes and anything else that cannot be mapped.
+        char block[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, block, sizeof(block))) > 0) copy.insert(copy.end(), block, block + n);
+        ::close(fd);
+        len = copy.size();
+        return n == 0;
+    }
+
+    const char *data() const { return map ? static_cast<const char *>(map) : copy.data(); }
+    size_t size() const { return len; }
+
+private:
+    void *map = nullptr;
+    size_t len = 0;
+    vector<char> copy;
+};
+
+// One chunk of whole lines and what parsing it produced.
+struct CsvChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    FeatureMatrix rows;
+    size_t lines = 0;
+    size_t badRows = 0;
+    size_t firstBad = 0; // 1-based line within the chunk
+};
+
+}
+
+static const char *parseNumber(const char *p, const char *end, float &v) {
+#ifdef CBIR_FLOAT_CHARCONV
+    auto r = std::from_chars(p, end, v);
+    return r.ec == std::errc() ? r.ptr : nullptr;
+#else
+    char tmp[64];
+    size_t n = 0;
+    while (p + n < end && n < sizeof(tmp) - 1 && p[n] != ',') {
+        tmp[n] = p[n];
+        n++;
+    }
+    tmp[n] = '\0';
+    char *stop;
+    v = strtof(tmp, &stop);
+    return stop == tmp ? nullptr : p + (stop - tmp);
+#endif
+}
+
+static const char *parseNumber(const char *p, const char *end, uint8_t &v) {
+    int i;
+    auto r = std::from_chars(p, end, i);
+    if (r.ec != std::errc()) return nullptr;
+    v = uint8_t(std::clamp(i, 0, 255));
+    return r.ptr;
+}
+
+// Split one line into its name and values. Blanks around values, a
+// leading '+' and one trailing comma are accepted, as getline/stod did.
+// Returns false on a malformed value or, when dim is not 0, a row of any
+// other length.
+template <typename T>
+static bool parseLine(const char *p, const char *end, size_t dim,
+                      std::string_view &name, vector<T> &vals) {
+    vals.clear();
+    const char *comma = static_cast<const char *>(memchr(p, ',', end - p));
+    if (!comma) return false;
+    name = std::string_view(p, comma - p);
+
+    p = comma + 1;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p < end && *p == '+') p++;
+
+        T v;
+        p = parseNumber(p, end, v);
+        if (!p) return false;
+        vals.push_back(v);
+        if (dim && vals.size() > dim) return false;
+
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p == end) break;
+        if (*p != ',') return false;
+        p++;
+    }
+    return !vals.empty() && (dim == 0 || vals.size() == dim);
+}
+
+// Next line in [p, end): its extent without "\r\n", and the start of the one after.
+static const char *nextLine(const char *p, const char *end, const char *&eol) {
+    const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+    eol = nl ? nl : end;
+    if (eol > p && eol[-1] == '\r') eol--;
+    return nl ? nl + 1 : end;
+}
+
+// Values per row, from the first line that parses; 0 if none does. The
+// length of that line is stored in lineBytes.
+static size_t detectDim(const char *p, const char *end, ElemType elem, size_t &lineBytes) {
+    std::string_view name;
+    vector<float> f32;
+    vector<uint8_t> u8;
+    while (p < end) {
+        const char *eol;
+        const char *next = nextLine(p, end, eol);
+        if (elem == ELEM_U8 ? parseLine(p, eol, 0, name, u8) : parseLine(p, eol, 0, name, f32)) {
+            lineBytes = size_t(next - p);
+            return elem == ELEM_U8 ? u8.size() : f32.size();
+        }
+        p = next;
+    }
+    return 0;
+}
+
+static void parseChunk(CsvChunk &c, FeatureType type, size_t dim) {
+    c.rows = FeatureMatrix(type, dim);
+    bool u8Rows = c.rows.elem() == ELEM_U8;
+    std::string_view name;
+    vector<float> f32;
+    vector<uint8_t> u8;
+
+    const char *p = c.begin;
+    while (p < c.end) {
+        const char *eol;
+        const char *next = nextLine(p, c.end, eol);
+        c.lines++;
+        if (eol > p) {
+            bool ok = u8Rows
+                ? parseLine(p, eol, dim, name, u8) && c.rows.addRow(name, u8.data(), u8.size())
+                : parseLine(p, eol, dim, name, f32) && c.rows.addRow(name, f32.data(), f32.size());
+            if (!ok) {
+                c.badRows++;
+                if (!c.firstBad) c.firstBad = c.lines;
+            }
+        }
+        p = next;
+    }
+}
+
+FeatureMatrix readFeatureCSV(const string &filename, FeatureType type,
+                             CsvStats *stats, int threads) {
+    ScopedTimer timer(STAGE_CSV_PARSE);
+    CsvStats local;
+    CsvStats &st = stats ? *stats : local;
+    st = CsvStats();
+
+    FeatureMatrix db(type);
+    CsvInput in;
+    if (!in.open(filename)) return db;
+
+    const char *pos = in.data();
+    const char *end = pos + in.size();
+    size_t firstRow = 0;
+    st.dim = detectDim(pos, end, db.elem(), firstRow);
+    if (st.dim == 0) return db;
+
+    // Size the result from the length of the first row, but never past the
+    // rows the file could hold at two bytes ("0,") per value.
+    size_t estimate = size_t(in.size() / std::max<size_t>(firstRow, 1) * 1.1) + 1;
+    size_t most = in.size() / (2 * st.dim + 1) + 1;
+    db = FeatureMatrix(type, st.dim);
+    db.reserve(std::min(estimate, most));
+
+    if (threads <= 0) threads = std::max(1u, thread::hardware_concurrency());
+
+    size_t lineBase = 0;
+    while (pos < end) {
+        vector<CsvChunk> wave;
+        while (pos < end && wave.size() < size_t(threads)) {
+            const char *stop = pos + std::min(CSV_CHUNK_BYTES, size_t(end - pos));
+            if (stop < end) {
+                const char *nl = static_cast<const char *>(memchr(stop, '\n', end - stop));
+                stop = nl ? nl + 1 : end;
+            }
+            wave.emplace_back();
+            wave.back().begin = pos;
+            wave.back().end = stop;
+            pos = stop;
+        }
+
+        if (wave.size() == 1) {
+            parseChunk(wave[0], type, st.dim);
+        } else {
+            vector<thread> workers;
+            for (auto &c : wave) workers.emplace_back(parseChunk, std::ref(c), type, st.dim);
+            for (auto &w : workers) w.join();
+        }
+
+        for (auto &c : wave) {
+            db.append(c.rows);
+            c.rows = FeatureMatrix();
+            if (c.badRows && !st.firstBadLine) st.firstBadLine = lineBase + c.firstBad;
+            st.badRows += c.badRows;
+            lineBase += c.lines;
+        }
+    }
+
+    st.rows = db.count();
+    return db;
+}
+
+// Read CSV produced by a DNN embedding extractor.
+FeatureMatrix readDNNCSV(const string &filename, CsvStats *stats) {
+    return readFeatureCSV(filename, DNN_EMB, stats);
+}
+
+static void appendNumber(string &out, float v) {
+    char buf[32];
+#ifdef CBIR_FLOAT_CHARCONV
+    char *e = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+#else
+    char *e = buf + snprintf(buf, sizeof(buf), "%.9g", v);
+#endif
+    out.append(buf, e);
+}
+
+static void appendNumber(string &out, uint8_t v) {
+    char buf[4];
+    char *e = std::to_chars(buf, buf + sizeof(buf), int(v)).ptr;
+    out.append(buf, e);
+}
+
+// Format rows [first, last) as CSV lines. Sparse rows are written out in full.
+static void formatRows(const FeatureView &rows, size_t first, size_t last, string &out) {
+    out.clear();
+    vector<float> dense(rows.elem == ELEM_SPARSE ? rows.dim : 0);
+    for (size_t r = first; r < last; r++) {
+        out += rows.name(r);
+        if (rows.elem == ELEM_SPARSE) rows.expand(r, dense.data());
+        for (size_t i = 0; i < rows.dim; i++) {
+            out += ',';
+            if (rows.elem == ELEM_U8) appendNumber(out, rows.u8(r)[i]);
+            else if (rows.elem == ELEM_SPARSE) appendNumber(out, dense[i]);
+            else appendNumber(out, rows.f32(r)[i]);
+        }
+        out += '\n';
+    }
+}
+
+// Write feature rows to CSV, formatting blocks of rows on all threads and
+// writing them in order.
+bool writeFeatureCSV(const string &filename, const FeatureView &rows, int threads) {
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) return false;
+
+    if (threads <= 0) threads = std::max(1u, thread::hardware_concurrency());
+    vector<string> parts(threads);
+    bool ok = true;
+
+    for (size_t first = 0; first < rows.count && ok; first += CSV_WRITE_ROWS * threads) {
+        auto format = [&](int t) {
+            size_t a = std::min(rows.count, first + t * CSV_WRITE_ROWS);
+            size_t b = std::min(rows.count, a + CSV_WRITE_ROWS);
+            formatRows(rows, a, b, parts[t]);
+        };
+
+        vector<thread> workers;
+        for (int t = 1; t < threads && first + t * CSV_WRITE_ROWS < rows.count; t++) {
+            workers.emplace_back(format, t);
+        }
+        format(0);
+        for (auto &w : workers) w.join();
+
+        for (int t = 0; t < threads && ok; t++) {
+            if (first + t * CSV_WRITE_ROWS >= rows.count) break;
+            ok = fwrite(parts[t].data(), 1, parts[t].size(), file) == parts[t].size();
+        }
+    }
+    return fclose(file) == 0 && ok;
+}
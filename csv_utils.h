@@ -0,0 +1,36 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: csv_utils.h
+//
+// Header file for csv_utils.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include "feature_utils.h"
+#include "feature_matrix.h"
+
+// What a CSV read found besides the rows it returned.
+struct CsvStats {
+    size_t rows = 0;         // rows read
+    size_t dim = 0;          // values per row, from the first well-formed row
+    size_t badRows = 0;      // rows skipped: wrong value count or a malformed value
+    size_t firstBadLine = 0; // 1-based line of the first skipped row, 0 if none
+};
+
+//Read a feature CSV ("name,v1,v2,..." per line). The file is mapped and
+//parsed in parallel chunks split at line boundaries. Every row must have
+//the dimension of the first well-formed row; rows that do not, or that
+//hold a malformed value, are skipped and counted in stats.
+//threads = 0 uses one parser per hardware thread.
+FeatureMatrix readFeatureCSV(const string &filename, FeatureType type,
+                             CsvStats *stats = nullptr, int threads = 0);
+
+//Read DNN embedding CSV file.
+FeatureMatrix readDNNCSV(const string &filename, CsvStats *stats = nullptr);
+
+//Write rows to a CSV file in the format readFeatureCSV reads. Float values
+//are written in their shortest round-trip form, so reading the file back
+//gives the same rows bit for bit.
+bool writeFeatureCSV(const string &filename, const FeatureView &rows, int threads = 0);
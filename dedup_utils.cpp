@@ -0,0 +1,277 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: dedup_utils.cpp
+//
+// Near-duplicate detection over perceptual hash stores. Hashes are indexed
+// by substring in a few direct-addressed bucket tables, so finding every
+// pair within a Hamming radius costs a handful of bucket probes per row
+// instead of a comparison against every other row.
+
+#include "dedup_utils.h"
+#include "distance_kernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+// Substring widths are kept to this many bits so a table's bucket starts
+// (4 bytes per possible substring) stay within 64 MB.
+static const int MAX_TABLE_BITS = 24;
+
+// Rows handed to a search thread at a time.
+static const size_t DUP_BLOCK = 1024;
+
+// Cost of probing one bucket relative to comparing one more hash; the
+// probe is usually a cache miss, the comparison a load and a popcount.
+static const double PROBE_COST = 8.0;
+
+namespace {
+
+// One substring of the hash and its rows grouped by substring value:
+// rows[start[k] .. start[k + 1]) hold substring k, and hashes holds their
+// hashes in the same order so a bucket is read without jumping around.
+struct SubstringTable {
+    int shift = 0;
+    int bits = 0;
+    uint64_t mask = 0;
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> rows;
+    std::vector<uint64_t> hashes;
+
+    uint64_t key(uint64_t h) const { return (h >> shift) & mask; }
+};
+
+}
+
+std::vector<uint64_t> rowHashes(const FeatureView &rows) {
+    std::vector<uint64_t> hashes;
+    if (!isHashType(rows.type) || rows.elem != ELEM_U8 || rows.dim != HASH_BYTES) return hashes;
+    hashes.reserve(rows.count);
+    for (size_t i = 0; i < rows.count; i++) hashes.push_back(hashWord(rows.u8(i)));
+    return hashes;
+}
+
+// Bucket rows by one substring with a counting sort.
+static SubstringTable buildTable(const std::vector<uint64_t> &hashes, int shift, int bits) {
+    SubstringTable t;
+    t.shift = shift;
+    t.bits = bits;
+    t.mask = bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+    t.start.assign((size_t(1) << bits) + 1, 0);
+    for (uint64_t h : hashes) t.start[t.key(h) + 1]++;
+    for (size_t k = 1; k < t.start.size(); k++) t.start[k] += t.start[k - 1];
+
+    t.rows.resize(hashes.size());
+    t.hashes.resize(hashes.size());
+    std::vector<uint32_t> fill(t.start.begin(), t.start.end() - 1);
+    for (size_t i = 0; i < hashes.size(); i++) {
+        uint32_t k = fill[t.key(hashes[i])]++;
+        t.rows[k] = uint32_t(i);
+        t.hashes[k] = hashes[i];
+    }
+    return t;
+}
+
+// Call visit for key and every key of the table's width that differs from
+// it in at most left bits from firstBit up; each key is visited once.
+template <typename Visit>
+static void probeKeys(uint64_t key, int firstBit, int bits, int left, Visit &visit) {
+    visit(key);
+    if (left == 0) return;
+    for (int b = firstBit; b < bits; b++) probeKeys(key ^ (uint64_t(1) << b), b + 1, bits, left - 1, visit);
+}
+
+// Compare every pair directly, each thread taking rows of a stripe.
+static std::vector<DuplicatePair> exhaustiveDuplicates(const std::vector<uint64_t> &hashes, int radius,
+                                                       int threads, DuplicateStats &st) {
+    size_t n = hashes.size();
+    threads = int(std::min<size_t>(threads, n));
+    std::vector<std::vector<DuplicatePair>> found(threads);
+    auto worker = [&](int w) {
+        for (size_t i = w; i < n; i += threads) {
+            for (size_t j = i + 1; j < n; j++) {
+                int d = hammingDistance(hashes[i], hashes[j]);
+                if (d <= radius) found[w].push_back({uint32_t(i), uint32_t(j), uint32_t(d)});
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int w = 1; w < threads; w++) workers.emplace_back(worker, w);
+    worker(0);
+    for (auto &t : workers) t.join();
+
+    std::vector<DuplicatePair> pairs;
+    for (auto &f : found) pairs.insert(pairs.end(), f.begin(), f.end());
+    st.candidates = n * (n - 1) / 2;
+    return pairs;
+}
+
+// Keys within r bits of a w-bit key.
+static double probeCount(int w, int r) {
+    double total = 0, c = 1;
+    for (int k = 0; k <= r && k <= w; k++) {
+        total += c;
+        c = c * (w - k) / (k + 1);
+    }
+    return total;
+}
+
+// Number of tables to split the hash into for n rows. More tables mean
+// narrower substrings, so a smaller probe radius but fuller buckets; pick
+// the count with the least expected work per row, or 0 if comparing each
+// row with every later one is cheaper still (large radii on small sets).
+static int chooseTables(size_t n, int radius) {
+    int best = 0;
+    double bestCost = double(n) / 2;
+    for (int m = (64 + MAX_TABLE_BITS - 1) / MAX_TABLE_BITS; m <= 16; m++) {
+        int w = 64 / m;
+        double cost = m * probeCount(w, radius / m) * (PROBE_COST + double(n) / std::ldexp(1.0, w));
+        if (cost < bestCost) {
+            best = m;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
+// Search m substring tables, probing subRadius bits around each row's keys.
+static std::vector<DuplicatePair> indexedDuplicates(const std::vector<uint64_t> &hashes, int radius,
+                                                    int m, int threads, DuplicateStats &st) {
+    size_t n = hashes.size();
+    int subRadius = radius / m;
+    st.tables = m;
+    st.subRadius = subRadius;
+
+    std::vector<SubstringTable> tables;
+    for (int t = 0, shift = 0; t < m; t++) {
+        int bits = 64 / m + (t < 64 % m);
+        tables.push_back(buildTable(hashes, shift, bits));
+        shift += bits;
+    }
+
+    size_t blocks = (n + DUP_BLOCK - 1) / DUP_BLOCK;
+    threads = int(std::min<size_t>(threads, blocks * m));
+
+    std::vector<std::vector<DuplicatePair>> found(threads);
+    std::vector<size_t> compared(threads, 0);
+    std::atomic<size_t> nextBlock(0);
+
+    // Rows are taken table by table in that table's key order, so the
+    // buckets probed for one row are next to those probed for the last.
+    auto worker = [&](int w) {
+        size_t seen = 0;
+        for (size_t job = nextBlock++; job < blocks * m; job = nextBlock++) {
+            int t = int(job / blocks);
+            const SubstringTable &tab = tables[t];
+            size_t first = (job % blocks) * DUP_BLOCK, end = std::min(n, first + DUP_BLOCK);
+            for (size_t q = first; q < end; q++) {
+                uint32_t i = tab.rows[q];
+                uint64_t hi = tab.hashes[q];
+                auto visit = [&](uint64_t key) {
+                    uint32_t k0 = tab.start[key], k1 = tab.start[key + 1];
+                    seen += k1 - k0;
+                    for (uint32_t k = k0; k < k1; k++) {
+                        uint64_t hj = tab.hashes[k];
+                        int d = hammingDistance(hi, hj);
+                        uint32_t j = tab.rows[k];
+                        if (d > radius || j <= i) continue;
+
+                        // Report each pair from the first table that finds it.
+                        bool earlier = false;
+                        for (int s = 0; s < t && !earlier; s++) {
+                            earlier = hammingDistance(tables[s].key(hi), tables[s].key(hj)) <= subRadius;
+                        }
+                        if (!earlier) found[w].push_back({i, j, uint32_t(d)});
+                    }
+                };
+                probeKeys(tab.key(hi), 0, tab.bits, subRadius, visit);
+            }
+        }
+        compared[w] = seen;
+    };
+
+    std::vector<std::thread> workers;
+    for (int w = 1; w < threads; w++) workers.emplace_back(worker, w);
+    worker(0);
+    for (auto &t : workers) t.join();
+
+    std::vector<DuplicatePair> pairs;
+    for (int w = 0; w < threads; w++) {
+        st.candidates += compared[w];
+        pairs.insert(pairs.end(), found[w].begin(), found[w].end());
+    }
+    return pairs;
+}
+
+std::vector<DuplicatePair> findNearDuplicates(const std::vector<uint64_t> &hashes, int radius,
+                                              int threads, DuplicateStats *stats) {
+    DuplicateStats local;
+    DuplicateStats &st = stats ? *stats : local;
+    st = DuplicateStats();
+
+    if (hashes.size() < 2 || radius < 0) return {};
+    radius = std::min(radius, 64);
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int m = chooseTables(hashes.size(), radius);
+    std::vector<DuplicatePair> pairs = m ? indexedDuplicates(hashes, radius, m, threads, st)
+                                         : exhaustiveDuplicates(hashes, radius, threads, st);
+    std::sort(pairs.begin(), pairs.end(), [](const DuplicatePair &x, const DuplicatePair &y) {
+        return x.a != y.a ? x.a < y.a : x.b < y.b;
+    });
+    return pairs;
+}
+
+// Union-find root of row i, halving the path on the way.
+static uint32_t findRoot(std::vector<uint32_t> &parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+std::vector<std::vector<uint32_t>> clusterDuplicates(size_t count,
+                                                     const std::vector<DuplicatePair> &pairs) {
+    std::vector<uint32_t> parent(count);
+    for (size_t i = 0; i < count; i++) parent[i] = uint32_t(i);
+    for (const DuplicatePair &p : pairs) {
+        if (p.a >= count || p.b >= count) continue;
+        uint32_t ra = findRoot(parent, p.a), rb = findRoot(parent, p.b);
+        // The lower row becomes the root, so a cluster is named by its first row.
+        if (ra != rb) parent[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    std::vector<std::vector<uint32_t>> members(count);
+    for (size_t i = 0; i < count; i++) members[findRoot(parent, uint32_t(i))].push_back(uint32_t(i));
+
+    std::vector<std::vector<uint32_t>> clusters;
+    for (auto &c : members) {
+        if (c.size() > 1) clusters.push_back(std::move(c));
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+                     [](const std::vector<uint32_t> &x, const std::vector<uint32_t> &y) {
+                         return x.size() > y.size();
+                     });
+    return clusters;
+}
+
+bool writeDuplicateReport(const std::string &filename, const FeatureView &rows,
+                          const std::vector<uint64_t> &hashes,
+                          const std::vector<std::vector<uint32_t>> &clusters) {
+    FILE *file = fopen(filename.c_str(), "w");
+    if (!file) return false;
+
+    fprintf(file, "cluster,size,name,bits\n");
+    for (size_t c = 0; c < clusters.size(); c++) {
+        uint64_t first = hashes[clusters[c][0]];
+        for (uint32_t r : clusters[c]) {
+            std::string_view name = rows.name(r);
+            fprintf(file, "%zu,%zu,%.*s,%d\n", c + 1, clusters[c].size(), int(name.size()), name.data(),
+                    hammingDistance(first, hashes[r]));
+        }
+    }
+    return fclose(file) == 0;
+}
@@ -0,0 +1,54 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: dedup_utils.h
+//
+// Header file for dedup_utils.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "feature_store.h"
+
+// Two rows whose hashes differ in dist bits; a < b.
+struct DuplicatePair {
+    uint32_t a;
+    uint32_t b;
+    uint32_t dist;
+};
+
+// What a near-duplicate search did besides the pairs it returned.
+struct DuplicateStats {
+    int tables = 0;          // substring tables, 0 if every pair was compared
+    int subRadius = 0;       // bits probed around each substring
+    size_t candidates = 0;   // pairs whose full hashes were compared
+};
+
+//Hamming radius for near duplicates unless a caller asks otherwise.
+const int DEFAULT_DUP_RADIUS = 8;
+
+//64-bit hash of every row of a DHASH or PHASH block; empty for any other.
+std::vector<uint64_t> rowHashes(const FeatureView &rows);
+
+//Every pair of hashes at most radius bits apart, ordered by (a, b).
+//Multi-index hashing: the 64 bits are cut into m substrings, each indexed
+//in its own bucket table. A pair within radius is within radius / m bits
+//in at least one substring, so only rows found by probing that far around
+//each of a row's substrings are compared. m is chosen from the count and
+//radius; when no split beats comparing every pair, every pair is compared.
+//threads = 0 uses every hardware thread.
+std::vector<DuplicatePair> findNearDuplicates(const std::vector<uint64_t> &hashes, int radius,
+                                              int threads = 0, DuplicateStats *stats = nullptr);
+
+//Rows linked by pairs, grouped into clusters (connected components) of
+//two or more rows, each in row order; largest cluster first.
+std::vector<std::vector<uint32_t>> clusterDuplicates(size_t count,
+                                                     const std::vector<DuplicatePair> &pairs);
+
+//Write clusters as CSV lines "cluster,size,name,bits", where bits is the
+//row's Hamming distance from the first row of its cluster.
+bool writeDuplicateReport(const std::string &filename, const FeatureView &rows,
+                          const std::vector<uint64_t> &hashes,
+                          const std::vector<std::vector<uint32_t>> &clusters);
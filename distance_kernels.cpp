@@ -0,0 +1,741 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: distance_kernels.cpp
+//
+// Scalar and SIMD (SSE4.2, AVX2, AVX-512) versions of the SSD, histogram
+// intersection and cosine distance kernels, with the best supported set
+// picked at runtime. The SIMD versions are compiled per function with
+// target attributes so the rest of the build needs no special flags.
+
+#include "distance_kernels.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CBIR_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Finish a cosine distance from its accumulated sums.
+static double cosineFromSums(double dot, double na, double nb) {
+    na = sqrt(na);
+    nb = sqrt(nb);
+    if (na == 0 || nb == 0) return 1.0;
+    return 1.0 - dot / (na * nb);
+}
+
+std::vector<double> suffixMass(const float *a, size_t n) {
+    std::vector<double> rest(n + 1, 0.0);
+    for (size_t i = n; i > 0; i--) rest[i - 1] = rest[i] + a[i - 1];
+    return rest;
+}
+
+// Decide whether a histogram intersection can stop after some values:
+// the rest of the row can add at most restA to the sum of minima, so the
+// distance is at least 1 - (partial + restA). The slack covers the float
+// rounding of n additions in the partial and the final sums, so a row is
+// only dropped when its exact result could not reach bound either.
+static bool histAbandon(double partial, double restA, size_t n, double bound, double &lower) {
+    double best = partial + restA;
+    lower = 1.0 - best - double(n) * FLT_EPSILON * max(1.0, best);
+    return lower > bound;
+}
+
+double histIntersectionSparseDense(const float *a, size_t n, const double *restA,
+                                   const uint16_t *index, const float *value, size_t nnz,
+                                   double bound, size_t *done) {
+    double sum = 0, lower;
+    for (size_t k = 0; k < nnz; k++) {
+        size_t j = index[k];
+        if (j < n) sum += min(a[j], value[k]);
+        // Whatever b has left lies in bins after j.
+        if (restA && (k + 1) % BOUND_CHECK == 0 && k + 1 < nnz
+            && histAbandon(sum, restA[min(n, j + 1)], n, bound, lower)) {
+            *done = k + 1;
+            return lower;
+        }
+    }
+    *done = nnz;
+    return 1.0 - sum;
+}
+
+double histIntersectionSparse(const uint16_t *ia, const float *va, size_t na,
+                              const uint16_t *ib, const float *vb, size_t nb) {
+    double sum = 0;
+    size_t i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (ia[i] < ib[j]) i++;
+        else if (ib[j] < ia[i]) j++;
+        else sum += min(va[i++], vb[j++]);
+    }
+    return 1.0 - sum;
+}
+
+// ---- Scalar reference ----
+
+static double ssdU8Scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+    uint64_t ssd = 0;
+    for (size_t i = 0; i < n; i++) {
+        int diff = int(a[i]) - int(b[i]);
+        ssd += uint64_t(diff * diff);
+    }
+    return double(ssd);
+}
+
+static double histIntersectionF32Scalar(const float *a, const float *b, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += min(a[i], b[i]);
+    }
+    return 1.0 - sum;
+}
+
+static double cosineDistanceF32Scalar(const float *a, const float *b, size_t n) {
+    double dot = 0, na = 0, nb = 0;
+    for (size_t i = 0; i < n; i++) {
+        dot += double(a[i]) * b[i];
+        na += double(a[i]) * a[i];
+        nb += double(b[i]) * b[i];
+    }
+    return cosineFromSums(dot, na, nb);
+}
+
+static double dotF32Scalar(const float *a, const float *b, size_t n) {
+    double dot = 0;
+    for (size_t i = 0; i < n; i++) dot += double(a[i]) * b[i];
+    return dot;
+}
+
+static double ssdU8BoundedScalar(const uint8_t *a, const uint8_t *b, size_t n,
+                                 double bound, size_t *done) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    while (i < n && double(ssd) <= bound) {
+        size_t end = min(n, i + BOUND_CHECK);
+        for (; i < end; i++) {
+            int diff = int(a[i]) - int(b[i]);
+            ssd += uint64_t(diff * diff);
+        }
+    }
+    *done = i;
+    return double(ssd);
+}
+
+static double histIntersectionF32BoundedScalar(const float *a, const float *b, size_t n,
+                                               const double *restA, double bound, size_t *done) {
+    double sum = 0, lower;
+    for (size_t i = 0; i < n; i++) {
+        sum += min(a[i], b[i]);
+        if ((i + 1) % BOUND_CHECK == 0 && i + 1 < n && histAbandon(sum, restA[i + 1], n, bound, lower)) {
+            *done = i + 1;
+            return lower;
+        }
+    }
+    *done = n;
+    return 1.0 - sum;
+}
+
+static void dotF32x4Scalar(const float *const a[4], const float *b, size_t n, double out[4]) {
+    for (int r = 0; r < 4; r++) out[r] = dotF32Scalar(a[r], b, n);
+}
+
+static void histIntersectionF32x4Scalar(const float *const a[4], const float *b, size_t n, double out[4]) {
+    for (int r = 0; r < 4; r++) out[r] = histIntersectionF32Scalar(a[r], b, n);
+}
+
+#ifdef CBIR_X86_SIMD
+
+// Differences are squared into int32 lanes; flush them to 64 bits every
+// SSD_BLOCK bytes so long rows cannot overflow a lane.
+static const size_t SSD_BLOCK = 1 << 14;
+
+// ---- SSE4.2 ----
+
+__attribute__((target("sse4.2")))
+static int64_t hsumEpi32Sse(__m128i v) {
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), v);
+    return int64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("sse4.2")))
+static float hsumPsSse(__m128 v) {
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("sse4.2")))
+static double ssdU8Sse42(const uint8_t *a, const uint8_t *b, size_t n) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= n) {
+        size_t end = min(n, i + SSD_BLOCK);
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= end; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i dlo = _mm_sub_epi16(_mm_cvtepu8_epi16(va), _mm_cvtepu8_epi16(vb));
+            __m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(dlo, dlo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(dhi, dhi));
+        }
+        ssd += uint64_t(hsumEpi32Sse(acc));
+    }
+    for (; i < n; i++) {
+        int diff = int(a[i]) - int(b[i]);
+        ssd += uint64_t(diff * diff);
+    }
+    return double(ssd);
+}
+
+__attribute__((target("sse4.2")))
+static double histIntersectionF32Sse42(const float *a, const float *b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_min_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_min_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    double sum = hsumPsSse(_mm_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    return 1.0 - sum;
+}
+
+// The int32 lanes are flushed every BOUND_CHECK bytes (well inside
+// SSD_BLOCK), which is where the running sum is checked against bound.
+__attribute__((target("sse4.2")))
+static double ssdU8BoundedSse42(const uint8_t *a, const uint8_t *b, size_t n,
+                                double bound, size_t *done) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= n && double(ssd) <= bound) {
+        size_t end = min(n, i + BOUND_CHECK);
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= end; i += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i dlo = _mm_sub_epi16(_mm_cvtepu8_epi16(va), _mm_cvtepu8_epi16(vb));
+            __m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(dlo, dlo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(dhi, dhi));
+        }
+        ssd += uint64_t(hsumEpi32Sse(acc));
+    }
+    if (double(ssd) <= bound) {
+        for (; i < n; i++) {
+            int diff = int(a[i]) - int(b[i]);
+            ssd += uint64_t(diff * diff);
+        }
+    }
+    *done = i;
+    return double(ssd);
+}
+
+__attribute__((target("sse4.2")))
+static double histIntersectionF32BoundedSse42(const float *a, const float *b, size_t n,
+                                              const double *restA, double bound, size_t *done) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    double lower;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_min_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_min_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        if ((i + 8) % BOUND_CHECK == 0 && i + 8 < n
+            && histAbandon(hsumPsSse(_mm_add_ps(acc0, acc1)), restA[i + 8], n, bound, lower)) {
+            *done = i + 8;
+            return lower;
+        }
+    }
+    double sum = hsumPsSse(_mm_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    *done = n;
+    return 1.0 - sum;
+}
+
+__attribute__((target("sse4.2")))
+static double cosineDistanceF32Sse42(const float *a, const float *b, size_t n) {
+    __m128 dot = _mm_setzero_ps(), na = _mm_setzero_ps(), nb = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        dot = _mm_add_ps(dot, _mm_mul_ps(va, vb));
+        na = _mm_add_ps(na, _mm_mul_ps(va, va));
+        nb = _mm_add_ps(nb, _mm_mul_ps(vb, vb));
+    }
+    double d = hsumPsSse(dot), x = hsumPsSse(na), y = hsumPsSse(nb);
+    for (; i < n; i++) {
+        d += double(a[i]) * b[i];
+        x += double(a[i]) * a[i];
+        y += double(b[i]) * b[i];
+    }
+    return cosineFromSums(d, x, y);
+}
+
+__attribute__((target("sse4.2")))
+static double dotF32Sse42(const float *a, const float *b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    double dot = hsumPsSse(_mm_add_ps(acc0, acc1));
+    for (; i < n; i++) dot += double(a[i]) * b[i];
+    return dot;
+}
+
+__attribute__((target("sse4.2")))
+static void dotF32x4Sse42(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vb = _mm_loadu_ps(b + i);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a[0] + i), vb));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a[1] + i), vb));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a[2] + i), vb));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a[3] + i), vb));
+    }
+    out[0] = hsumPsSse(acc0);
+    out[1] = hsumPsSse(acc1);
+    out[2] = hsumPsSse(acc2);
+    out[3] = hsumPsSse(acc3);
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) out[r] += double(a[r][j]) * b[j];
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void histIntersectionF32x4Sse42(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vb = _mm_loadu_ps(b + i);
+        acc0 = _mm_add_ps(acc0, _mm_min_ps(_mm_loadu_ps(a[0] + i), vb));
+        acc1 = _mm_add_ps(acc1, _mm_min_ps(_mm_loadu_ps(a[1] + i), vb));
+        acc2 = _mm_add_ps(acc2, _mm_min_ps(_mm_loadu_ps(a[2] + i), vb));
+        acc3 = _mm_add_ps(acc3, _mm_min_ps(_mm_loadu_ps(a[3] + i), vb));
+    }
+    double sum[4] = {hsumPsSse(acc0), hsumPsSse(acc1), hsumPsSse(acc2), hsumPsSse(acc3)};
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) sum[r] += min(a[r][j], b[j]);
+        out[r] = 1.0 - sum[r];
+    }
+}
+
+// ---- AVX2 ----
+
+__attribute__((target("avx2")))
+static int64_t hsumEpi32Avx2(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), s);
+    return int64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static float hsumPsAvx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    __m128 shuf = _mm_movehdup_ps(s);
+    __m128 sums = _mm_add_ps(s, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2")))
+static double ssdU8Avx2(const uint8_t *a, const uint8_t *b, size_t n) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    while (i + 32 <= n) {
+        size_t end = min(n, i + SSD_BLOCK);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= end; i += 32) {
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i + 16));
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + 16));
+            __m256i d0 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(a0), _mm256_cvtepu8_epi16(b0));
+            __m256i d1 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(a1), _mm256_cvtepu8_epi16(b1));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d0, d0));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d1, d1));
+        }
+        ssd += uint64_t(hsumEpi32Avx2(acc));
+    }
+    for (; i < n; i++) {
+        int diff = int(a[i]) - int(b[i]);
+        ssd += uint64_t(diff * diff);
+    }
+    return double(ssd);
+}
+
+__attribute__((target("avx2")))
+static double histIntersectionF32Avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+    double sum = hsumPsAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    return 1.0 - sum;
+}
+
+__attribute__((target("avx2")))
+static double ssdU8BoundedAvx2(const uint8_t *a, const uint8_t *b, size_t n,
+                               double bound, size_t *done) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    while (i + 32 <= n && double(ssd) <= bound) {
+        size_t end = min(n, i + BOUND_CHECK);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= end; i += 32) {
+            __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i + 16));
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + 16));
+            __m256i d0 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(a0), _mm256_cvtepu8_epi16(b0));
+            __m256i d1 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(a1), _mm256_cvtepu8_epi16(b1));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d0, d0));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d1, d1));
+        }
+        ssd += uint64_t(hsumEpi32Avx2(acc));
+    }
+    if (double(ssd) <= bound) {
+        for (; i < n; i++) {
+            int diff = int(a[i]) - int(b[i]);
+            ssd += uint64_t(diff * diff);
+        }
+    }
+    *done = i;
+    return double(ssd);
+}
+
+__attribute__((target("avx2")))
+static double histIntersectionF32BoundedAvx2(const float *a, const float *b, size_t n,
+                                             const double *restA, double bound, size_t *done) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    double lower;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        if ((i + 16) % BOUND_CHECK == 0 && i + 16 < n
+            && histAbandon(hsumPsAvx2(_mm256_add_ps(acc0, acc1)), restA[i + 16], n, bound, lower)) {
+            *done = i + 16;
+            return lower;
+        }
+    }
+    double sum = hsumPsAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    *done = n;
+    return 1.0 - sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double cosineDistanceF32Avx2(const float *a, const float *b, size_t n) {
+    __m256 dot = _mm256_setzero_ps(), na = _mm256_setzero_ps(), nb = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+        dot = _mm256_fmadd_ps(va, vb, dot);
+        na = _mm256_fmadd_ps(va, va, na);
+        nb = _mm256_fmadd_ps(vb, vb, nb);
+    }
+    double d = hsumPsAvx2(dot), x = hsumPsAvx2(na), y = hsumPsAvx2(nb);
+    for (; i < n; i++) {
+        d += double(a[i]) * b[i];
+        x += double(a[i]) * a[i];
+        y += double(b[i]) * b[i];
+    }
+    return cosineFromSums(d, x, y);
+}
+
+__attribute__((target("avx2,fma")))
+static double dotF32Avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    double dot = hsumPsAvx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; i++) dot += double(a[i]) * b[i];
+    return dot;
+}
+
+__attribute__((target("avx2,fma")))
+static void dotF32x4Avx2(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a[0] + i), vb, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a[1] + i), vb, acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a[2] + i), vb, acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a[3] + i), vb, acc3);
+    }
+    out[0] = hsumPsAvx2(acc0);
+    out[1] = hsumPsAvx2(acc1);
+    out[2] = hsumPsAvx2(acc2);
+    out[3] = hsumPsAvx2(acc3);
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) out[r] += double(a[r][j]) * b[j];
+    }
+}
+
+__attribute__((target("avx2")))
+static void histIntersectionF32x4Avx2(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a[0] + i), vb));
+        acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a[1] + i), vb));
+        acc2 = _mm256_add_ps(acc2, _mm256_min_ps(_mm256_loadu_ps(a[2] + i), vb));
+        acc3 = _mm256_add_ps(acc3, _mm256_min_ps(_mm256_loadu_ps(a[3] + i), vb));
+    }
+    double sum[4] = {hsumPsAvx2(acc0), hsumPsAvx2(acc1), hsumPsAvx2(acc2), hsumPsAvx2(acc3)};
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) sum[r] += min(a[r][j], b[j]);
+        out[r] = 1.0 - sum[r];
+    }
+}
+
+// ---- AVX-512 ----
+
+__attribute__((target("avx512f,avx512bw")))
+static double ssdU8Avx512(const uint8_t *a, const uint8_t *b, size_t n) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    while (i + 32 <= n) {
+        size_t end = min(n, i + SSD_BLOCK);
+        __m512i acc = _mm512_setzero_si512();
+        for (; i + 32 <= end; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            __m512i d = _mm512_sub_epi16(_mm512_cvtepu8_epi16(va), _mm512_cvtepu8_epi16(vb));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(d, d));
+        }
+        ssd += uint64_t(_mm512_reduce_add_epi32(acc));
+    }
+    for (; i < n; i++) {
+        int diff = int(a[i]) - int(b[i]);
+        ssd += uint64_t(diff * diff);
+    }
+    return double(ssd);
+}
+
+__attribute__((target("avx512f")))
+static double histIntersectionF32Avx512(const float *a, const float *b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
+    }
+    if (i + 16 <= n) {
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        i += 16;
+    }
+    double sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    return 1.0 - sum;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static double ssdU8BoundedAvx512(const uint8_t *a, const uint8_t *b, size_t n,
+                                 double bound, size_t *done) {
+    uint64_t ssd = 0;
+    size_t i = 0;
+    while (i + 32 <= n && double(ssd) <= bound) {
+        size_t end = min(n, i + BOUND_CHECK);
+        __m512i acc = _mm512_setzero_si512();
+        for (; i + 32 <= end; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            __m512i d = _mm512_sub_epi16(_mm512_cvtepu8_epi16(va), _mm512_cvtepu8_epi16(vb));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(d, d));
+        }
+        ssd += uint64_t(_mm512_reduce_add_epi32(acc));
+    }
+    if (double(ssd) <= bound) {
+        for (; i < n; i++) {
+            int diff = int(a[i]) - int(b[i]);
+            ssd += uint64_t(diff * diff);
+        }
+    }
+    *done = i;
+    return double(ssd);
+}
+
+__attribute__((target("avx512f")))
+static double histIntersectionF32BoundedAvx512(const float *a, const float *b, size_t n,
+                                               const double *restA, double bound, size_t *done) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    double lower;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
+        if ((i + 32) % BOUND_CHECK == 0 && i + 32 < n
+            && histAbandon(_mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)), restA[i + 32], n, bound, lower)) {
+            *done = i + 32;
+            return lower;
+        }
+    }
+    if (i + 16 <= n) {
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        i += 16;
+    }
+    double sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < n; i++) sum += min(a[i], b[i]);
+    *done = n;
+    return 1.0 - sum;
+}
+
+__attribute__((target("avx512f")))
+static double cosineDistanceF32Avx512(const float *a, const float *b, size_t n) {
+    __m512 dot = _mm512_setzero_ps(), na = _mm512_setzero_ps(), nb = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 va = _mm512_loadu_ps(a + i);
+        __m512 vb = _mm512_loadu_ps(b + i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        na = _mm512_fmadd_ps(va, va, na);
+        nb = _mm512_fmadd_ps(vb, vb, nb);
+    }
+    double d = _mm512_reduce_add_ps(dot), x = _mm512_reduce_add_ps(na), y = _mm512_reduce_add_ps(nb);
+    for (; i < n; i++) {
+        d += double(a[i]) * b[i];
+        x += double(a[i]) * a[i];
+        y += double(b[i]) * b[i];
+    }
+    return cosineFromSums(d, x, y);
+}
+
+__attribute__((target("avx512f")))
+static double dotF32Avx512(const float *a, const float *b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    if (i + 16 <= n) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        i += 16;
+    }
+    double dot = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    for (; i < n; i++) dot += double(a[i]) * b[i];
+    return dot;
+}
+
+__attribute__((target("avx512f")))
+static void dotF32x4Avx512(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vb = _mm512_loadu_ps(b + i);
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a[0] + i), vb, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a[1] + i), vb, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a[2] + i), vb, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a[3] + i), vb, acc3);
+    }
+    out[0] = _mm512_reduce_add_ps(acc0);
+    out[1] = _mm512_reduce_add_ps(acc1);
+    out[2] = _mm512_reduce_add_ps(acc2);
+    out[3] = _mm512_reduce_add_ps(acc3);
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) out[r] += double(a[r][j]) * b[j];
+    }
+}
+
+__attribute__((target("avx512f")))
+static void histIntersectionF32x4Avx512(const float *const a[4], const float *b, size_t n, double out[4]) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vb = _mm512_loadu_ps(b + i);
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a[0] + i), vb));
+        acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a[1] + i), vb));
+        acc2 = _mm512_add_ps(acc2, _mm512_min_ps(_mm512_loadu_ps(a[2] + i), vb));
+        acc3 = _mm512_add_ps(acc3, _mm512_min_ps(_mm512_loadu_ps(a[3] + i), vb));
+    }
+    double sum[4] = {_mm512_reduce_add_ps(acc0), _mm512_reduce_add_ps(acc1),
+                     _mm512_reduce_add_ps(acc2), _mm512_reduce_add_ps(acc3)};
+    for (int r = 0; r < 4; r++) {
+        for (size_t j = i; j < n; j++) sum[r] += min(a[r][j], b[j]);
+        out[r] = 1.0 - sum[r];
+    }
+}
+
+#endif
+
+static const DistanceKernels SCALAR = {
+    "scalar", ssdU8Scalar, histIntersectionF32Scalar, cosineDistanceF32Scalar, dotF32Scalar,
+    ssdU8BoundedScalar, histIntersectionF32BoundedScalar, dotF32x4Scalar, histIntersectionF32x4Scalar
+};
+
+#ifdef CBIR_X86_SIMD
+static const DistanceKernels SSE42 = {
+    "sse4.2", ssdU8Sse42, histIntersectionF32Sse42, cosineDistanceF32Sse42, dotF32Sse42,
+    ssdU8BoundedSse42, histIntersectionF32BoundedSse42, dotF32x4Sse42, histIntersectionF32x4Sse42
+};
+static const DistanceKernels AVX2 = {
+    "avx2", ssdU8Avx2, histIntersectionF32Avx2, cosineDistanceF32Avx2, dotF32Avx2,
+    ssdU8BoundedAvx2, histIntersectionF32BoundedAvx2, dotF32x4Avx2, histIntersectionF32x4Avx2
+};
+static const DistanceKernels AVX512 = {
+    "avx512", ssdU8Avx512, histIntersectionF32Avx512, cosineDistanceF32Avx512, dotF32Avx512,
+    ssdU8BoundedAvx512, histIntersectionF32BoundedAvx512, dotF32x4Avx512, histIntersectionF32x4Avx512
+};
+#endif
+
+const DistanceKernels &scalarKernels() {
+    return SCALAR;
+}
+
+vector<const DistanceKernels *> availableKernels() {
+    vector<const DistanceKernels *> sets = {&SCALAR};
+#ifdef CBIR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) sets.push_back(&SSE42);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) sets.push_back(&AVX2);
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) sets.push_back(&AVX512);
+#endif
+    return sets;
+}
+
+// Pick the last (widest) available set unless CBIR_KERNELS names another.
+static const DistanceKernels *selectKernels() {
+    vector<const DistanceKernels *> sets = availableKernels();
+    const char *forced = getenv("CBIR_KERNELS");
+    if (forced) {
+        for (auto *k : sets) {
+            if (strcmp(k->name, forced) == 0) return k;
+        }
+    }
+    return sets.back();
+}
+
+const DistanceKernels &activeKernels() {
+    static const DistanceKernels *active = selectKernels();
+    return *active;
+}
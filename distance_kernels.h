@@ -0,0 +1,82 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: distance_kernels.h
+//
+// Header file for distance_kernels.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// One implementation of the row distance functions used by the matcher.
+struct DistanceKernels {
+    const char *name;
+    //Sum of squared differences between two uint8 rows.
+    double (*ssdU8)(const uint8_t *a, const uint8_t *b, size_t n);
+    //1 - sum(min(a, b)) between two float rows.
+    double (*histIntersectionF32)(const float *a, const float *b, size_t n);
+    //1 - cos(a, b) between two float rows (1 if either row is all zero).
+    double (*cosineDistanceF32)(const float *a, const float *b, size_t n);
+    //Dot product of two float rows.
+    double (*dotF32)(const float *a, const float *b, size_t n);
+    //ssdU8 that stops once the running sum exceeds bound, returning that
+    //partial sum. *done is set to the number of values compared.
+    double (*ssdU8Bounded)(const uint8_t *a, const uint8_t *b, size_t n,
+                           double bound, size_t *done);
+    //histIntersectionF32 that stops once the distance must exceed bound,
+    //returning a lower bound on it; restA[i] is the sum of a[i..n) and has
+    //n + 1 entries. A row that is not abandoned gets exactly the value
+    //histIntersectionF32 returns. *done is set to the number of values compared.
+    double (*histIntersectionF32Bounded)(const float *a, const float *b, size_t n,
+                                         const double *restA, double bound, size_t *done);
+    //dotF32 of four rows a[0..3] against one row b, reading b once:
+    //out[r] = dotF32(a[r], b, n) up to float rounding.
+    void (*dotF32x4)(const float *const a[4], const float *b, size_t n, double out[4]);
+    //histIntersectionF32 of four rows a[0..3] against one row b, reading b
+    //once: out[r] = histIntersectionF32(a[r], b, n) up to float rounding.
+    void (*histIntersectionF32x4)(const float *const a[4], const float *b, size_t n, double out[4]);
+};
+
+// Values compared between early-abandon checks in the bounded kernels.
+const size_t BOUND_CHECK = 64;
+
+//Target-side table for histIntersectionF32Bounded: entry i is the sum of
+//a[i..n), so that the mass still to be matched is known at every check.
+std::vector<double> suffixMass(const float *a, size_t n);
+
+//1 - sum(min(a, b)) between a dense row a of n values and a sparse row b
+//given as nnz ascending indices and their values. Only b's nonzero bins
+//are read. Stops like histIntersectionF32Bounded once the distance must
+//exceed bound, with restA = suffixMass(a, n), or never if restA is null;
+//*done is set to the number of b's values compared.
+double histIntersectionSparseDense(const float *a, size_t n, const double *restA,
+                                   const uint16_t *index, const float *value, size_t nnz,
+                                   double bound, size_t *done);
+
+//1 - sum(min(a, b)) between two sparse rows, merging their index lists.
+double histIntersectionSparse(const uint16_t *ia, const float *va, size_t na,
+                              const uint16_t *ib, const float *vb, size_t nb);
+
+//A DHASH/PHASH row (8 bytes, least significant first) as one 64-bit word.
+inline uint64_t hashWord(const uint8_t *row) {
+    uint64_t h = 0;
+    for (int i = 7; i >= 0; i--) h = (h << 8) | row[i];
+    return h;
+}
+
+//Number of differing bits between two 64-bit hashes.
+inline int hammingDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+//Portable scalar kernels; the reference the SIMD versions are checked against.
+const DistanceKernels &scalarKernels();
+
+//Every kernel set this CPU can run, scalar first.
+std::vector<const DistanceKernels *> availableKernels();
+
+//The fastest kernel set this CPU supports, chosen once at first use.
+//Setting CBIR_KERNELS=scalar|sse4.2|avx2|avx512 forces a specific set.
+const DistanceKernels &activeKernels();
@@ -0,0 +1,173 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: extract_pipeline.cpp
+//
+// Pipelined directory extraction. One thread lists the directory into a
+// bounded queue and a pool of workers decodes and extracts each image.
+// Results are collected by listing index so the output order matches the
+// serial extractDirFeatureSet.
+
+#include "extract_pipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct WorkItem {
+    size_t seq;
+    fs::path path;
+    const vector<FeatureType> *types;
+};
+
+// Fixed-capacity blocking queue between the listing stage and the workers.
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cap(std::max<size_t>(1, capacity)) {}
+
+    void push(WorkItem item) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [&] { return q.size() < cap; });
+        q.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool pop(WorkItem &item) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [&] { return !q.empty() || closed; });
+        if (q.empty()) return false;
+        item = std::move(q.front());
+        q.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t cap;
+    deque<WorkItem> q;
+    bool closed = false;
+    mutex m;
+    condition_variable notFull, notEmpty;
+};
+
+}
+
+// Decode one image and extract its types. Scale-tolerant types come from a
+// reduced decode when one is set, the rest from a full one; nothing is
+// returned if either decode fails.
+static vector<ImageFeature> decodeAndExtract(const WorkItem &item, const DecodeScale &decode) {
+    string name = item.path.filename().string();
+    vector<FeatureType> reduced, full;
+    for (FeatureType type : *item.types) {
+        if (decode.reduced() && scaleTolerant(type)) reduced.push_back(type);
+        else full.push_back(type);
+    }
+
+    vector<ImageFeature> feats;
+    for (auto *group : {&full, &reduced}) {
+        if (group->empty()) continue;
+        Mat img = decodeImage(item.path.string(), group == &reduced ? decode : DecodeScale());
+        if (img.empty()) return {};
+        for (auto &f : computeFeatureSet(img, *group, name)) feats.push_back(std::move(f));
+    }
+    return feats;
+}
+
+// Run the listing stage `produce` against a pool of decode+extract workers
+// and return the per-item results indexed by sequence number. total is the
+// number of items produce will list, or 0 if not known up front.
+static vector<vector<ImageFeature>> runPipeline(const ExtractOptions &opts, size_t total,
+                                                const function<void(BoundedQueue &)> &produce) {
+    int threads = opts.threads;
+    if (threads <= 0) threads = std::max(1u, thread::hardware_concurrency());
+
+    BoundedQueue queue(opts.queueDepth);
+
+    // Per-image results indexed by listing order; empty if the decode failed.
+    vector<vector<ImageFeature>> slots;
+    mutex slotsMutex;
+    atomic<size_t> done{0};
+
+    thread lister([&] {
+        produce(queue);
+        queue.close();
+    });
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            WorkItem item;
+            while (queue.pop(item)) {
+                vector<ImageFeature> feats;
+                if (!opts.cancelled()) feats = decodeAndExtract(item, opts.decode);
+
+                {
+                    lock_guard<mutex> lock(slotsMutex);
+                    if (slots.size() <= item.seq) slots.resize(item.seq + 1);
+                    slots[item.seq] = std::move(feats);
+                }
+                size_t d = ++done;
+                if (opts.progress) opts.progress(d, total);
+            }
+        });
+    }
+
+    lister.join();
+    for (auto &w : workers) w.join();
+    return slots;
+}
+
+map<FeatureType, FeatureMatrix> extractDirParallel(const string &dir,
+                                                   const vector<FeatureType> &types,
+                                                   const ExtractOptions &opts) {
+    // The lister runs on its own thread, so it must not throw: the
+    // error_code overloads report a directory it cannot read instead.
+    error_code ec;
+    vector<vector<ImageFeature>> slots = runPipeline(opts, 0, [&](BoundedQueue &queue) {
+        size_t seq = 0;
+        fs::directory_iterator it(dir, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            if (opts.cancelled()) break;
+            error_code fileEc;
+            if (!it->is_regular_file(fileEc)) continue;
+            if (!isImageExtension(it->path().extension().string())) continue;
+            queue.push({seq++, it->path(), &types});
+        }
+    });
+    if (ec) return {};
+
+    map<FeatureType, FeatureMatrix> stores;
+    for (FeatureType type : types) {
+        FeatureMatrix &m = stores.emplace(type, FeatureMatrix(type)).first->second;
+        if (scaleTolerant(type)) m.setDecode(opts.decode);
+    }
+    for (auto &feats : slots) {
+        for (auto &f : feats) stores.at(f.type).addFeature(f);
+    }
+    return stores;
+}
+
+vector<vector<ImageFeature>> extractJobsParallel(const vector<ExtractJob> &jobs,
+                                                 const ExtractOptions &opts) {
+    vector<vector<ImageFeature>> slots = runPipeline(opts, jobs.size(), [&](BoundedQueue &queue) {
+        for (size_t i = 0; i < jobs.size() && !opts.cancelled(); i++) {
+            queue.push({i, fs::path(jobs[i].path), &jobs[i].types});
+        }
+    });
+    slots.resize(jobs.size());
+    return slots;
+}
@@ -0,0 +1,54 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: extract_pipeline.h
+//
+// Header file for extract_pipeline.cpp
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "feature_utils.h"
+#include "feature_matrix.h"
+
+// Settings for pipelined directory extraction.
+struct ExtractOptions {
+    int threads = 0;          // decode+extract workers, 0 = hardware threads
+    size_t queueDepth = 32;   // files listed ahead of the workers
+
+    // Decode scale for the scale-tolerant types; the others always get a
+    // full-resolution decode, so an image may be decoded twice.
+    DecodeScale decode;
+
+    // Called from the workers as images finish with (done, total); total
+    // is 0 when extracting a directory that is still being listed.
+    function<void(size_t, size_t)> progress;
+
+    // When set, remaining images are skipped and their results left empty.
+    const atomic<bool> *cancel = nullptr;
+
+    bool cancelled() const { return cancel && cancel->load(); }
+};
+
+// One image to decode and the feature types to extract from it.
+struct ExtractJob {
+    string path;
+    vector<FeatureType> types;
+};
+
+//Extract several feature types for all images in a directory using a
+//listing thread, a bounded work queue and a pool of decode+extract workers.
+//Rows come back in directory order regardless of the thread count. A
+//cancelled run returns the rows finished so far. If dir cannot be listed
+//the map is empty, without even an empty matrix for each type.
+map<FeatureType, FeatureMatrix> extractDirParallel(const string &dir,
+                                                   const vector<FeatureType> &types,
+                                                   const ExtractOptions &opts = ExtractOptions());
+
+//Run a list of extraction jobs on the worker pool. Result i holds the
+//features of jobs[i], or is empty if that image could not be decoded.
+vector<vector<ImageFeature>> extractJobsParallel(const vector<ExtractJob> &jobs,
+                                                 const ExtractOptions &opts = ExtractOptions());
@@ -0,0 +1,391 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_cache.cpp
+//
+// Keeps feature databases, target features and recent query results
+// resident so repeated matches do not re-read or recompute anything.
+
+#include "feature_cache.h"
+#include "metrics.h"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+FileStamp stampFile(const std::string &path) {
+    FileStamp s;
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) return s;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec) return s;
+    s.exists = true;
+    s.size = size;
+    s.mtime = mtime.time_since_epoch().count();
+    return s;
+}
+
+FeatureType csvFeatureType(const std::string &path) {
+    // Most specific names first, so "multihist" is not taken for "hist".
+    static const std::pair<const char *, FeatureType> names[] = {
+        {"dhash", DHASH}, {"phash", PHASH}, {"pyramid", PYRAMID},
+        {"grid2", GRID_2X2}, {"grid3", GRID_3X3}, {"baseline", BASELINE},
+        {"multihist", MULTIHIST}, {"hist", COLOR}, {"custom", CUSTOM},
+        {"dnn", DNN_EMB}, {"ct", COLOR_TEXTURE},
+    };
+
+    // Only the file name counts; a directory named "hist" says nothing.
+    fs::path file = fs::path(path).filename();
+    std::string stem = file.stem().string(), name = file.string();
+    for (auto &n : names) {
+        if (stem == n.first) return n.second;
+    }
+    // "ct" is too short to look for inside other names.
+    for (auto &n : names) {
+        if (n.second != COLOR_TEXTURE && name.find(n.first) != std::string::npos) return n.second;
+    }
+    return BASELINE;
+}
+
+static bool isStorePath(const std::string &path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+}
+
+// Path of an index file stored next to a .bin store.
+static std::string siblingPath(const std::string &path, const char *ext) {
+    return path.substr(0, path.size() - 4) + ext;
+}
+
+// Float store a quantized store was encoded from: <stem>.bin beside it.
+static std::string exactStorePath(const std::string &path) {
+    return fs::path(path).replace_extension(".bin").string();
+}
+
+ImageFeature ResidentDatabase::row(size_t i) const {
+    const FeatureView &v = view();
+    ImageFeature f;
+    f.name = std::string(name(i));
+    f.type = type;
+    if (quant && !store.isOpen()) {
+        std::vector<float> dense(quant->dim);
+        quant->decode(i, dense.data());
+        f.dblFeat.assign(dense.begin(), dense.end());
+    } else if (v.elem == ELEM_U8) {
+        f.intFeat.assign(v.u8(i), v.u8(i) + v.dim);
+    } else {
+        std::vector<float> dense(v.dim);
+        v.expand(i, dense.data());
+        f.dblFeat.assign(dense.begin(), dense.end());
+    }
+    return f;
+}
+
+FeatureCache::FeatureCache(size_t targetCapacity, size_t resultCapacity)
+    : targets(targetCapacity), results(resultCapacity), alignments(8) {}
+
+FeatureType FeatureCache::csvType(const std::string &path) const {
+    auto it = csvTypes.find(path);
+    return it != csvTypes.end() ? it->second : csvFeatureType(path);
+}
+
+void FeatureCache::clear() {
+    databases.clear();
+    targets.clear();
+    results.clear();
+    alignments.clear();
+}
+
+const ResidentDatabase *FeatureCache::database(const std::string &path, FeatureType csvType) {
+    FileStamp stamp = stampFile(path);
+    if (!stamp.exists) {
+        databases.erase(path);
+        return nullptr;
+    }
+
+    auto &slot = databases[path];
+    bool quantized = isQuantizedPath(path);
+    FileStamp exactStamp = quantized ? stampFile(exactStorePath(path)) : FileStamp();
+    if (slot && slot->stamp == stamp && slot->exactStamp == exactStamp
+        && (slot->isStore() || quantized || slot->type == csvType)) {
+        refreshIndexes(*slot);
+        return slot.get();
+    }
+
+    auto db = std::make_unique<ResidentDatabase>();
+    db->path = path;
+    db->stamp = stamp;
+
+    if (isStorePath(path)) {
+        if (!db->store.open(path)) {
+            databases.erase(path);
+            return nullptr;
+        }
+        db->type = db->store.view().type;
+    }
+    else if (quantized) {
+        auto q = std::make_unique<QuantizedStore>();
+        if (!readQuantizedStore(path, *q)) {
+            databases.erase(path);
+            return nullptr;
+        }
+        db->type = DNN_EMB;
+        db->exactStamp = exactStamp;
+        if (exactStamp.exists && exactStamp.mtime <= stamp.mtime && db->store.open(exactStorePath(path))) {
+            const FeatureView &v = db->store.view();
+            if (v.type != DNN_EMB || v.elem != ELEM_F32 || v.count != q->count || v.dim != q->dim) {
+                db->store.close();
+            }
+        }
+        db->quant = std::move(q);
+    }
+    else {
+        db->type = csvType;
+        db->rows = readFeatureCSV(path, csvType, &db->csv);
+        // Mostly-empty histograms are held sparse, as a store would be.
+        if (preferSparse(db->rows.view())) db->rows = sparseCopy(db->rows.view());
+    }
+
+    db->rowOf.reserve(db->count());
+    for (size_t i = 0; i < db->count(); i++) db->rowOf.emplace(std::string(db->name(i)), i);
+
+    db->generation = nextGeneration++;
+    slot = std::move(db);
+    refreshIndexes(*slot);
+    return slot.get();
+}
+
+// Reload the .knn graph and .hnsw index of a store when their files change.
+// Either is used only while it is at least as new as the store itself and
+// holds as many rows.
+void FeatureCache::refreshIndexes(ResidentDatabase &db) {
+    if (!db.isStore()) return;
+    const FeatureView &v = db.store.view();
+
+    std::string graphPath = siblingPath(db.path, ".knn");
+    FileStamp graphStamp = stampFile(graphPath);
+    if (graphStamp != db.graphStamp) {
+        db.graphStamp = graphStamp;
+        db.graph.reset();
+        auto graph = std::make_unique<KnnGraph>();
+        if (graphStamp.exists && graphStamp.mtime >= db.stamp.mtime &&
+            readKnnGraph(graphPath, *graph) &&
+            graph->count == v.count && graph->type == v.type) {
+            db.graph = std::move(graph);
+        }
+        db.generation = nextGeneration++;
+    }
+
+    if (v.type != DNN_EMB) return;
+
+    std::string hnswPath = siblingPath(db.path, ".hnsw");
+    FileStamp hnswStamp = stampFile(hnswPath);
+    if (hnswStamp != db.hnswStamp) {
+        db.hnswStamp = hnswStamp;
+        db.hnsw.reset();
+        auto index = std::make_unique<HnswIndex>();
+        if (hnswStamp.exists && hnswStamp.mtime >= db.stamp.mtime &&
+            index->open(hnswPath) && index->dim() == v.dim && index->size() == v.count) {
+            db.hnsw = std::move(index);
+        }
+        db.generation = nextGeneration++;
+    }
+}
+
+// Features of an image file outside the database, decoded at the scale the
+// database was extracted at and computed once per (path, type, scale, file
+// stamp).
+const ImageFeature *FeatureCache::targetFeatures(const std::string &imagePath,
+                                                 const std::string &name,
+                                                 FeatureType type,
+                                                 const DecodeScale &decode,
+                                                 const FileStamp &stamp) {
+    std::string key = imagePath + '\n' + std::to_string(type) + '\n' +
+                      std::to_string(decode.factor) + '\n' + std::to_string(decode.maxSide) + '\n' +
+                      std::to_string(stamp.size) + '\n' + std::to_string(stamp.mtime);
+    if (ImageFeature *f = targets.get(key)) return f;
+
+    cv::Mat img = decodeImage(imagePath, decode);
+    if (img.empty()) return nullptr;
+    return &targets.put(key, computeFeatures(img, type, name));
+}
+
+// Features of target for db: its stored row if it is in the database,
+// otherwise computed from the image in imageDir.
+const ImageFeature *FeatureCache::resolveTarget(const ResidentDatabase &db,
+                                                const std::string &target,
+                                                const std::string &imageDir,
+                                                ImageFeature &rowFeat, std::string &error) {
+    size_t self = db.find(target);
+    if (self != NO_ROW) {
+        rowFeat = db.row(self);
+        return &rowFeat;
+    }
+    if (db.type == DNN_EMB) {
+        error = "Target not found in DNN database.";
+        return nullptr;
+    }
+
+    std::string imagePath = imageDir + "/" + target;
+    const ImageFeature *f = targetFeatures(imagePath, target, db.type, db.view().decode,
+                                           stampFile(imagePath));
+    if (!f) error = "Target image not found in image folder.";
+    return f;
+}
+
+bool FeatureCache::queryCascade(const std::string &coarsePath, const std::string &path,
+                                const std::string &target, const std::string &imageDir,
+                                int N, size_t shortlist,
+                                std::vector<Match> &matches, std::string &error) {
+    ScopedTimer timer(STAGE_QUERY);
+    countMetric(COUNTER_QUERIES);
+
+    matches.clear();
+    if (N <= 0) return true;
+
+    const ResidentDatabase *coarse = database(coarsePath, csvType(coarsePath));
+    const ResidentDatabase *fine = database(path, csvType(path));
+    if (!coarse || !fine) {
+        error = "Could not open feature database.";
+        return false;
+    }
+    if (coarse->quant || fine->quant) {
+        error = "Quantized databases cannot be used in a cascade.";
+        return false;
+    }
+
+    size_t self = coarse->find(target);
+    FileStamp imageStamp;
+    if (self == NO_ROW) imageStamp = stampFile(imageDir + "/" + target);
+
+    std::string pair = std::to_string(coarse->generation) + '\n' + std::to_string(fine->generation);
+    std::string key = coarsePath + '\n' + path + '\n' + pair + '\n' + target + '\n' +
+                      std::to_string(N) + '\n' + std::to_string(shortlist) + '\n' +
+                      std::to_string(imageStamp.mtime);
+    if (std::vector<Match> *hit = results.get(key)) {
+        countMetric(COUNTER_RESULT_CACHE_HITS);
+        matches = *hit;
+        return true;
+    }
+
+    ImageFeature coarseRow, fineRow;
+    const ImageFeature *coarseFeat = resolveTarget(*coarse, target, imageDir, coarseRow, error);
+    if (!coarseFeat) return false;
+    const ImageFeature *fineFeat = resolveTarget(*fine, target, imageDir, fineRow, error);
+    if (!fineFeat) return false;
+
+    std::vector<size_t> *rowMap = alignments.get(pair);
+    if (!rowMap) rowMap = &alignments.put(pair, alignRows(coarse->view(), fine->view()));
+
+    matches = matchCascade(*coarseFeat, coarse->view(), *fineFeat, fine->view(), *rowMap,
+                           N, shortlist, 0, self);
+    results.put(key, matches);
+    return true;
+}
+
+bool FeatureCache::query(const std::string &path, const std::string &target,
+                         const std::string &imageDir, int N,
+                         std::vector<Match> &matches, std::string &error,
+                         const MatchProgress &progress) {
+    ScopedTimer timer(STAGE_QUERY);
+    countMetric(COUNTER_QUERIES);
+
+    // Row counts below are N + 1 as a size_t, so N must be positive.
+    matches.clear();
+    if (N <= 0) return true;
+
+    const ResidentDatabase *db = database(path, csvType(path));
+    if (!db) {
+        error = "Could not open feature database.";
+        return false;
+    }
+
+    // An in-database target uses its stored row; any other target is
+    // decoded from imageDir, so its file stamp is part of the result key.
+    size_t self = db->find(target);
+    std::string imagePath = imageDir + "/" + target;
+    FileStamp imageStamp;
+    if (self == NO_ROW) {
+        if (db->type == DNN_EMB) {
+            error = "Target not found in DNN database.";
+            return false;
+        }
+        imageStamp = stampFile(imagePath);
+    }
+
+    std::string key = path + '\n' + std::to_string(db->generation) + '\n' + target + '\n' +
+                      std::to_string(N) + '\n' + std::to_string(imageStamp.mtime) + '\n' +
+                      std::to_string(quantRerank) + '\n' + std::to_string(hnswEf);
+    if (std::vector<Match> *hit = results.get(key)) {
+        countMetric(COUNTER_RESULT_CACHE_HITS);
+        matches = *hit;
+        return true;
+    }
+
+    matches.clear();
+
+    if (self != NO_ROW && db->graph && N <= (int)db->graph->k) {
+        const KnnGraph &g = *db->graph;
+        for (int j = 0; j < N; j++) {
+            uint32_t nb = g.neighbors[self * g.k + j];
+            if (nb == NO_NEIGHBOR) break;
+            matches.push_back({std::string(db->store.view().name(nb)), g.dists[self * g.k + j]});
+        }
+        results.put(key, matches);
+        return true;
+    }
+
+    ImageFeature rowFeat;
+    const ImageFeature *targetFeat = nullptr;
+    if (self != NO_ROW) {
+        rowFeat = db->row(self);
+        targetFeat = &rowFeat;
+    }
+    else {
+        targetFeat = targetFeatures(imagePath, target, db->type, db->view().decode, imageStamp);
+        if (!targetFeat) {
+            error = "Target image not found in image folder.";
+            return false;
+        }
+    }
+
+    if (db->quant) {
+        // Search the codes, then re-rank a shortlist against the float rows.
+        std::vector<float> q(targetFeat->dblFeat.begin(), targetFeat->dblFeat.end());
+        size_t n = size_t(N) + 1;
+        std::vector<Scored> found = quantRerank > 0 && db->store.isOpen()
+            ? searchQuantizedRerank(*db->quant, db->store.view(), q.data(), n, std::max(quantRerank, n))
+            : searchQuantized(*db->quant, q.data(), n);
+        for (auto &s : found) {
+            if (s.index == self || (int)matches.size() == N) continue;
+            matches.push_back({std::string(db->quant->name(s.index)), s.dist});
+        }
+    }
+    else if (db->hnsw) {
+        std::vector<float> q(targetFeat->dblFeat.begin(), targetFeat->dblFeat.end());
+        size_t n = size_t(N) + 1;
+        for (auto &s : db->hnsw->search(q.data(), n, std::max(hnswEf, n))) {
+            std::string name(db->hnsw->name(s.index));
+            if (name == target || (int)matches.size() == N) continue;
+            matches.push_back({name, s.dist});
+        }
+    }
+    else {
+        bool stopped = false;
+        MatchProgress watch;
+        if (progress) {
+            watch = [&](const std::vector<Match> &best, size_t done, size_t total) {
+                stopped = !progress(best, done, total);
+                return !stopped;
+            };
+        }
+
+        matches = matchFeatures(*targetFeat, db->view(), N, 0, self, watch);
+
+        if (stopped) {
+            error = "Match cancelled.";
+            return false;
+        }
+    }
+
+    results.put(key, matches);
+    return true;
+}
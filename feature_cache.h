@@ -0,0 +1,192 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_cache.h
+//
+// Header file for feature_cache.cpp
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "feature_utils.h"
+#include "feature_store.h"
+#include "feature_matrix.h"
+#include "csv_utils.h"
+#include "knn_graph.h"
+#include "hnsw_index.h"
+#include "matcher_utils.h"
+#include "quantize_utils.h"
+
+// Size and modification time of a file; a change means it must be reloaded.
+struct FileStamp {
+    bool exists = false;
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+
+    bool operator==(const FileStamp &o) const {
+        return exists == o.exists && size == o.size && mtime == o.mtime;
+    }
+    bool operator!=(const FileStamp &o) const { return !(*this == o); }
+};
+
+//Stamp of a file; exists is false if it cannot be stat'ed.
+FileStamp stampFile(const std::string &path);
+
+//Feature type of a CSV database, guessed from its file name (not the
+//directories above it); BASELINE if the name does not say.
+FeatureType csvFeatureType(const std::string &path);
+
+// A feature database kept in memory between queries: a mapped binary
+// store, parsed CSV rows or a quantized DNN_EMB store, with a name lookup
+// and, for stores, any .knn graph or .hnsw index that is at least as new
+// as the store. A quantized database also maps the float store beside it
+// (<stem>.bin), if no newer, for re-ranking; only the rows re-ranked are
+// read from it.
+struct ResidentDatabase {
+    std::string path;
+    FeatureType type = BASELINE;
+    uint64_t generation = 0; // changes whenever anything below is reloaded
+
+    FeatureStore store; // .bin databases, or the float rows of a quantized one
+    FeatureMatrix rows; // .csv databases
+    CsvStats csv;       // what reading the .csv skipped
+    std::unique_ptr<QuantizedStore> quant; // .sq8/.pq databases
+    std::unordered_map<std::string, size_t> rowOf;
+
+    std::unique_ptr<KnnGraph> graph;
+    std::unique_ptr<HnswIndex> hnsw;
+
+    FileStamp stamp, graphStamp, hnswStamp;
+    FileStamp exactStamp; // quantized databases: the float store beside it
+
+    bool isStore() const { return store.isOpen() && !quant; }
+    const FeatureView &view() const { return store.isOpen() ? store.view() : rows.view(); }
+    size_t count() const { return quant ? quant->count : view().count; }
+    std::string_view name(size_t i) const { return quant ? quant->name(i) : view().name(i); }
+
+    //Row holding name, or NO_ROW.
+    size_t find(const std::string &name) const {
+        auto it = rowOf.find(name);
+        return it == rowOf.end() ? NO_ROW : it->second;
+    }
+
+    //Copy of row i as an ImageFeature.
+    ImageFeature row(size_t i) const;
+};
+
+// Least-recently-used map holding at most `capacity` values.
+template <typename Key, typename Value>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity) : capacity(capacity) {}
+
+    //Value for key, marked most recently used, or nullptr.
+    Value *get(const Key &key) {
+        auto it = index.find(key);
+        if (it == index.end()) return nullptr;
+        order.splice(order.begin(), order, it->second);
+        return &it->second->second;
+    }
+
+    Value &put(const Key &key, Value value) {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(value);
+            order.splice(order.begin(), order, it->second);
+            return it->second->second;
+        }
+        order.emplace_front(key, std::move(value));
+        index[key] = order.begin();
+        if (order.size() > capacity) {
+            index.erase(order.back().first);
+            order.pop_back();
+        }
+        return order.front().second;
+    }
+
+    void clear() {
+        order.clear();
+        index.clear();
+    }
+
+    size_t size() const { return order.size(); }
+
+private:
+    size_t capacity;
+    std::list<std::pair<Key, Value>> order;
+    std::unordered_map<Key, typename std::list<std::pair<Key, Value>>::iterator> index;
+};
+
+// Feature databases, target features and recent results shared by
+// successive queries. Databases stay resident until their file changes on
+// disk; query results are remembered per database generation.
+class FeatureCache {
+public:
+    explicit FeatureCache(size_t targetCapacity = 64, size_t resultCapacity = 256);
+
+    //Resident database for path, loaded on first use and reloaded (in
+    //whole or just its indexes) when the files behind it change. csvType
+    //is the feature type of a CSV database. Returns nullptr if unreadable.
+    const ResidentDatabase *database(const std::string &path, FeatureType csvType);
+
+    //As above, with the type set by setFeatureType or guessed from the name.
+    const ResidentDatabase *database(const std::string &path) { return database(path, csvType(path)); }
+
+    //Top-N matches of target (an image filename in imageDir) against the
+    //database at path, leaving out the target itself. Answered from the
+    //result cache, the k-NN graph, the HNSW index or a full scan, in that
+    //order. A full scan reports its partial top-N through progress, which
+    //can stop it. N <= 0 gives no matches. Returns false and sets error if
+    //the query cannot be run or was stopped.
+    bool query(const std::string &path, const std::string &target,
+               const std::string &imageDir, int N,
+               std::vector<Match> &matches, std::string &error,
+               const MatchProgress &progress = nullptr);
+
+    //Cascade query: shortlist the nearest `shortlist` images to target by
+    //the cheap database at coarsePath, then rank only those by the
+    //database at path. Both must hold features of the same images. Results
+    //are cached like query's. Returns false and sets error on failure.
+    bool queryCascade(const std::string &coarsePath, const std::string &path,
+                      const std::string &target, const std::string &imageDir,
+                      int N, size_t shortlist,
+                      std::vector<Match> &matches, std::string &error);
+
+    //Exact rows re-ranked after searching a quantized (.sq8/.pq) database
+    //that has its float store beside it; 0 keeps the quantized ranking.
+    void setQuantRerank(size_t rerank) { quantRerank = rerank; }
+
+    //Search width for databases with an HNSW index; larger is slower but
+    //closer to the exact ranking.
+    void setHnswEf(size_t ef) { hnswEf = ef; }
+
+    //Feature type of the CSV database at path, for names csvFeatureType
+    //cannot guess. Binary stores record their own type.
+    void setFeatureType(const std::string &path, FeatureType type) { csvTypes[path] = type; }
+
+    void clear();
+
+private:
+    const ImageFeature *targetFeatures(const std::string &imagePath, const std::string &name,
+                                       FeatureType type, const DecodeScale &decode,
+                                       const FileStamp &stamp);
+    void refreshIndexes(ResidentDatabase &db);
+    FeatureType csvType(const std::string &path) const;
+    const ImageFeature *resolveTarget(const ResidentDatabase &db, const std::string &target,
+                                      const std::string &imageDir, ImageFeature &rowFeat,
+                                      std::string &error);
+
+    std::map<std::string, std::unique_ptr<ResidentDatabase>> databases;
+    LruCache<std::string, ImageFeature> targets;
+    LruCache<std::string, std::vector<Match>> results;
+    LruCache<std::string, std::vector<size_t>> alignments; // coarse row -> fine row
+    uint64_t nextGeneration = 1;
+    size_t quantRerank = DEFAULT_QUANT_RERANK;
+    size_t hnswEf = HNSW_QUERY_EF;
+    std::map<std::string, FeatureType> csvTypes;
+};
@@ -0,0 +1,316 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_matrix.cpp
+//
+// Contiguous in-memory feature databases. Every row of a matrix lives in
+// one aligned allocation with the same layout as a mapped store, so the
+// SIMD kernels and the top-N scan read both without any conversion, and a
+// scan walks memory linearly instead of chasing one heap block per image.
+// Sparse matrices keep the same single buffer, packed with SparseRow
+// encodings and indexed by a row offset table.
+
+#include "feature_matrix.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Row stride in bytes for dim elements of elem: a multiple of 64.
+static size_t rowStride(ElemType elem, size_t dim) {
+    size_t bytes = dim * (elem == ELEM_U8 ? sizeof(uint8_t) : sizeof(float));
+    return (bytes + 63) & ~size_t(63);
+}
+
+FeatureMatrix::FeatureMatrix(FeatureType type, size_t dim)
+    : FeatureMatrix(type, dim, elemTypeFor(type)) {}
+
+FeatureMatrix::FeatureMatrix(FeatureType type, size_t dim, ElemType elem) {
+    v.type = type;
+    v.elem = elem;
+    v.dim = dim;
+    v.stride = elem == ELEM_SPARSE ? 0 : rowStride(elem, dim);
+    sync();
+}
+
+FeatureMatrix::FeatureMatrix(const FeatureMatrix &other)
+    : nameOffsets(other.nameOffsets), names(other.names), rowOffsets(other.rowOffsets), v(other.v) {
+    reserveBytes(other.used);
+    if (other.used) memcpy(buf.get(), other.buf.get(), other.used);
+    used = other.used;
+    sync();
+}
+
+FeatureMatrix &FeatureMatrix::operator=(const FeatureMatrix &other) {
+    if (this != &other) *this = FeatureMatrix(other);
+    return *this;
+}
+
+FeatureMatrix::FeatureMatrix(FeatureMatrix &&other) noexcept
+    : buf(std::move(other.buf)), capacity(other.capacity), used(other.used),
+      nameOffsets(std::move(other.nameOffsets)), names(std::move(other.names)),
+      rowOffsets(std::move(other.rowOffsets)), v(other.v) {
+    other.capacity = 0;
+    other.clear();
+    sync();
+}
+
+FeatureMatrix &FeatureMatrix::operator=(FeatureMatrix &&other) noexcept {
+    if (this != &other) {
+        buf = std::move(other.buf);
+        capacity = other.capacity;
+        used = other.used;
+        nameOffsets = std::move(other.nameOffsets);
+        names = std::move(other.names);
+        rowOffsets = std::move(other.rowOffsets);
+        v = other.v;
+        other.capacity = 0;
+        other.clear();
+        sync();
+    }
+    return *this;
+}
+
+// Point the view at the current buffers.
+void FeatureMatrix::sync() {
+    if (nameOffsets.empty()) nameOffsets.push_back(0);
+    if (rowOffsets.empty()) rowOffsets.push_back(0);
+    v.rows = buf.get();
+    v.nameOffsets = nameOffsets.data();
+    v.names = names.data();
+    v.rowOffsets = sparse() ? rowOffsets.data() : nullptr;
+}
+
+void FeatureMatrix::clear() {
+    v.count = 0;
+    used = 0;
+    nameOffsets.assign(1, 0);
+    names.clear();
+    rowOffsets.assign(1, 0);
+    sync();
+}
+
+void FeatureMatrix::reserveBytes(size_t bytes) {
+    if (bytes <= capacity) return;
+
+    // aligned_alloc needs a size that is a multiple of the alignment.
+    bytes = (bytes + 63) & ~size_t(63);
+    auto *p = static_cast<unsigned char *>(std::aligned_alloc(64, bytes));
+    if (!p) throw std::bad_alloc();
+    if (used) memcpy(p, buf.get(), used);
+    buf.reset(p);
+    capacity = bytes;
+    sync();
+}
+
+void FeatureMatrix::reserve(size_t rows) {
+    nameOffsets.reserve(rows + 1);
+    if (sparse()) {
+        rowOffsets.reserve(rows + 1);
+        sync();
+    }
+    else if (v.stride) {
+        reserveBytes(rows * v.stride);
+    }
+}
+
+void FeatureMatrix::addName(std::string_view name) {
+    names.insert(names.end(), name.begin(), name.end());
+    names.push_back('\0');
+    nameOffsets.push_back(names.size());
+}
+
+// Reserve one more row of n elements and record its name. Returns the
+// zeroed row to fill, or nullptr with ok false on a dimension mismatch.
+unsigned char *FeatureMatrix::appendRow(std::string_view name, size_t n, bool &ok) {
+    if (v.count == 0 && v.dim == 0) {
+        v.dim = n;
+        v.stride = rowStride(v.elem, n);
+    }
+    ok = n == v.dim && v.stride > 0;
+    if (!ok) return nullptr;
+
+    if (used + v.stride > capacity) reserveBytes(std::max<size_t>(64 * v.stride, capacity * 2));
+    addName(name);
+
+    unsigned char *row = buf.get() + used;
+    memset(row, 0, v.stride);
+    used += v.stride;
+    v.count++;
+    sync();
+    return row;
+}
+
+// Append one SparseRow encoding of len bytes to a sparse matrix.
+bool FeatureMatrix::appendEncoded(std::string_view name, const unsigned char *row, size_t len) {
+    if (used + len > capacity) reserveBytes(std::max<size_t>(4096, std::max(used + len, capacity * 2)));
+    memcpy(buf.get() + used, row, len);
+    used += len;
+    rowOffsets.push_back(used);
+    addName(name);
+    v.count++;
+    sync();
+    return true;
+}
+
+bool FeatureMatrix::addRow(std::string_view name, const uint8_t *row, size_t n) {
+    if (v.elem != ELEM_U8) return false;
+    bool ok;
+    unsigned char *dst = appendRow(name, n, ok);
+    if (ok) memcpy(dst, row, n);
+    return ok;
+}
+
+bool FeatureMatrix::addRow(std::string_view name, const float *row, size_t n) {
+    if (sparse()) {
+        if (v.count == 0 && v.dim == 0) v.dim = n;
+        if (n != v.dim || n > 65536) return false;
+        scratch.clear();
+        encodeSparseRow(row, n, scratch);
+        return appendEncoded(name, scratch.data(), scratch.size());
+    }
+    if (v.elem != ELEM_F32) return false;
+    bool ok;
+    unsigned char *dst = appendRow(name, n, ok);
+    if (ok) memcpy(dst, row, n * sizeof(float));
+    return ok;
+}
+
+bool FeatureMatrix::addRow(const FeatureView &src, size_t i) {
+    if (src.elem == ELEM_U8) return addRow(src.name(i), src.u8(i), src.dim);
+    if (src.elem == ELEM_F32) return addRow(src.name(i), src.f32(i), src.dim);
+
+    // Sparse rows are copied as they are into a sparse matrix and
+    // expanded into a dense one.
+    if (sparse() && (src.dim == v.dim || (v.count == 0 && v.dim == 0))) {
+        v.dim = src.dim;
+        return appendEncoded(src.name(i), src.rows + src.rowOffsets[i],
+                             src.rowOffsets[i + 1] - src.rowOffsets[i]);
+    }
+    vector<float> row(src.dim);
+    src.expand(i, row.data());
+    return addRow(src.name(i), row.data(), src.dim);
+}
+
+bool FeatureMatrix::append(const FeatureMatrix &other) {
+    if (other.v.count == 0) return true;
+    if (other.v.elem != v.elem) {
+        for (size_t i = 0; i < other.v.count; i++) {
+            if (!addRow(other.v, i)) return false;
+        }
+        return true;
+    }
+    if (v.count == 0 && v.dim == 0) {
+        v.dim = other.v.dim;
+        v.stride = other.v.stride;
+    }
+    if (other.v.dim != v.dim) return false;
+
+    if (used + other.used > capacity) reserveBytes(std::max(used + other.used, capacity * 2));
+    memcpy(buf.get() + used, other.buf.get(), other.used);
+    if (sparse()) {
+        for (size_t i = 1; i <= other.v.count; i++) rowOffsets.push_back(used + other.rowOffsets[i]);
+    }
+    used += other.used;
+
+    uint64_t base = names.size();
+    names.insert(names.end(), other.names.begin(), other.names.end());
+    for (size_t i = 1; i <= other.v.count; i++) nameOffsets.push_back(base + other.nameOffsets[i]);
+    v.count += other.v.count;
+    sync();
+    return true;
+}
+
+bool FeatureMatrix::addFeature(const ImageFeature &f) {
+    bool ok;
+    if (v.elem == ELEM_U8) {
+        uint8_t *dst = appendRow(f.name, f.intFeat.size(), ok);
+        if (ok) {
+            for (size_t i = 0; i < v.dim; i++) dst[i] = (uint8_t)std::clamp(f.intFeat[i], 0, 255);
+        }
+    } else if (sparse()) {
+        vector<float> row(f.dblFeat.begin(), f.dblFeat.end());
+        ok = addRow(f.name, row.data(), row.size());
+    } else {
+        float *dst = reinterpret_cast<float *>(appendRow(f.name, f.dblFeat.size(), ok));
+        if (ok) {
+            for (size_t i = 0; i < v.dim; i++) dst[i] = float(f.dblFeat[i]);
+        }
+    }
+    return ok;
+}
+
+ImageFeature FeatureMatrix::feature(size_t i) const {
+    ImageFeature f;
+    f.name = std::string(v.name(i));
+    f.type = v.type;
+    if (v.elem == ELEM_U8) {
+        f.intFeat.assign(v.u8(i), v.u8(i) + v.dim);
+    } else {
+        vector<float> row(v.dim);
+        v.expand(i, row.data());
+        f.dblFeat.assign(row.begin(), row.end());
+    }
+    return f;
+}
+
+FeatureMatrix sparseCopy(const FeatureView &rows) {
+    if (rows.elem == ELEM_U8 || !sparseEligible(rows.type) || rows.dim > 65536) return FeatureMatrix();
+    FeatureMatrix db(rows.type, rows.dim, ELEM_SPARSE);
+    db.setDecode(rows.decode);
+    db.reserve(rows.count);
+    for (size_t i = 0; i < rows.count; i++) db.addRow(rows, i);
+    return db;
+}
+
+FeatureMatrix readFeatureStore(const string &filename) {
+    FeatureStore store;
+    if (!store.open(filename)) return FeatureMatrix();
+
+    const FeatureView &v = store.view();
+    FeatureMatrix db(v.type, v.dim, v.elem);
+    db.setDecode(v.decode);
+    db.reserve(v.count);
+    for (size_t i = 0; i < v.count; i++) db.addRow(v, i);
+    return db;
+}
+
+// Extract features for all images in a directory.
+FeatureMatrix extractDirFeatures(const string &dir, FeatureType type) {
+    FeatureMatrix db(type);
+
+    for (auto &p : fs::directory_iterator(dir)) {
+        if (!p.is_regular_file()) continue;
+        string fn = p.path().filename().string();
+        if (!isImageExtension(p.path().extension().string())) continue;
+
+        Mat img = decodeImage(p.path().string());
+        if (img.empty()) continue;
+
+        db.addFeature(computeFeatures(img, type, fn));
+    }
+    return db;
+}
+
+// Extract several feature types for all images in a directory,
+// decoding each image only once.
+map<FeatureType, FeatureMatrix> extractDirFeatureSet(const string &dir,
+                                                     const vector<FeatureType> &types) {
+    map<FeatureType, FeatureMatrix> stores;
+    for (FeatureType type : types) stores.emplace(type, FeatureMatrix(type));
+
+    for (auto &p : fs::directory_iterator(dir)) {
+        if (!p.is_regular_file()) continue;
+        string fn = p.path().filename().string();
+        if (!isImageExtension(p.path().extension().string())) continue;
+
+        Mat img = decodeImage(p.path().string());
+        if (img.empty()) continue;
+
+        for (auto &f : computeFeatureSet(img, types, fn)) {
+            stores.at(f.type).addFeature(f);
+        }
+    }
+    return stores;
+}
@@ -0,0 +1,111 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_matrix.h
+//
+// Header file for feature_matrix.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "feature_utils.h"
+#include "feature_store.h"
+
+// In-memory feature database: fixed-dimension rows in one 64-byte aligned
+// buffer laid out exactly like a mapped store (uint8 rows for BASELINE,
+// float32 otherwise, each padded to a multiple of 64 bytes) and a separate
+// name table. Rows are addressed by index through view(). A sparse matrix
+// (ELEM_SPARSE) instead packs SparseRow encodings back to back with a row
+// offset table, as a sparse store does.
+class FeatureMatrix {
+public:
+    //Empty matrix of a type. dim 0 takes the dimension of the first row.
+    explicit FeatureMatrix(FeatureType type = BASELINE, size_t dim = 0);
+
+    //Empty matrix with an explicit element type; ELEM_SPARSE requires a
+    //float type and encodes every row added as a SparseRow.
+    FeatureMatrix(FeatureType type, size_t dim, ElemType elem);
+
+    FeatureMatrix(const FeatureMatrix &other);
+    FeatureMatrix &operator=(const FeatureMatrix &other);
+    FeatureMatrix(FeatureMatrix &&other) noexcept;
+    FeatureMatrix &operator=(FeatureMatrix &&other) noexcept;
+
+    FeatureType type() const { return v.type; }
+    ElemType elem() const { return v.elem; }
+    size_t dim() const { return v.dim; }
+    size_t count() const { return v.count; }
+    bool empty() const { return v.count == 0; }
+    bool sparse() const { return v.elem == ELEM_SPARSE; }
+
+    //Bytes of row data held (not counting names).
+    size_t rowBytes() const { return used; }
+
+    //Zero-copy view of the rows; valid until the matrix is modified.
+    const FeatureView &view() const { return v; }
+    std::string_view name(size_t i) const { return v.name(i); }
+
+    //Decode scale recorded when the rows are written to a store.
+    void setDecode(const DecodeScale &decode) { v.decode = decode; }
+
+    //Make room for rows without reallocating.
+    void reserve(size_t rows);
+
+    //Append a row. Returns false, adding nothing, if n differs from dim().
+    bool addRow(std::string_view name, const uint8_t *row, size_t n);
+    bool addRow(std::string_view name, const float *row, size_t n);
+
+    //Append an extractor result, clamping BASELINE values to 0-255.
+    bool addFeature(const ImageFeature &f);
+
+    //Append row i of another block of rows of the same type and dim.
+    bool addRow(const FeatureView &src, size_t i);
+
+    //Append all rows of another matrix of the same type and dim.
+    bool append(const FeatureMatrix &other);
+
+    //Copy of row i as an ImageFeature.
+    ImageFeature feature(size_t i) const;
+
+    void clear();
+
+private:
+    struct FreeDeleter {
+        void operator()(unsigned char *p) const { std::free(p); }
+    };
+
+    unsigned char *appendRow(std::string_view name, size_t n, bool &ok);
+    bool appendEncoded(std::string_view name, const unsigned char *row, size_t len);
+    void addName(std::string_view name);
+    void reserveBytes(size_t bytes);
+    void sync();
+
+    std::unique_ptr<unsigned char, FreeDeleter> buf;
+    size_t capacity = 0; // bytes
+    size_t used = 0;     // bytes
+    std::vector<uint64_t> nameOffsets{0};
+    std::vector<char> names;
+    std::vector<uint64_t> rowOffsets{0}; // sparse rows only
+    std::vector<unsigned char> scratch;  // encoding of the row being added
+    FeatureView v;
+};
+
+//Sparse copy of a block of float rows of a sparse-eligible type, or an
+//empty matrix if the rows cannot be stored sparse.
+FeatureMatrix sparseCopy(const FeatureView &rows);
+
+//Copy every row of a binary feature store into memory, keeping sparse
+//stores sparse. Returns an empty matrix if the store cannot be opened.
+FeatureMatrix readFeatureStore(const string &filename);
+
+//Extract features for all images in a directory.
+FeatureMatrix extractDirFeatures(const string &dir, FeatureType type);
+
+//Extract several feature types for all images in a directory in one pass.
+map<FeatureType, FeatureMatrix> extractDirFeatureSet(const string &dir, const vector<FeatureType> &types);
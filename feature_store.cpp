@@ -0,0 +1,321 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_store.cpp
+//
+// Versioned binary feature store. Rows are written contiguously after a
+// header and a name table, and read back through a read-only memory map
+// so that opening a store does not parse or copy any feature data.
+
+#include "feature_store.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char STORE_MAGIC[8] = {'C', 'B', 'I', 'R', 'F', 'S', 'T', '\0'};
+
+// Round n up to the next multiple of 64.
+static uint64_t align64(uint64_t n) {
+    return (n + 63) & ~uint64_t(63);
+}
+
+// Size of a version 1 header, which has no decode fields.
+static const size_t V1_HEADER_SIZE = offsetof(FeatureStoreHeader, decodeFactor);
+
+static size_t elemSize(ElemType elem) {
+    return elem == ELEM_U8 ? sizeof(uint8_t) : sizeof(float);
+}
+
+ElemType elemTypeFor(FeatureType type) {
+    return type == BASELINE || isHashType(type) ? ELEM_U8 : ELEM_F32;
+}
+
+bool sparseEligible(FeatureType type) {
+    return type == COLOR || type == MULTIHIST || type == COLOR_TEXTURE || type == CUSTOM;
+}
+
+// Encoded size of a row with nnz nonzero values out of dim.
+static size_t sparseRowBytes(size_t nnz, size_t dim) {
+    if (nnz > dim * SPARSE_MAX_FILL) return sizeof(uint32_t) + dim * sizeof(float);
+    return sizeof(uint32_t) + ((nnz * sizeof(uint16_t) + 3) & ~size_t(3)) + nnz * sizeof(float);
+}
+
+static size_t countNonzero(const float *row, size_t dim) {
+    size_t nnz = 0;
+    for (size_t j = 0; j < dim; j++) nnz += row[j] != 0.0f;
+    return nnz;
+}
+
+void encodeSparseRow(const float *row, size_t dim, vector<unsigned char> &out) {
+    size_t nnz = countNonzero(row, dim);
+    size_t start = out.size();
+    out.resize(start + sparseRowBytes(nnz, dim), 0);
+    unsigned char *p = out.data() + start;
+
+    uint32_t header = nnz > dim * SPARSE_MAX_FILL ? SPARSE_DENSE_ROW : uint32_t(nnz);
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    if (header == SPARSE_DENSE_ROW) {
+        memcpy(p, row, dim * sizeof(float));
+        return;
+    }
+
+    unsigned char *values = p + ((nnz * sizeof(uint16_t) + 3) & ~size_t(3));
+    for (size_t j = 0, k = 0; j < dim; j++) {
+        if (row[j] == 0.0f) continue;
+        uint16_t index = uint16_t(j);
+        memcpy(p + k * sizeof(uint16_t), &index, sizeof(index));
+        memcpy(values + k * sizeof(float), &row[j], sizeof(float));
+        k++;
+    }
+}
+
+void FeatureView::expand(size_t i, float *out) const {
+    if (elem == ELEM_F32) {
+        memcpy(out, f32(i), dim * sizeof(float));
+        return;
+    }
+    SparseRow r = sparse(i);
+    if (r.dense) {
+        memcpy(out, r.dense, dim * sizeof(float));
+        return;
+    }
+    fill(out, out + dim, 0.0f);
+    for (uint32_t k = 0; k < r.nnz; k++) {
+        if (r.index[k] < dim) out[r.index[k]] = r.value[k];
+    }
+}
+
+bool preferSparse(const FeatureView &rows) {
+    if (rows.elem != ELEM_F32 || !sparseEligible(rows.type) || rows.dim > 65536) return false;
+    double sparseBytes = 0;
+    for (size_t i = 0; i < rows.count; i++) sparseBytes += sparseRowBytes(countNonzero(rows.f32(i), rows.dim), rows.dim);
+    return sparseBytes <= 0.75 * double(rows.count) * align64(rows.dim * sizeof(float));
+}
+
+// Write the offset table and encoded rows of a sparse store. Dense float
+// rows are encoded on the way.
+static void writeSparseRows(ofstream &file, const FeatureView &rows, uint64_t tableBytes) {
+    vector<uint64_t> offsets(rows.count + 1, 0);
+    for (size_t i = 0; i < rows.count; i++) {
+        uint64_t len = rows.elem == ELEM_SPARSE
+            ? rows.rowOffsets[i + 1] - rows.rowOffsets[i]
+            : sparseRowBytes(countNonzero(rows.f32(i), rows.dim), rows.dim);
+        offsets[i + 1] = offsets[i] + len;
+    }
+    file.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    vector<char> pad(tableBytes - offsets.size() * sizeof(uint64_t), 0);
+    file.write(pad.data(), pad.size());
+
+    if (rows.elem == ELEM_SPARSE) {
+        file.write(reinterpret_cast<const char *>(rows.rows + rows.rowOffsets[0]), offsets[rows.count]);
+        return;
+    }
+    vector<unsigned char> row;
+    for (size_t i = 0; i < rows.count; i++) {
+        row.clear();
+        encodeSparseRow(rows.f32(i), rows.dim, row);
+        file.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+}
+
+// Write a block of rows to a binary store, recording rows.decode.
+bool writeFeatureStore(const string &filename, const FeatureView &rows) {
+    vector<uint64_t> nameOffsets(rows.count + 1, 0);
+    for (size_t i = 0; i < rows.count; i++) {
+        nameOffsets[i + 1] = nameOffsets[i] + rows.name(i).size() + 1;
+    }
+    uint64_t blobSize = nameOffsets[rows.count];
+
+    bool sparse = rows.elem == ELEM_SPARSE || preferSparse(rows);
+
+    FeatureStoreHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+    h.version = FEATURE_STORE_VERSION;
+    h.type = rows.type;
+    h.elem = sparse ? ELEM_SPARSE : rows.elem;
+    h.dim = uint32_t(rows.dim);
+    h.decodeFactor = uint32_t(rows.decode.factor);
+    h.decodeMaxSide = uint32_t(rows.decode.maxSide);
+    h.count = rows.count;
+    h.rowStride = sparse ? 0 : align64(rows.dim * elemSize(rows.elem));
+    h.namesOffset = sizeof(FeatureStoreHeader);
+    h.blobOffset = h.namesOffset + nameOffsets.size() * sizeof(uint64_t);
+    h.rowsOffset = align64(h.blobOffset + blobSize);
+    h.fileSize = h.rowsOffset + h.count * h.rowStride;
+
+    uint64_t tableBytes = align64((h.count + 1) * sizeof(uint64_t));
+    if (sparse) {
+        uint64_t data = 0;
+        for (size_t i = 0; i < rows.count; i++) {
+            data += rows.elem == ELEM_SPARSE
+                ? rows.rowOffsets[i + 1] - rows.rowOffsets[i]
+                : sparseRowBytes(countNonzero(rows.f32(i), rows.dim), rows.dim);
+        }
+        h.fileSize = h.rowsOffset + tableBytes + data;
+    }
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    if (!file) return false;
+
+    file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char *>(nameOffsets.data()),
+               nameOffsets.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < rows.count; i++) {
+        std::string_view name = rows.name(i);
+        file.write(name.data(), name.size());
+        file.put('\0');
+    }
+
+    vector<char> pad(h.rowsOffset - (h.blobOffset + blobSize), 0);
+    file.write(pad.data(), pad.size());
+
+    if (sparse) {
+        writeSparseRows(file, rows, tableBytes);
+        file.close();
+        return bool(file);
+    }
+
+    // Matrices and stores already use the store stride; other views are
+    // repacked row by row.
+    size_t bytes = rows.dim * elemSize(rows.elem);
+    if (rows.stride == h.rowStride) {
+        file.write(reinterpret_cast<const char *>(rows.rows), h.count * h.rowStride);
+    } else {
+        vector<unsigned char> row(h.rowStride, 0);
+        for (size_t i = 0; i < rows.count; i++) {
+            memcpy(row.data(), rows.rows + i * rows.stride, bytes);
+            file.write(reinterpret_cast<const char *>(row.data()), row.size());
+        }
+    }
+    file.close();
+    return bool(file);
+}
+
+FeatureStore::~FeatureStore() {
+    close();
+}
+
+FeatureStore::FeatureStore(FeatureStore &&other) noexcept
+    : base(other.base), mappedSize(other.mappedSize), v(other.v) {
+    other.base = nullptr;
+    other.mappedSize = 0;
+    other.v = FeatureView();
+}
+
+FeatureStore &FeatureStore::operator=(FeatureStore &&other) noexcept {
+    if (this != &other) {
+        close();
+        base = other.base;
+        mappedSize = other.mappedSize;
+        v = other.v;
+        other.base = nullptr;
+        other.mappedSize = 0;
+        other.v = FeatureView();
+    }
+    return *this;
+}
+
+void FeatureStore::close() {
+    if (base) munmap(base, mappedSize);
+    base = nullptr;
+    mappedSize = 0;
+    v = FeatureView();
+}
+
+void FeatureStore::advise(int advice) const {
+    if (base) madvise(base, mappedSize, advice);
+}
+
+// Map a store file and validate its header against the file size.
+// Version 1 stores are still accepted.
+bool FeatureStore::open(const string &filename) {
+    ScopedTimer timer(STAGE_STORE_LOAD);
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < V1_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = size_t(st.st_size);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+
+    const FeatureStoreHeader *h = static_cast<const FeatureStoreHeader *>(p);
+    size_t headerSize = h->version == 1 ? V1_HEADER_SIZE : sizeof(FeatureStoreHeader);
+    bool sparse = h->elem == ELEM_SPARSE;
+    uint64_t dataOffset = sparse ? h->rowsOffset + align64((h->count + 1) * sizeof(uint64_t)) : h->rowsOffset;
+    // The count is bounded by the file size before any offset is derived
+    // from it, and each section must lie inside the file after the last.
+    bool ok = memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) == 0
+        && h->version >= 1 && h->version <= FEATURE_STORE_VERSION
+        && size >= headerSize
+        && h->type <= LAST_FEATURE_TYPE
+        && h->elem <= ELEM_SPARSE
+        && h->namesOffset == headerSize
+        && h->rowsOffset % 64 == 0
+        && h->fileSize == size
+        && h->count < size / sizeof(uint64_t)
+        && h->blobOffset == h->namesOffset + (h->count + 1) * sizeof(uint64_t)
+        && h->blobOffset <= h->rowsOffset && h->rowsOffset <= size
+        && (sparse ? h->rowStride == 0 && h->dim <= 65536 && dataOffset <= size
+                   : h->rowStride >= h->dim * elemSize(ElemType(h->elem))
+                     && (h->count == 0 ? h->rowsOffset == size
+                                       : (size - h->rowsOffset) % h->count == 0
+                                         && (size - h->rowsOffset) / h->count == h->rowStride));
+    if (ok) {
+        // Names ascend through the blob, each ending in its own '\0'
+        // before the rows begin.
+        const unsigned char *bytes = static_cast<const unsigned char *>(p);
+        const uint64_t *offs = reinterpret_cast<const uint64_t *>(bytes + h->namesOffset);
+        const char *blob = reinterpret_cast<const char *>(bytes + h->blobOffset);
+        uint64_t blobSize = h->rowsOffset - h->blobOffset;
+        ok = offs[0] == 0;
+        for (uint64_t i = 0; ok && i < h->count; i++) {
+            ok = offs[i] < offs[i + 1] && offs[i + 1] <= blobSize && blob[offs[i + 1] - 1] == '\0';
+        }
+    }
+    if (ok && sparse) {
+        // Row offsets must ascend and end at the end of the file.
+        const uint64_t *rowOffs = reinterpret_cast<const uint64_t *>(
+            static_cast<const unsigned char *>(p) + h->rowsOffset);
+        ok = rowOffs[0] == 0 && dataOffset + rowOffs[h->count] == size;
+        for (uint64_t i = 0; ok && i < h->count; i++) ok = rowOffs[i] <= rowOffs[i + 1];
+    }
+    if (!ok) {
+        munmap(p, size);
+        return false;
+    }
+
+    base = p;
+    mappedSize = size;
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(p);
+    v.type = FeatureType(h->type);
+    v.elem = ElemType(h->elem);
+    v.dim = h->dim;
+    v.count = h->count;
+    v.stride = h->rowStride;
+    v.decode = DecodeScale();
+    if (h->version >= 2) {
+        v.decode.factor = int(h->decodeFactor);
+        v.decode.maxSide = int(h->decodeMaxSide);
+    }
+    v.rows = bytes + dataOffset;
+    v.rowOffsets = sparse ? reinterpret_cast<const uint64_t *>(bytes + h->rowsOffset) : nullptr;
+    v.nameOffsets = reinterpret_cast<const uint64_t *>(bytes + h->namesOffset);
+    v.names = reinterpret_cast<const char *>(bytes + h->blobOffset);
+    return true;
+}
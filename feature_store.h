@@ -0,0 +1,172 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: feature_store.h
+//
+// Header file for feature_store.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "feature_utils.h"
+
+// Element type of the rows in a binary feature store.
+enum ElemType {
+    ELEM_U8,
+    ELEM_F32,
+    ELEM_SPARSE // variable-length float rows, see SparseRow
+};
+
+// One row of an ELEM_SPARSE block. Encoded as uint32 nnz, then nnz
+// ascending uint16 bin indices (padded to 4 bytes), then nnz float values;
+// a row too full to gain from this has nnz == SPARSE_DENSE_ROW and all dim
+// floats instead. Zero bins contribute nothing to a histogram intersection,
+// so only the stored bins need to be compared.
+struct SparseRow {
+    uint32_t nnz = 0;
+    const uint16_t *index = nullptr;
+    const float *value = nullptr;
+    const float *dense = nullptr; // set instead for a row stored dense
+};
+
+const uint32_t SPARSE_DENSE_ROW = 0xFFFFFFFF;
+
+// Rows whose share of nonzero bins is at most this are stored sparse.
+const double SPARSE_MAX_FILL = 0.5;
+
+// On-disk header of a binary feature store (native byte order).
+// Layout: header | name offsets (count+1 x uint64) | name blob | rows.
+// Rows start on a 64-byte boundary and are padded to a multiple of 64 bytes.
+// ELEM_SPARSE stores have rowStride 0, and their rows section starts with
+// count+1 uint64 row offsets followed, from the next 64-byte boundary, by
+// the encoded rows.
+// Version 1 headers end at fileSize and imply a full-resolution decode.
+struct FeatureStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint32_t elem;
+    uint32_t dim;
+    uint64_t count;
+    uint64_t rowStride;
+    uint64_t namesOffset;
+    uint64_t blobOffset;
+    uint64_t rowsOffset;
+    uint64_t fileSize;
+    uint32_t decodeFactor;  // DecodeScale the rows were extracted at
+    uint32_t decodeMaxSide;
+};
+
+const uint32_t FEATURE_STORE_VERSION = 3;
+
+// Zero-copy view of a block of fixed-dimension feature rows. Dense rows
+// are stride bytes apart; ELEM_SPARSE rows are found through rowOffsets.
+struct FeatureView {
+    FeatureType type = BASELINE;
+    ElemType elem = ELEM_U8;
+    size_t dim = 0;
+    size_t count = 0;
+    size_t stride = 0;
+    const unsigned char *rows = nullptr;
+    const uint64_t *nameOffsets = nullptr;
+    const char *names = nullptr;
+    DecodeScale decode; // scale the rows were extracted at
+    const uint64_t *rowOffsets = nullptr; // ELEM_SPARSE: count+1 byte offsets from rows
+
+    const uint8_t *u8(size_t i) const {
+        return reinterpret_cast<const uint8_t *>(rows + i * stride);
+    }
+    const float *f32(size_t i) const {
+        return reinterpret_cast<const float *>(rows + i * stride);
+    }
+    std::string_view name(size_t i) const {
+        return std::string_view(names + nameOffsets[i],
+                                nameOffsets[i + 1] - nameOffsets[i] - 1);
+    }
+
+    //Row i of an ELEM_SPARSE block. A row whose encoding does not fit its
+    //extent reads as all zeros.
+    SparseRow sparse(size_t i) const {
+        SparseRow r;
+        const unsigned char *p = rows + rowOffsets[i];
+        size_t len = rowOffsets[i + 1] - rowOffsets[i];
+        if (len < sizeof(uint32_t)) return r;
+        uint32_t nnz;
+        memcpy(&nnz, p, sizeof(nnz));
+        p += sizeof(uint32_t);
+        if (nnz == SPARSE_DENSE_ROW) {
+            if (len == sizeof(uint32_t) + dim * sizeof(float)) r.dense = reinterpret_cast<const float *>(p);
+            return r;
+        }
+        size_t indexBytes = (size_t(nnz) * sizeof(uint16_t) + 3) & ~size_t(3);
+        if (len != sizeof(uint32_t) + indexBytes + size_t(nnz) * sizeof(float)) return r;
+        r.nnz = nnz;
+        r.index = reinterpret_cast<const uint16_t *>(p);
+        r.value = reinterpret_cast<const float *>(p + indexBytes);
+        return r;
+    }
+
+    //Row i of a float or sparse block as dim floats.
+    void expand(size_t i, float *out) const;
+
+    //Values a full comparison with row i reads: dim, or the nonzeros of a
+    //row stored sparse.
+    size_t values(size_t i) const {
+        if (elem != ELEM_SPARSE) return dim;
+        SparseRow r = sparse(i);
+        return r.dense ? dim : r.nnz;
+    }
+};
+
+// Read-only memory-mapped binary feature store.
+class FeatureStore {
+public:
+    FeatureStore() = default;
+    ~FeatureStore();
+    FeatureStore(const FeatureStore &) = delete;
+    FeatureStore &operator=(const FeatureStore &) = delete;
+    FeatureStore(FeatureStore &&other) noexcept;
+    FeatureStore &operator=(FeatureStore &&other) noexcept;
+
+    //Map a store file. Returns false if the file is missing or malformed.
+    bool open(const std::string &filename);
+    void close();
+
+    bool isOpen() const { return base != nullptr; }
+    const FeatureView &view() const { return v; }
+
+    //Size of the mapped file in bytes.
+    size_t mappedBytes() const { return mappedSize; }
+
+    //Pass an madvise hint (e.g. MADV_WILLNEED to start reading the file in
+    //before it is scanned) for the whole mapping.
+    void advise(int advice) const;
+
+private:
+    void *base = nullptr;
+    size_t mappedSize = 0;
+    FeatureView v;
+};
+
+//Element type used to store rows of a given feature type.
+ElemType elemTypeFor(FeatureType type);
+
+//True for the whole-image histogram types, which may be stored sparse.
+bool sparseEligible(FeatureType type);
+
+//Append the SparseRow encoding of a float row to out, sparse or dense
+//by its fill.
+void encodeSparseRow(const float *row, size_t dim, std::vector<unsigned char> &out);
+
+//True if rows are float rows of a sparse-eligible type that would take at
+//most 3/4 of their dense size encoded sparse.
+bool preferSparse(const FeatureView &rows);
+
+//Write a block of rows (a matrix or another store) to a binary feature
+//store, recording rows.decode in the header. Sparse rows are written as
+//they are, and dense rows are encoded sparse when preferSparse says so.
+bool writeFeatureStore(const std::string &filename, const FeatureView &rows);
@@ -3,18 +3,14 @@
 //File: feature_utils.cpp
 //
 //Image feature extraction utilities.
-// Includes baseline patch features, color histograms,
-// texture histograms, and CSV read/write helpers.
+// Includes baseline patch features, color histograms
+// and texture histograms; CSV I/O lives in feature_matrix.cpp.
 
 #include "feature_utils.h"
-#include <filesystem>
-#include <fstream>
-#include <sstream>
+#include "metrics.h"
 #include <cmath>
 #include <algorithm>
 
-namespace fs = std::filesystem;
-
 //Extract a simple baseline feature: pixel values from the center 7x7 patch.
 static vector<int> baseline7x7(const Mat &img) {
     int cx = img.cols / 2;
@@ -33,89 +29,181 @@ static vector<int> baseline7x7(const Mat &img) {
     return feat;
 }
 
+// Sub-histograms per extractor; consecutive pixels go to different copies
+// so repeated bins do not stall on a store-to-load dependency.
+static const int SUB_HISTS = 4;
+
+// Sum the sub-histograms and normalize by the pixel count.
+static vector<double> normalizeCounts(const vector<uint32_t> &counts, size_t bins, double total) {
+    vector<double> hist(bins, 0.0);
+    for (int s = 0; s < SUB_HISTS; s++) {
+        for (size_t i = 0; i < bins; i++) hist[i] += counts[s * bins + i];
+    }
+    if (total > 0) {
+        for (double &v : hist) v /= total;
+    }
+    return hist;
+}
+
 // Compute normalized 2D rg histogram.
+// The bin of r = R/(R+G+B) is floor(bins*R / sum), computed with a
+// per-sum 32-bit reciprocal: m = ceil(2^32/sum) gives the exact quotient
+// whenever bins*R*sum < 2^32, so bins match the floating-point version.
 static vector<double> rgHistogram(const Mat &img, int bins = 16) {
-    vector<double> hist(bins * bins, 0.0);
+    static const vector<uint64_t> recip = [] {
+        vector<uint64_t> r(3 * 255 + 1, 0);
+        for (size_t s = 1; s < r.size(); s++) r[s] = ((uint64_t(1) << 32) + s - 1) / s;
+        return r;
+    }();
+
+    size_t nbins = size_t(bins) * bins;
+    vector<uint32_t> counts(SUB_HISTS * nbins, 0);
 
     for (int y = 0; y < img.rows; y++) {
-        for (int x = 0; x < img.cols; x++) {
-            Vec3b p = img.at<Vec3b>(y, x);
-            double B = p[0], G = p[1], R = p[2];
-            double sum = R + G + B;
+        const uchar *p = img.ptr<uchar>(y);
+        for (int x = 0; x < img.cols; x++, p += 3) {
+            uint32_t B = p[0], G = p[1], R = p[2];
+            uint32_t sum = R + G + B;
             if (sum == 0) continue;
 
-            double r = R / sum;
-            double g = G / sum;
+            uint32_t ri = uint32_t((uint64_t(bins * R) * recip[sum]) >> 32);
+            uint32_t gi = uint32_t((uint64_t(bins * G) * recip[sum]) >> 32);
+            ri = min<uint32_t>(bins - 1, ri);
+            gi = min<uint32_t>(bins - 1, gi);
 
-            int ri = min(bins - 1, int(r * bins));
-            int gi = min(bins - 1, int(g * bins));
-
-            hist[ri * bins + gi] += 1.0;
+            counts[(x & (SUB_HISTS - 1)) * nbins + ri * bins + gi]++;
         }
     }
 
-    double total = img.rows * img.cols;
-    for (double &v : hist) v /= total;
-    return hist;
+    return normalizeCounts(counts, nbins, double(img.rows) * img.cols);
 }
 
 // Compute normalized RGB histogram with 3D bins (R,G,B).
+// Each channel value maps through a lookup table that already holds its
+// bin multiplied by the stride of that channel in the flat histogram.
 static vector<double> rgbHistogram(const Mat &img, int bins = 8) {
-    vector<double> hist(bins * bins * bins, 0.0);
+    uint32_t lutB[256], lutG[256], lutR[256];
+    for (int v = 0; v < 256; v++) {
+        uint32_t bin = min(v * bins / 256, bins - 1);
+        lutB[v] = bin;
+        lutG[v] = bin * bins;
+        lutR[v] = bin * bins * bins;
+    }
+
+    size_t nbins = size_t(bins) * bins * bins;
+    vector<uint32_t> counts(SUB_HISTS * nbins, 0);
 
     for (int y = 0; y < img.rows; y++) {
-        for (int x = 0; x < img.cols; x++) {
-            Vec3b p = img.at<Vec3b>(y, x);
-            int b = p[0], g = p[1], r = p[2];
+        const uchar *p = img.ptr<uchar>(y);
+        for (int x = 0; x < img.cols; x++, p += 3) {
+            uint32_t idx = lutR[p[2]] + lutG[p[1]] + lutB[p[0]];
+            counts[(x & (SUB_HISTS - 1)) * nbins + idx]++;
+        }
+    }
 
-            int bi = b * bins / 256;
-            int gi = g * bins / 256;
-            int ri = r * bins / 256;
+    return normalizeCounts(counts, nbins, double(img.rows) * img.cols);
+}
 
-            bi = min(bi, bins - 1);
-            gi = min(gi, bins - 1);
-            ri = min(ri, bins - 1);
+// Largest squared 3x3 Sobel magnitude of an 8-bit image: |gx|,|gy| <= 4*255.
+static const int MAX_SOBEL_SQ = 2 * (4 * 255) * (4 * 255);
 
-            hist[ri * bins * bins + gi * bins + bi] += 1.0;
-        }
+// Reflect-101 border index, as used by cv::Sobel by default.
+static int reflect101(int i, int n) {
+    if (n == 1) return 0;
+    if (i < 0) return -i;
+    if (i >= n) return 2 * n - 2 - i;
+    return i;
+}
+
+// Squared 3x3 Sobel magnitudes of the gray row m, between rows a and b;
+// each row is padded by one pixel on each side. The responses are exact
+// integers, so the squares are too. The rows are marked __restrict, or the
+// compiler would not vectorize the loop, since the stores into sq might
+// change the bytes being read.
+static void sobelSquaredRow(const uchar *__restrict a, const uchar *__restrict m,
+                            const uchar *__restrict b, int32_t *__restrict sq, int cols) {
+    for (int x = 0; x < cols; x++) {
+        int gx = (a[x + 2] - a[x]) + 2 * (m[x + 2] - m[x]) + (b[x + 2] - b[x]);
+        int gy = (b[x] + 2 * b[x + 1] + b[x + 2]) - (a[x] + 2 * a[x + 1] + a[x + 2]);
+        sq[x] = gx * gx + gy * gy;
     }
+}
 
-    double total = img.rows * img.cols;
-    for (double &v : hist) v /= total;
-    return hist;
+// Stream an image through a 3-row window of gray rows and pass each row's
+// squared Sobel magnitudes to rowFn(sq, cols).
+template <typename RowFn>
+static void sobelSquaredRows(const Mat &img, RowFn rowFn) {
+    int rows = img.rows, cols = img.cols;
+
+    // Gray rows padded by one reflected pixel on each side.
+    vector<uchar> window(3 * size_t(cols + 2));
+    vector<int32_t> sq(cols);
+    auto grayRow = [&](int y) { return window.data() + (y % 3) * size_t(cols + 2); };
+    auto loadRow = [&](int y) {
+        uchar *g = grayRow(y);
+        Mat dst(1, cols, CV_8U, g + 1);
+        cvtColor(img.row(y), dst, COLOR_BGR2GRAY);
+        g[0] = g[1 + reflect101(-1, cols)];
+        g[cols + 1] = g[1 + reflect101(cols, cols)];
+    };
+
+    loadRow(0);
+    if (rows > 1) loadRow(1);
+
+    for (int y = 0; y < rows; y++) {
+        if (y + 1 < rows && y >= 1) loadRow(y + 1);
+        sobelSquaredRow(grayRow(reflect101(y - 1, rows)), grayRow(y),
+                        grayRow(reflect101(y + 1, rows)), sq.data(), cols);
+        rowFn(sq.data(), cols);
+    }
 }
 
 // Compute histogram of Sobel gradient magnitudes.
+// Streams the image once, counting each pixel's squared magnitude in a
+// fixed per-thread table; the responses are exact integers, bounded for
+// 8-bit input. Once the maximum is known, the bin edges become squared-
+// magnitude thresholds and the table is folded into bins between them,
+// so the bins match the full-frame float version without a second pass.
 static vector<double> sobelMagnitudeHist(const Mat &img, int bins = 16) {
-    Mat gray;
-    cvtColor(img, gray, COLOR_BGR2GRAY);
+    thread_local vector<uint32_t> sqCounts(MAX_SOBEL_SQ + 1, 0);
 
-    Mat gx, gy;
-    Sobel(gray, gx, CV_32F, 1, 0);
-    Sobel(gray, gy, CV_32F, 0, 1);
+    int rows = img.rows, cols = img.cols;
+    vector<double> hist(bins, 0.0);
+    if (rows == 0 || cols == 0) return hist;
 
-    Mat mag;
-    magnitude(gx, gy, mag);
+    int32_t maxSq = 0;
+    sobelSquaredRows(img, [&](const int32_t *sq, int n) {
+        int32_t m = maxSq;
+        for (int x = 0; x < n; x++) m = max(m, sq[x]);
+        for (int x = 0; x < n; x++) sqCounts[sq[x]]++;
+        maxSq = m;
+    });
 
-    double maxVal = 0;
-    for (int y = 0; y < mag.rows; y++) {
-        for (int x = 0; x < mag.cols; x++) {
-            maxVal = std::max(maxVal, (double)mag.at<float>(y, x));
-        }
-    }
+    double maxVal = std::sqrt(float(maxSq));
     if (maxVal == 0) maxVal = 1;
-
-    vector<double> hist(bins, 0.0);
-    for (int y = 0; y < mag.rows; y++) {
-        for (int x = 0; x < mag.cols; x++) {
-            float v = mag.at<float>(y, x);
-            int bin = min(bins - 1, int(v / maxVal * bins));
-            hist[bin] += 1.0;
+    auto binOf = [&](int32_t s) { return min(bins - 1, int(std::sqrt(float(s)) / maxVal * bins)); };
+
+    // edges[k]: smallest squared magnitude in bin k or above, found by
+    // bisection since binOf never decreases.
+    vector<int32_t> edges(bins + 1);
+    edges[bins] = maxSq + 1;
+    for (int k = 1; k < bins; k++) {
+        int32_t lo = 0, hi = maxSq + 1;
+        while (lo < hi) {
+            int32_t mid = lo + (hi - lo) / 2;
+            if (binOf(mid) >= k) hi = mid;
+            else lo = mid + 1;
         }
+        edges[k] = lo;
     }
 
-    double total = mag.rows * mag.cols;
-    for (double &v : hist) v /= total;
+    double total = double(rows) * cols;
+    for (int k = 0; k < bins; k++) {
+        uint64_t c = 0;
+        for (int32_t s = edges[k]; s < edges[k + 1]; s++) c += sqCounts[s];
+        hist[k] = c / total;
+    }
+    fill(sqCounts.begin(), sqCounts.begin() + maxSq + 1, 0);
     return hist;
 }
 
@@ -134,6 +222,103 @@ static vector<double> multiHistTopBottom(const Mat &img) {
     return feat;
 }
 
+// Cells per side of the integral histogram. Every region of a spatial
+// layout is a rectangle of whole cells, so its grid size must divide this.
+static const int INTEGRAL_CELLS = 12;
+
+// Cumulative RGB histogram over a cells x cells partition of the image:
+// entry ((cy * (cells+1) + cx) * nbins + bin) counts the pixels of that bin
+// in cell rows [0, cy) and cell columns [0, cx). Built in one pass over the
+// pixels, after which any rectangle of cells costs O(bins).
+struct IntegralHistogram {
+    int cells = 0;
+    size_t nbins = 0;
+    vector<uint32_t> sums;
+
+    // Counts of each bin in cell rows [y0, y1) and columns [x0, x1).
+    void region(int y0, int x0, int y1, int x1, uint32_t *out) const {
+        size_t w = cells + 1;
+        const uint32_t *a = &sums[(y0 * w + x0) * nbins];
+        const uint32_t *b = &sums[(y0 * w + x1) * nbins];
+        const uint32_t *c = &sums[(y1 * w + x0) * nbins];
+        const uint32_t *d = &sums[(y1 * w + x1) * nbins];
+        for (size_t i = 0; i < nbins; i++) out[i] = d[i] - b[i] - c[i] + a[i];
+    }
+};
+
+// Bin every pixel into its cell's RGB histogram, then accumulate the cell
+// histograms into an integral histogram. Pixel (x, y) is in cell
+// (x * cells / cols, y * cells / rows), so a grid of g regions per side
+// puts it in region (x * g / cols, y * g / rows) whenever g divides cells.
+static IntegralHistogram integralHistogram(const Mat &img, int bins, int cells = INTEGRAL_CELLS) {
+    uint32_t lutB[256], lutG[256], lutR[256];
+    for (int v = 0; v < 256; v++) {
+        uint32_t bin = min(v * bins / 256, bins - 1);
+        lutB[v] = bin;
+        lutG[v] = bin * bins;
+        lutR[v] = bin * bins * bins;
+    }
+
+    IntegralHistogram ih;
+    ih.cells = cells;
+    ih.nbins = size_t(bins) * bins * bins;
+    size_t cellCount = size_t(cells) * cells;
+    vector<uint32_t> counts(SUB_HISTS * cellCount * ih.nbins, 0);
+
+    vector<uint32_t> cellOffset(img.cols);
+    for (int x = 0; x < img.cols; x++) {
+        cellOffset[x] = uint32_t(int64_t(x) * cells / img.cols * ih.nbins);
+    }
+
+    for (int y = 0; y < img.rows; y++) {
+        const uchar *p = img.ptr<uchar>(y);
+        size_t rowBase = size_t(int64_t(y) * cells / img.rows) * cells * ih.nbins;
+        for (int x = 0; x < img.cols; x++, p += 3) {
+            uint32_t idx = lutR[p[2]] + lutG[p[1]] + lutB[p[0]];
+            counts[(x & (SUB_HISTS - 1)) * cellCount * ih.nbins + rowBase + cellOffset[x] + idx]++;
+        }
+    }
+
+    size_t w = cells + 1;
+    ih.sums.assign(w * w * ih.nbins, 0);
+    for (int cy = 0; cy < cells; cy++) {
+        for (int cx = 0; cx < cells; cx++) {
+            uint32_t *out = &ih.sums[((cy + 1) * w + cx + 1) * ih.nbins];
+            const uint32_t *up = &ih.sums[(cy * w + cx + 1) * ih.nbins];
+            const uint32_t *left = &ih.sums[((cy + 1) * w + cx) * ih.nbins];
+            const uint32_t *diag = &ih.sums[(cy * w + cx) * ih.nbins];
+            size_t cell = (size_t(cy) * cells + cx) * ih.nbins;
+            for (size_t i = 0; i < ih.nbins; i++) {
+                uint32_t n = 0;
+                for (int s = 0; s < SUB_HISTS; s++) n += counts[s * cellCount * ih.nbins + cell + i];
+                out[i] = n + up[i] + left[i] - diag[i];
+            }
+        }
+    }
+    return ih;
+}
+
+// Region histograms of a spatial layout read off an integral histogram,
+// each normalized by its own pixel count.
+static vector<double> spatialHistogram(const IntegralHistogram &ih, const SpatialLayout &layout) {
+    vector<double> feat;
+    feat.reserve(layout.dim());
+    vector<uint32_t> counts(ih.nbins);
+
+    for (int g : layout.grids) {
+        int step = ih.cells / g;
+        for (int ry = 0; ry < g; ry++) {
+            for (int rx = 0; rx < g; rx++) {
+                ih.region(ry * step, rx * step, (ry + 1) * step, (rx + 1) * step, counts.data());
+                double total = 0;
+                for (uint32_t n : counts) total += n;
+                for (uint32_t n : counts) feat.push_back(total > 0 ? n / total : 0.0);
+            }
+        }
+    }
+    return feat;
+}
+
 // Combine color histogram + texture histogram.
 static vector<double> colorTextureFeat(const Mat &img) {
     vector<double> c = rgbHistogram(img, 8);
@@ -150,8 +335,134 @@ static vector<double> customFeature(const Mat &img) {
     return colorTextureFeat(img);
 }
 
+// Perceptual hashes work on a grayscale copy shared by both types.
+static Mat grayImage(const Mat &img) {
+    Mat gray;
+    cvtColor(img, gray, COLOR_BGR2GRAY);
+    return gray;
+}
+
+// A 64-bit hash as HASH_BYTES values, least significant byte first.
+static vector<int> hashBytes(uint64_t h) {
+    vector<int> bytes(HASH_BYTES);
+    for (size_t i = 0; i < HASH_BYTES; i++) bytes[i] = int((h >> (8 * i)) & 0xff);
+    return bytes;
+}
+
+// Difference hash: shrink to 9x8 and set one bit per horizontally
+// adjacent pair that gets brighter, row by row.
+static uint64_t dHash(const Mat &gray) {
+    Mat small;
+    resize(gray, small, Size(9, 8), 0, 0, INTER_AREA);
+    uint64_t h = 0;
+    for (int y = 0; y < 8; y++) {
+        const uchar *p = small.ptr<uchar>(y);
+        for (int x = 0; x < 8; x++) {
+            if (p[x] < p[x + 1]) h |= uint64_t(1) << (y * 8 + x);
+        }
+    }
+    return h;
+}
+
+// DCT hash: shrink to 32x32, take the 8x8 lowest frequencies of its DCT
+// and set a bit for each above their median. The DC term only measures
+// overall brightness, so it is left out of the median.
+static uint64_t pHash(const Mat &gray) {
+    Mat small;
+    resize(gray, small, Size(32, 32), 0, 0, INTER_AREA);
+    Mat pixels(32, 32, CV_32F), freq;
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) pixels.at<float>(y, x) = small.at<uchar>(y, x);
+    }
+    dct(pixels, freq);
+
+    float low[64];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) low[y * 8 + x] = freq.at<float>(y, x);
+    }
+    vector<float> ac(low + 1, low + 64);
+    nth_element(ac.begin(), ac.begin() + ac.size() / 2, ac.end());
+    float median = ac[ac.size() / 2];
+
+    uint64_t h = 0;
+    for (int i = 0; i < 64; i++) {
+        if (low[i] > median) h |= uint64_t(1) << i;
+    }
+    return h;
+}
+
+size_t SpatialLayout::dim() const {
+    size_t regions = 0;
+    for (int g : grids) regions += size_t(g) * g;
+    return regions * regionBins();
+}
+
+// Pyramid level weights follow the spatial pyramid match kernel: finer
+// levels count more, since matches there are more specific.
+const SpatialLayout *spatialLayout(FeatureType type) {
+    static const SpatialLayout grid2 = {{2}, {1.0}, 4};
+    static const SpatialLayout grid3 = {{3}, {1.0}, 4};
+    static const SpatialLayout pyramid = {{1, 2, 4}, {0.25, 0.25, 0.5}, 4};
+    switch (type) {
+    case GRID_2X2: return &grid2;
+    case GRID_3X3: return &grid3;
+    case PYRAMID: return &pyramid;
+    default: return nullptr;
+    }
+}
+
+const char *featureTypeName(FeatureType type) {
+    switch (type) {
+    case BASELINE: return "baseline";
+    case COLOR: return "color";
+    case MULTIHIST: return "multihist";
+    case COLOR_TEXTURE: return "color_texture";
+    case CUSTOM: return "custom";
+    case DNN_EMB: return "dnn_emb";
+    case GRID_2X2: return "grid_2x2";
+    case GRID_3X3: return "grid_3x3";
+    case PYRAMID: return "pyramid";
+    case DHASH: return "dhash";
+    case PHASH: return "phash";
+    }
+    return "unknown";
+}
+
+bool isImageExtension(const string &ext) {
+    return ext == ".jpg" || ext == ".png";
+}
+
+bool scaleTolerant(FeatureType type) {
+    return type == COLOR || type == MULTIHIST || type == COLOR_TEXTURE || type == CUSTOM
+        || spatialLayout(type) != nullptr || isHashType(type);
+}
+
+// Decode with imread, letting libjpeg scale by 1/2, 1/4 or 1/8 while it
+// inverts the DCT, then area-resample down to maxSide if one is set.
+Mat decodeImage(const string &path, const DecodeScale &scale) {
+    int flags = IMREAD_COLOR;
+    if (scale.factor == 2) flags = IMREAD_REDUCED_COLOR_2;
+    else if (scale.factor == 4) flags = IMREAD_REDUCED_COLOR_4;
+    else if (scale.factor == 8) flags = IMREAD_REDUCED_COLOR_8;
+
+    ScopedTimer timer(STAGE_DECODE);
+    Mat img = imread(path, flags);
+    countMetric(img.empty() ? COUNTER_DECODE_FAILURES : COUNTER_IMAGES_DECODED);
+
+    int side = std::max(img.rows, img.cols);
+    if (scale.maxSide > 0 && side > scale.maxSide) {
+        double f = double(scale.maxSide) / side;
+        Mat small;
+        resize(img, small, Size(std::max(1, int(img.cols * f + 0.5)), std::max(1, int(img.rows * f + 0.5))),
+               0, 0, INTER_AREA);
+        img = small;
+    }
+    return img;
+}
+
 //Compute features based on requested type.
 ImageFeature computeFeatures(const Mat &img, FeatureType type, const string &name) {
+    ScopedTimer timer(STAGE_EXTRACT, type);
     ImageFeature f;
     f.name = name;
     f.type = type;
@@ -171,96 +482,80 @@ ImageFeature computeFeatures(const Mat &img, FeatureType type, const string &nam
     else if (type == CUSTOM) {
         f.dblFeat = customFeature(img);
     }
-    return f;
-}
-
-// Extract features for all images in a directory.
-vector<ImageFeature> extractDirFeatures(const string &dir, FeatureType type) {
-    vector<ImageFeature> db;
-
-    for (auto &p : fs::directory_iterator(dir)) {
-        if (!p.is_regular_file()) continue;
-        string fn = p.path().filename().string();
-        string ext = p.path().extension().string();
-        if (ext != ".jpg" && ext != ".png") continue;
-
-        Mat img = imread(p.path().string());
-        if (img.empty()) continue;
-
-        db.push_back(computeFeatures(img, type, fn));
+    else if (const SpatialLayout *layout = spatialLayout(type)) {
+        f.dblFeat = spatialHistogram(integralHistogram(img, layout->bins), *layout);
     }
-    return db;
-}
-
-// Write feature vectors to CSV.
-void writeFeatureCSV(const string &filename, const vector<ImageFeature> &features) {
-    ofstream file(filename);
-    for (auto &f : features) {
-        file << f.name;
-
-        if (f.type == BASELINE) {
-            for (int v : f.intFeat) file << "," << v;
-        } else {
-            for (double v : f.dblFeat) file << "," << v;
-        }
-        file << "\n";
+    else if (type == DHASH) {
+        f.intFeat = hashBytes(dHash(grayImage(img)));
     }
+    else if (type == PHASH) {
+        f.intFeat = hashBytes(pHash(grayImage(img)));
+    }
+    return f;
 }
 
-// Read feature CSV into memory.
-vector<ImageFeature> readFeatureCSV(const string &filename, FeatureType type) {
-    vector<ImageFeature> db;
-    ifstream file(filename);
-    string line;
-
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-
-        ImageFeature f;
-        f.type = type;
-
-        stringstream ss(line);
-        string token;
-
-        getline(ss, token, ',');
-        f.name = token;
+//Compute several feature types from one decoded image.
+// The whole-image RGB histogram and the Sobel magnitude histogram are
+// computed at most once and shared by COLOR_TEXTURE and CUSTOM, the
+// spatial types with the same bin count share one integral histogram, and
+// the hashes share one grayscale copy.
+vector<ImageFeature> computeFeatureSet(const Mat &img,
+                                       const vector<FeatureType> &types,
+                                       const string &name) {
+    vector<double> rgb, sobel;
+    bool haveRgb = false, haveSobel = false;
+    map<int, IntegralHistogram> integrals;
+    Mat gray;
 
-        if (type == BASELINE) {
-            while (getline(ss, token, ',')) {
-                f.intFeat.push_back(stoi(token));
+    vector<ImageFeature> out;
+    for (FeatureType type : types) {
+        if (const SpatialLayout *layout = spatialLayout(type)) {
+            ScopedTimer timer(STAGE_EXTRACT, type);
+            auto it = integrals.find(layout->bins);
+            if (it == integrals.end()) {
+                it = integrals.emplace(layout->bins, integralHistogram(img, layout->bins)).first;
             }
-        } else {
-            while (getline(ss, token, ',')) {
-                f.dblFeat.push_back(stod(token));
-            }
-        }
-        db.push_back(f);
-    }
-    return db;
-}
 
-// Read CSV produced by a DNN embedding extractor.
-vector<ImageFeature> readDNNCSV(const string &filename) {
-    vector<ImageFeature> db;
-    ifstream file(filename);
-    string line;
+            ImageFeature f;
+            f.name = name;
+            f.type = type;
+            f.dblFeat = spatialHistogram(it->second, *layout);
+            out.push_back(f);
+            continue;
+        }
+        if (isHashType(type)) {
+            ScopedTimer timer(STAGE_EXTRACT, type);
+            if (gray.empty()) gray = grayImage(img);
+
+            ImageFeature f;
+            f.name = name;
+            f.type = type;
+            f.intFeat = hashBytes(type == DHASH ? dHash(gray) : pHash(gray));
+            out.push_back(f);
+            continue;
+        }
+        if (type != COLOR_TEXTURE && type != CUSTOM) {
+            out.push_back(computeFeatures(img, type, name));
+            continue;
+        }
 
-    while (getline(file, line)) {
-        if (line.empty()) continue;
+        ScopedTimer timer(STAGE_EXTRACT, type);
+        if (!haveRgb) {
+            rgb = rgbHistogram(img, 8);
+            haveRgb = true;
+        }
+        if (!haveSobel) {
+            sobel = sobelMagnitudeHist(img, 16);
+            haveSobel = true;
+        }
 
         ImageFeature f;
-        f.type = DNN_EMB;
-
-        stringstream ss(line);
-        string token;
-
-        getline(ss, token, ',');
-        f.name = token;
-
-        while (getline(ss, token, ',')) {
-            f.dblFeat.push_back(stod(token));
-        }
-        db.push_back(f);
+        f.name = name;
+        f.type = type;
+        f.dblFeat.reserve(rgb.size() + sobel.size());
+        f.dblFeat.insert(f.dblFeat.end(), rgb.begin(), rgb.end());
+        f.dblFeat.insert(f.dblFeat.end(), sobel.begin(), sobel.end());
+        out.push_back(f);
     }
-    return db;
+    return out;
 }
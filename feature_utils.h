@@ -9,6 +9,7 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <string>
+#include <map>
 
 using namespace cv;
 using namespace std;
@@ -20,9 +21,38 @@ enum FeatureType {
     MULTIHIST,
     COLOR_TEXTURE,
     CUSTOM,
-    DNN_EMB
+    DNN_EMB,
+    GRID_2X2,  // RGB histograms of a 2x2 grid of regions
+    GRID_3X3,  // RGB histograms of a 3x3 grid of regions
+    PYRAMID,   // 1x1 + 2x2 + 4x4 spatial pyramid of RGB histograms
+    DHASH,     // 64-bit difference hash of a 9x8 grayscale thumbnail
+    PHASH      // 64-bit DCT hash of a 32x32 grayscale thumbnail
 };
 
+const FeatureType LAST_FEATURE_TYPE = PHASH;
+
+// Bytes in a DHASH/PHASH row: the 64-bit hash, least significant byte first.
+const size_t HASH_BYTES = 8;
+
+//True for the perceptual hash types, compared by Hamming distance.
+inline bool isHashType(FeatureType type) { return type == DHASH || type == PHASH; }
+
+// Region layout of a spatial histogram type. Each level splits the image
+// into a grid x grid array of regions and stores one normalized RGB
+// histogram per region, level by level in row-major order. Matching
+// weights every region of a level by weight / (grid * grid).
+struct SpatialLayout {
+    vector<int> grids;      // grid size of each level; each must divide 12
+    vector<double> weights; // weight of each level; they sum to 1
+    int bins;               // bins per channel, so bins^3 per region
+
+    size_t regionBins() const { return size_t(bins) * bins * bins; }
+    size_t dim() const;
+};
+
+//Layout of a spatial histogram type, or nullptr for any other type.
+const SpatialLayout *spatialLayout(FeatureType type);
+
 //Stores a feature vector for one image.
 struct ImageFeature {
     string name;
@@ -31,17 +61,32 @@ struct ImageFeature {
     vector<double> dblFeat; 
 };
 
-//Compute features for an image.
-ImageFeature computeFeatures(const Mat &img, FeatureType type, const string &name);
+// Resolution at which images are decoded for the histogram descriptors.
+struct DecodeScale {
+    int factor = 1;  // 1, 2, 4 or 8; JPEGs are reduced in the DCT domain
+    int maxSide = 0; // then shrink so neither side exceeds this; 0 = off
+
+    bool reduced() const { return factor > 1 || maxSide > 0; }
+    bool operator==(const DecodeScale &o) const { return factor == o.factor && maxSide == o.maxSide; }
+    bool operator!=(const DecodeScale &o) const { return !(*this == o); }
+};
+
+//True for the types that are normalized by pixel count and so may be
+//extracted from a reduced decode (the histograms and the hashes, which
+//only see a small thumbnail).
+bool scaleTolerant(FeatureType type);
 
-//Extract features for all images in a directory.
-vector<ImageFeature> extractDirFeatures(const string &dir, FeatureType type);
+//Decode an image at the given scale. Returns an empty Mat on failure.
+Mat decodeImage(const string &path, const DecodeScale &scale = DecodeScale());
 
-//Write image features to a CSV file.
-void writeFeatureCSV(const string &filename, const vector<ImageFeature> &features);
+//Short lowercase name of a feature type ("baseline", "color", ...).
+const char *featureTypeName(FeatureType type);
 
-//Read image features from a CSV file.
-vector<ImageFeature> readFeatureCSV(const string &filename, FeatureType type);
+//True for the file extensions the extractors read (".jpg", ".png").
+bool isImageExtension(const string &ext);
+
+//Compute features for an image.
+ImageFeature computeFeatures(const Mat &img, FeatureType type, const string &name);
 
-//Read DNN embedding CSV file.
-vector<ImageFeature> readDNNCSV(const string &filename);
+//Compute several feature types for an image, sharing intermediate results.
+vector<ImageFeature> computeFeatureSet(const Mat &img, const vector<FeatureType> &types, const string &name);
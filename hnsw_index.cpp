@@ -0,0 +1,523 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: hnsw_index.cpp
+//
+// HNSW approximate nearest-neighbour index for DNN_EMB embeddings.
+// Follows Malkov & Yashunin: nodes get a random top level, inserts link
+// each node to diverse near neighbours per level, and queries descend
+// greedily before a best-first search of width ef on level 0.
+
+#include "hnsw_index.h"
+#include "distance_kernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char HNSW_MAGIC[8] = {'C', 'B', 'I', 'R', 'H', 'N', 'S', 'W'};
+static const uint32_t HNSW_VERSION = 1;
+
+// Highest level a node may be assigned.
+static const int MAX_LEVEL = 16;
+
+struct HnswFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t M;
+    uint32_t efConstruction;
+    int32_t maxLevel;
+    uint32_t entry;
+    uint64_t count;
+    uint64_t nameOffsetsAt;
+    uint64_t namesAt;
+    uint64_t vecsAt;
+    uint64_t links0At;
+    uint64_t upperOffsetsAt;
+    uint64_t upperAt;
+    uint64_t levelsAt;
+    uint64_t fileSize;
+};
+
+static uint64_t alignTo(uint64_t n, uint64_t a) {
+    return (n + a - 1) / a * a;
+}
+
+HnswIndex::HnswIndex(size_t dim, HnswParams params) : p(params), d(dim) {
+    syncPointers();
+}
+
+HnswIndex::~HnswIndex() {
+    unmap();
+}
+
+float HnswIndex::distance(const float *a, const float *b) const {
+    return float(1.0 - activeKernels().dotF32(a, b, d));
+}
+
+// Links of node i on a level: a count followed by capacity(level) slots.
+const uint32_t *HnswIndex::links(size_t i, int level) const {
+    if (level == 0) return links0 + i * (1 + capacity(0));
+    return upper + upperOffsets[i] + (level - 1) * (1 + capacity(level));
+}
+
+uint32_t *HnswIndex::mutableLinks(size_t i, int level) {
+    if (level == 0) return &ownLinks0[i * (1 + capacity(0))];
+    return &ownUpper[ownUpperOffsets[i] + (level - 1) * (1 + capacity(level))];
+}
+
+void HnswIndex::syncPointers() {
+    vecs = ownVecs.data();
+    links0 = ownLinks0.data();
+    upperOffsets = ownUpperOffsets.data();
+    upper = ownUpper.data();
+    levels = ownLevels.data();
+    nameOffsets = ownNameOffsets.data();
+    names = ownNames.data();
+}
+
+void HnswIndex::unmap() {
+    if (base) munmap(base, mappedSize);
+    base = nullptr;
+    mappedSize = 0;
+}
+
+// Copy a memory-mapped index into owned storage so it can be modified.
+void HnswIndex::makeMutable() {
+    if (!base) return;
+    ownVecs.assign(vecs, vecs + count * d);
+    ownLinks0.assign(links0, links0 + count * (1 + capacity(0)));
+    ownUpperOffsets.assign(upperOffsets, upperOffsets + count + 1);
+    ownUpper.assign(upper, upper + upperOffsets[count]);
+    ownLevels.assign(levels, levels + count);
+    ownNameOffsets.assign(nameOffsets, nameOffsets + count + 1);
+    ownNames.assign(names, names + nameOffsets[count]);
+    unmap();
+    syncPointers();
+}
+
+void HnswIndex::clear() {
+    unmap();
+    ownVecs.clear();
+    ownLinks0.clear();
+    ownUpperOffsets.assign(1, 0);
+    ownUpper.clear();
+    ownLevels.clear();
+    ownNameOffsets.assign(1, 0);
+    ownNames.clear();
+    count = 0;
+    maxLevel = -1;
+    entry = 0;
+    rng.seed(1234);
+    syncPointers();
+}
+
+// Best-first search of one level starting from `entry`; returns up to ef
+// nearest nodes found, nearest first.
+vector<HnswIndex::Candidate> HnswIndex::searchLayer(const float *q, vector<Candidate> entry,
+                                                    size_t ef, int level) const {
+    // Visit marks are reused across queries on the same thread.
+    thread_local vector<uint32_t> visited;
+    thread_local uint32_t epoch = 0;
+    if (visited.size() < count) visited.resize(count, 0);
+    if (++epoch == 0) {
+        fill(visited.begin(), visited.end(), 0);
+        epoch = 1;
+    }
+
+    priority_queue<Candidate, vector<Candidate>, greater<Candidate>> frontier;
+    priority_queue<Candidate> best;
+    for (auto &c : entry) {
+        visited[c.id] = epoch;
+        frontier.push(c);
+        best.push(c);
+    }
+    while (best.size() > ef) best.pop();
+
+    while (!frontier.empty()) {
+        Candidate c = frontier.top();
+        if (best.size() >= ef && c.dist > best.top().dist) break;
+        frontier.pop();
+
+        const uint32_t *l = links(c.id, level);
+        for (uint32_t j = 1; j <= l[0]; j++) {
+            uint32_t n = l[j];
+            if (visited[n] == epoch) continue;
+            visited[n] = epoch;
+
+            float dist = distance(q, vec(n));
+            if (best.size() < ef || dist < best.top().dist) {
+                frontier.push({dist, n});
+                best.push({dist, n});
+                if (best.size() > ef) best.pop();
+            }
+        }
+    }
+
+    vector<Candidate> out(best.size());
+    for (size_t i = out.size(); i-- > 0;) {
+        out[i] = best.top();
+        best.pop();
+    }
+    return out;
+}
+
+// Neighbour selection heuristic: keep a candidate only if it is closer to
+// the base node than to every neighbour already kept, then top up with
+// the nearest discarded candidates.
+vector<uint32_t> HnswIndex::selectNeighbors(const vector<Candidate> &cands, size_t m) const {
+    vector<uint32_t> kept, pruned;
+    for (auto &c : cands) {
+        if (kept.size() >= m) break;
+        bool diverse = true;
+        for (uint32_t k : kept) {
+            if (distance(vec(c.id), vec(k)) < c.dist) {
+                diverse = false;
+                break;
+            }
+        }
+        if (diverse) kept.push_back(c.id);
+        else pruned.push_back(c.id);
+    }
+    for (size_t i = 0; i < pruned.size() && kept.size() < m; i++) kept.push_back(pruned[i]);
+    return kept;
+}
+
+// Add a link from -> to, re-selecting from's neighbours if it is full.
+void HnswIndex::connect(uint32_t from, uint32_t to, int level) {
+    uint32_t *l = mutableLinks(from, level);
+    size_t cap = capacity(level);
+    if (l[0] < cap) {
+        l[++l[0]] = to;
+        return;
+    }
+
+    vector<Candidate> cands;
+    cands.push_back({distance(vec(from), vec(to)), to});
+    for (uint32_t j = 1; j <= l[0]; j++) {
+        cands.push_back({distance(vec(from), vec(l[j])), l[j]});
+    }
+    sort(cands.begin(), cands.end());
+
+    vector<uint32_t> chosen = selectNeighbors(cands, cap);
+    l[0] = uint32_t(chosen.size());
+    for (size_t j = 0; j < chosen.size(); j++) l[j + 1] = chosen[j];
+}
+
+void HnswIndex::add(const string &name, const float *v) {
+    makeMutable();
+
+    uint32_t id = uint32_t(count);
+
+    double norm = sqrt(activeKernels().dotF32(v, v, d));
+    for (size_t j = 0; j < d; j++) {
+        ownVecs.push_back(norm > 0 ? float(v[j] / norm) : 0.0f);
+    }
+
+    ownNames.insert(ownNames.end(), name.begin(), name.end());
+    ownNames.push_back('\0');
+    ownNameOffsets.push_back(ownNames.size());
+
+    double mL = 1.0 / log(double(max(p.M, 2)));
+    uniform_real_distribution<double> unit(numeric_limits<double>::min(), 1.0);
+    int level = min(MAX_LEVEL, int(-log(unit(rng)) * mL));
+
+    ownLevels.push_back(uint8_t(level));
+    ownLinks0.resize(ownLinks0.size() + 1 + capacity(0), 0);
+    ownUpper.resize(ownUpper.size() + level * (1 + capacity(1)), 0);
+    ownUpperOffsets.push_back(ownUpper.size());
+    count++;
+    syncPointers();
+
+    if (maxLevel < 0) {
+        entry = id;
+        maxLevel = level;
+        return;
+    }
+
+    const float *q = vec(id);
+    vector<Candidate> ep = {{distance(q, vec(entry)), entry}};
+
+    for (int l = maxLevel; l > level; l--) {
+        ep = searchLayer(q, ep, 1, l);
+    }
+
+    for (int l = min(level, maxLevel); l >= 0; l--) {
+        vector<Candidate> cands = searchLayer(q, ep, p.efConstruction, l);
+        vector<uint32_t> chosen = selectNeighbors(cands, capacity(l));
+
+        uint32_t *mine = mutableLinks(id, l);
+        mine[0] = uint32_t(chosen.size());
+        for (size_t j = 0; j < chosen.size(); j++) {
+            mine[j + 1] = chosen[j];
+            connect(chosen[j], id, l);
+        }
+        ep = cands;
+    }
+
+    if (level > maxLevel) {
+        maxLevel = level;
+        entry = id;
+    }
+}
+
+vector<Scored> HnswIndex::search(const float *query, size_t k, size_t ef) const {
+    vector<Scored> out;
+    if (count == 0 || k == 0) return out;
+
+    vector<float> q(query, query + d);
+    double norm = sqrt(activeKernels().dotF32(q.data(), q.data(), d));
+    for (auto &v : q) v = norm > 0 ? float(v / norm) : 0.0f;
+
+    vector<Candidate> ep = {{distance(q.data(), vec(entry)), entry}};
+    for (int l = maxLevel; l > 0; l--) {
+        ep = searchLayer(q.data(), ep, 1, l);
+    }
+    vector<Candidate> found = searchLayer(q.data(), ep, max(ef, k), 0);
+
+    for (size_t i = 0; i < found.size() && i < k; i++) {
+        out.push_back({double(found[i].dist), found[i].id});
+    }
+    return out;
+}
+
+bool HnswIndex::save(const string &filename) const {
+    HnswFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HNSW_MAGIC, sizeof(h.magic));
+    h.version = HNSW_VERSION;
+    h.dim = uint32_t(d);
+    h.M = uint32_t(p.M);
+    h.efConstruction = uint32_t(p.efConstruction);
+    h.maxLevel = maxLevel;
+    h.entry = entry;
+    h.count = count;
+
+    uint64_t namesSize = nameOffsets[count];
+    uint64_t upperSize = upperOffsets[count];
+
+    h.nameOffsetsAt = sizeof(h);
+    h.namesAt = h.nameOffsetsAt + (count + 1) * sizeof(uint64_t);
+    h.vecsAt = alignTo(h.namesAt + namesSize, 64);
+    h.links0At = h.vecsAt + count * d * sizeof(float);
+    h.upperOffsetsAt = alignTo(h.links0At + count * (1 + capacity(0)) * sizeof(uint32_t), 8);
+    h.upperAt = h.upperOffsetsAt + (count + 1) * sizeof(uint64_t);
+    h.levelsAt = h.upperAt + upperSize * sizeof(uint32_t);
+    h.fileSize = h.levelsAt + count;
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    if (!file) return false;
+
+    auto writeAt = [&](uint64_t at, const void *data, uint64_t bytes) {
+        static const char zeros[64] = {0};
+        uint64_t pos = uint64_t(file.tellp());
+        if (pos < at) file.write(zeros, at - pos);
+        file.write(static_cast<const char *>(data), bytes);
+    };
+
+    writeAt(0, &h, sizeof(h));
+    writeAt(h.nameOffsetsAt, nameOffsets, (count + 1) * sizeof(uint64_t));
+    writeAt(h.namesAt, names, namesSize);
+    writeAt(h.vecsAt, vecs, count * d * sizeof(float));
+    writeAt(h.links0At, links0, count * (1 + capacity(0)) * sizeof(uint32_t));
+    writeAt(h.upperOffsetsAt, upperOffsets, (count + 1) * sizeof(uint64_t));
+    writeAt(h.upperAt, upper, upperSize * sizeof(uint32_t));
+    writeAt(h.levelsAt, levels, count);
+    file.close();
+    return bool(file);
+}
+
+// Check the tables of a mapped index whose header has been checked: names
+// ascend within the name blob, every node's upper links fill exactly its
+// levels, link counts fit their slots and every link names a node.
+static bool validGraph(const unsigned char *bytes, const HnswFileHeader &h) {
+    const uint64_t *nameOffsets = reinterpret_cast<const uint64_t *>(bytes + h.nameOffsetsAt);
+    const uint64_t *upperOffsets = reinterpret_cast<const uint64_t *>(bytes + h.upperOffsetsAt);
+    const uint8_t *levels = bytes + h.levelsAt;
+    const char *names = reinterpret_cast<const char *>(bytes + h.namesAt);
+    uint64_t namesSize = h.vecsAt - h.namesAt;
+    uint64_t upperSize = (h.levelsAt - h.upperAt) / sizeof(uint32_t);
+
+    if (nameOffsets[0] != 0 || upperOffsets[0] != 0 || upperOffsets[h.count] != upperSize) return false;
+    if (h.count && levels[h.entry] != h.maxLevel) return false;
+    for (uint64_t i = 0; i < h.count; i++) {
+        if (nameOffsets[i + 1] <= nameOffsets[i] || nameOffsets[i + 1] > namesSize
+            || names[nameOffsets[i + 1] - 1] != '\0') return false;
+        if (levels[i] > h.maxLevel) return false;
+        if (upperOffsets[i + 1] < upperOffsets[i]
+            || upperOffsets[i + 1] - upperOffsets[i] != uint64_t(levels[i]) * (1 + h.M)) return false;
+    }
+
+    // Level 0 blocks hold 2M slots, upper blocks M; each starts with its count.
+    auto validLinks = [&](const uint32_t *l, uint64_t blocks, uint64_t slots) {
+        for (uint64_t b = 0; b < blocks; b++, l += 1 + slots) {
+            if (l[0] > slots) return false;
+            for (uint32_t j = 1; j <= l[0]; j++) {
+                if (l[j] >= h.count) return false;
+            }
+        }
+        return true;
+    };
+    return validLinks(reinterpret_cast<const uint32_t *>(bytes + h.links0At), h.count, 2 * uint64_t(h.M))
+        && validLinks(reinterpret_cast<const uint32_t *>(bytes + h.upperAt), upperSize / (1 + h.M), h.M);
+}
+
+bool HnswIndex::open(const string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(HnswFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = size_t(st.st_size);
+    void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(m);
+    const HnswFileHeader *h = static_cast<const HnswFileHeader *>(m);
+    // Sizes are bounded by the file before they are multiplied, so none of
+    // the products below can overflow.
+    uint64_t slots0 = 1 + 2 * uint64_t(h->M);
+    bool ok = memcmp(h->magic, HNSW_MAGIC, sizeof(h->magic)) == 0
+        && h->version == HNSW_VERSION
+        && h->fileSize == size
+        && h->M > 0 && h->M <= size
+        && h->dim > 0 && h->dim <= size
+        && h->count < size && h->count <= UINT32_MAX
+        && h->maxLevel >= -1 && h->maxLevel <= MAX_LEVEL
+        && (h->count == 0 ? h->maxLevel == -1 : h->maxLevel >= 0 && h->entry < h->count)
+        && h->levelsAt + h->count == size
+        && h->nameOffsetsAt == sizeof(HnswFileHeader)
+        && h->namesAt == h->nameOffsetsAt + (h->count + 1) * sizeof(uint64_t)
+        && h->namesAt <= h->vecsAt
+        && h->vecsAt % 64 == 0
+        && h->vecsAt <= size
+        && h->count <= (size - h->vecsAt) / (h->dim * sizeof(float))
+        && h->links0At == h->vecsAt + h->count * h->dim * sizeof(float)
+        && h->count <= (size - h->links0At) / (slots0 * sizeof(uint32_t))
+        && h->links0At + h->count * slots0 * sizeof(uint32_t) <= h->upperOffsetsAt
+        && h->upperOffsetsAt % 8 == 0
+        && h->upperAt == h->upperOffsetsAt + (h->count + 1) * sizeof(uint64_t)
+        && h->upperAt <= h->levelsAt
+        && (h->levelsAt - h->upperAt) % sizeof(uint32_t) == 0;
+    if (ok) ok = validGraph(bytes, *h);
+    if (!ok) {
+        munmap(m, size);
+        return false;
+    }
+
+    clear();
+
+    base = m;
+    mappedSize = size;
+    p.M = int(h->M);
+    p.efConstruction = int(h->efConstruction);
+    d = h->dim;
+    count = h->count;
+    maxLevel = h->maxLevel;
+    entry = h->entry;
+
+    vecs = reinterpret_cast<const float *>(bytes + h->vecsAt);
+    links0 = reinterpret_cast<const uint32_t *>(bytes + h->links0At);
+    upperOffsets = reinterpret_cast<const uint64_t *>(bytes + h->upperOffsetsAt);
+    upper = reinterpret_cast<const uint32_t *>(bytes + h->upperAt);
+    levels = bytes + h->levelsAt;
+    nameOffsets = reinterpret_cast<const uint64_t *>(bytes + h->nameOffsetsAt);
+    names = reinterpret_cast<const char *>(bytes + h->namesAt);
+    return true;
+}
+
+// True if each row of index is a different row of db with the same unit
+// vector, so that extending index leaves no stale rows in it.
+static bool indexMatchesStore(const HnswIndex &index, const FeatureView &db) {
+    unordered_map<string_view, size_t> rowOf;
+    rowOf.reserve(db.count);
+    for (size_t i = 0; i < db.count; i++) rowOf.emplace(db.name(i), i);
+
+    const DistanceKernels &k = activeKernels();
+    vector<bool> used(db.count, false);
+    for (size_t i = 0; i < index.size(); i++) {
+        auto it = rowOf.find(index.name(i));
+        if (it == rowOf.end() || used[it->second]) return false;
+        used[it->second] = true;
+
+        // Normalized as add() does; the slack allows for another ISA's sum.
+        const float *v = db.f32(it->second), *u = index.row(i);
+        double norm = sqrt(k.dotF32(v, v, db.dim));
+        for (size_t j = 0; j < db.dim; j++) {
+            float want = norm > 0 ? float(v[j] / norm) : 0.0f;
+            if (fabs(want - u[j]) > 1e-6f) return false;
+        }
+    }
+    return true;
+}
+
+bool addStoreToHnsw(HnswIndex &index, const FeatureView &db, bool *rebuilt) {
+    if (db.type != DNN_EMB || db.elem != ELEM_F32 || db.dim != index.dim()) return false;
+
+    bool stale = !indexMatchesStore(index, db);
+    if (stale) index.clear();
+    if (rebuilt) *rebuilt = stale;
+
+    unordered_set<string> have;
+    for (size_t i = 0; i < index.size(); i++) have.insert(string(index.name(i)));
+
+    for (size_t i = 0; i < db.count; i++) {
+        string name(db.name(i));
+        if (have.count(name)) continue;
+        index.add(name, db.f32(i));
+    }
+    return true;
+}
+
+vector<HnswReportRow> hnswRecallReport(const HnswIndex &index, const FeatureView &db,
+                                       size_t N, const vector<size_t> &efs, size_t queries) {
+    vector<HnswReportRow> rows;
+    if (db.count == 0 || index.size() == 0) return rows;
+
+    queries = min(queries, db.count);
+    const DistanceKernels &k = activeKernels();
+
+    // Exact answers from a single-threaded cosine scan.
+    vector<unordered_set<string>> truth(queries);
+    auto t0 = chrono::steady_clock::now();
+    for (size_t q = 0; q < queries; q++) {
+        const float *query = db.f32(q * db.count / queries);
+        auto best = scanTopN(db.count, N, 1, [&](size_t i) {
+            return k.cosineDistanceF32(query, db.f32(i), db.dim);
+        });
+        for (auto &s : best) truth[q].insert(string(db.name(s.index)));
+    }
+    double exactUs = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count() / queries;
+
+    for (size_t ef : efs) {
+        size_t hits = 0, total = 0;
+        auto t1 = chrono::steady_clock::now();
+        vector<vector<Scored>> results(queries);
+        for (size_t q = 0; q < queries; q++) {
+            results[q] = index.search(db.f32(q * db.count / queries), N, ef);
+        }
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - t1).count() / queries;
+
+        for (size_t q = 0; q < queries; q++) {
+            for (auto &s : results[q]) hits += truth[q].count(string(index.name(s.index)));
+            total += truth[q].size();
+        }
+        rows.push_back({ef, total ? double(hits) / total : 1.0, us, exactUs});
+    }
+    return rows;
+}
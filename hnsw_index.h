@@ -0,0 +1,133 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: hnsw_index.h
+//
+// Header file for hnsw_index.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "feature_store.h"
+#include "matcher_utils.h"
+
+// Default search width for interactive queries.
+const size_t HNSW_QUERY_EF = 64;
+
+// Build parameters of an HNSW index.
+struct HnswParams {
+    int M = 16;               // links per node on upper levels (2*M on level 0)
+    int efConstruction = 100; // candidate list size while inserting
+};
+
+// Hierarchical navigable small world graph over unit-normalized float
+// vectors, for approximate cosine nearest-neighbour search on DNN_EMB
+// stores. The index keeps its own copy of the vectors and names so a
+// saved file can be memory-mapped and searched without the store.
+class HnswIndex {
+public:
+    explicit HnswIndex(size_t dim = 0, HnswParams params = HnswParams());
+    ~HnswIndex();
+    HnswIndex(const HnswIndex &) = delete;
+    HnswIndex &operator=(const HnswIndex &) = delete;
+
+    size_t size() const { return count; }
+    size_t dim() const { return d; }
+    std::string_view name(size_t i) const {
+        return std::string_view(names + nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i] - 1);
+    }
+
+    //Row i as stored: the inserted vector scaled to unit length.
+    const float *row(size_t i) const { return vec(i); }
+
+    //Insert one vector. A memory-mapped index is copied into memory first.
+    void add(const std::string &name, const float *vec);
+
+    //Remove every row, keeping the dimension and build parameters.
+    void clear();
+
+    //Approximate k nearest rows to query by cosine distance; larger ef
+    //trades latency for recall. Scored::index is the index row.
+    std::vector<Scored> search(const float *query, size_t k, size_t ef) const;
+
+    //Write the index to a file.
+    bool save(const std::string &filename) const;
+
+    //Memory-map an index file read-only. Returns false if missing or malformed.
+    bool open(const std::string &filename);
+
+private:
+    struct Candidate {
+        float dist;
+        uint32_t id;
+        bool operator<(const Candidate &o) const { return dist < o.dist; }
+        bool operator>(const Candidate &o) const { return dist > o.dist; }
+    };
+
+    float distance(const float *a, const float *b) const;
+    const float *vec(size_t i) const { return vecs + i * d; }
+    const uint32_t *links(size_t i, int level) const;
+    uint32_t *mutableLinks(size_t i, int level);
+    size_t capacity(int level) const { return level == 0 ? 2 * p.M : p.M; }
+
+    std::vector<Candidate> searchLayer(const float *q, std::vector<Candidate> entry,
+                                       size_t ef, int level) const;
+    std::vector<uint32_t> selectNeighbors(const std::vector<Candidate> &cands, size_t m) const;
+    void connect(uint32_t from, uint32_t to, int level);
+
+    void makeMutable();
+    void syncPointers();
+    void unmap();
+
+    HnswParams p;
+    size_t d = 0;
+    size_t count = 0;
+    int maxLevel = -1;
+    uint32_t entry = 0;
+    std::mt19937 rng{1234};
+
+    // Either point into the owned vectors below or into the mapped file.
+    const float *vecs = nullptr;
+    const uint32_t *links0 = nullptr;
+    const uint64_t *upperOffsets = nullptr;
+    const uint32_t *upper = nullptr;
+    const uint8_t *levels = nullptr;
+    const uint64_t *nameOffsets = nullptr;
+    const char *names = nullptr;
+
+    std::vector<float> ownVecs;
+    std::vector<uint32_t> ownLinks0;
+    std::vector<uint64_t> ownUpperOffsets{0};
+    std::vector<uint32_t> ownUpper;
+    std::vector<uint8_t> ownLevels;
+    std::vector<uint64_t> ownNameOffsets{0};
+    std::vector<char> ownNames;
+
+    void *base = nullptr;
+    size_t mappedSize = 0;
+};
+
+//Build an index from every row of a DNN_EMB store. An index that already
+//holds some rows of db is extended with the rows whose names it lacks;
+//one holding a name db lacks, or a row whose vector no longer matches
+//db's, is cleared and rebuilt (and *rebuilt set). Returns false, adding
+//nothing, if db is not a float DNN_EMB store of the index's dim.
+bool addStoreToHnsw(HnswIndex &index, const FeatureView &db, bool *rebuilt = nullptr);
+
+// One row of the recall@N-vs-latency report.
+struct HnswReportRow {
+    size_t ef;
+    double recall;
+    double usPerQuery;
+    double exactUsPerQuery;
+};
+
+//Compare HNSW search at each ef against the exact cosine scan of db for
+//`queries` rows sampled from the store.
+std::vector<HnswReportRow> hnswRecallReport(const HnswIndex &index, const FeatureView &db,
+                                            size_t N, const std::vector<size_t> &efs,
+                                            size_t queries = 200);
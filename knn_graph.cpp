@@ -0,0 +1,247 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: knn_graph.cpp
+//
+// Batch all-pairs k-NN graph over a feature store. Queries are processed
+// in tiles against database tiles sized to stay in cache. Float rows are
+// compared four queries per pass over a database row (cosine rows are
+// normalized once so each pair is a dot product), and the best candidates
+// of each query are then re-scored with the scan's own distance.
+
+#include "knn_graph.h"
+#include "distance_kernels.h"
+#include "matcher_utils.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+static const char KNN_MAGIC[8] = {'C', 'B', 'I', 'R', 'K', 'N', 'N', '\0'};
+
+// Rows per query tile.
+static const size_t QUERY_TILE = 32;
+
+// Bytes of database rows per tile; roughly half a typical L2 cache.
+static const size_t DB_TILE_BYTES = 256 * 1024;
+
+struct KnnFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint32_t k;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+// Candidates kept per row by the four-row kernels, as a multiple of k,
+// before they are re-scored; rows whose float and exact distances nearly
+// tie with the k-th may rank either way.
+static const size_t RESCORE_FACTOR = 2;
+
+// A stored row as a target feature, as FeatureCache makes one for a
+// target that is in the store.
+static ImageFeature rowFeature(const FeatureView &db, size_t i) {
+    ImageFeature f;
+    f.type = db.type;
+    if (db.elem == ELEM_U8) {
+        f.intFeat.assign(db.u8(i), db.u8(i) + db.dim);
+    } else {
+        vector<float> dense(db.dim);
+        db.expand(i, dense.data());
+        f.dblFeat.assign(dense.begin(), dense.end());
+    }
+    return f;
+}
+
+KnnGraph buildKnnGraph(const FeatureView &db, int k, int threads, const KnnProgress &progress) {
+    KnnGraph g;
+    g.type = db.type;
+    g.k = uint32_t(max(k, 0));
+    g.count = db.count;
+    g.neighbors.assign(db.count * g.k, NO_NEIGHBOR);
+    g.dists.assign(db.count * g.k, 0.0);
+    if (db.count == 0 || g.k == 0) return g;
+
+    const DistanceKernels &kern = activeKernels();
+    const SpatialLayout *layout = spatialLayout(db.type);
+    if (layout && layout->dim() != db.dim) return g;
+
+    // Dense float rows are ranked four queries at a time; other rows are
+    // scored exactly from the start.
+    bool tiled = db.elem == ELEM_F32;
+
+    // Unit-length copies of the rows so cosine distance is 1 - dot.
+    vector<float> unit;
+    if (db.type == DNN_EMB) {
+        unit.resize(db.count * db.dim);
+        for (size_t i = 0; i < db.count; i++) {
+            const float *row = db.f32(i);
+            double norm = sqrt(kern.dotF32(row, row, db.dim));
+            float *dst = &unit[i * db.dim];
+            for (size_t j = 0; j < db.dim; j++) {
+                dst[j] = norm > 0 ? float(row[j] / norm) : 0.0f;
+            }
+        }
+    }
+    auto rowOf = [&](size_t i) { return db.type == DNN_EMB ? &unit[i * db.dim] : db.f32(i); };
+
+    // Float distances from four query rows to row d, for ranking only.
+    auto dist4 = [&](const float *const q[4], size_t d, double out[4]) {
+        const float *b = rowOf(d);
+        if (db.type == DNN_EMB) {
+            kern.dotF32x4(q, b, db.dim, out);
+            for (int r = 0; r < 4; r++) out[r] = 1.0 - out[r];
+        }
+        else if (layout) {
+            size_t bins = layout->regionBins();
+            const float *a[4] = {q[0], q[1], q[2], q[3]};
+            double sim[4] = {0, 0, 0, 0}, part[4];
+            for (size_t l = 0; l < layout->grids.size(); l++) {
+                size_t regions = size_t(layout->grids[l]) * layout->grids[l];
+                double levelSim[4] = {0, 0, 0, 0};
+                for (size_t r = 0; r < regions; r++, b += bins) {
+                    kern.histIntersectionF32x4(a, b, bins, part);
+                    for (int j = 0; j < 4; j++) {
+                        levelSim[j] += 1.0 - part[j];
+                        a[j] += bins;
+                    }
+                }
+                for (int j = 0; j < 4; j++) sim[j] += layout->weights[l] * levelSim[j] / regions;
+            }
+            for (int j = 0; j < 4; j++) out[j] = 1.0 - sim[j];
+        }
+        else {
+            kern.histIntersectionF32x4(q, b, db.dim, out);
+        }
+    };
+
+    size_t rowBytes = db.type == DNN_EMB ? db.dim * sizeof(float) : db.stride;
+    if (db.elem == ELEM_SPARSE) rowBytes = (db.rowOffsets[db.count] - db.rowOffsets[0]) / db.count;
+    size_t dbTile = max<size_t>(16, DB_TILE_BYTES / max<size_t>(1, rowBytes));
+    size_t queryTiles = (db.count + QUERY_TILE - 1) / QUERY_TILE;
+    size_t keep = tiled ? g.k * RESCORE_FACTOR : g.k;
+
+    if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+    threads = int(min<size_t>(threads, queryTiles));
+
+    atomic<size_t> nextTile(0);
+    atomic<bool> stopped(false);
+    mutex progressLock;
+    size_t done = 0;
+
+    auto worker = [&] {
+        for (size_t t = nextTile++; t < queryTiles && !stopped; t = nextTile++) {
+            size_t q0 = t * QUERY_TILE;
+            size_t q1 = min(db.count, q0 + QUERY_TILE);
+            vector<TopN> heaps(q1 - q0, TopN(keep));
+
+            // Exact distances, as a scan from each query row would give them.
+            vector<function<double(size_t)>> exact(q1 - q0);
+            for (size_t q = q0; q < q1; q++) exact[q - q0] = rowScorer(rowFeature(db, q), db);
+
+            for (size_t d0 = 0; d0 < db.count; d0 += dbTile) {
+                size_t d1 = min(db.count, d0 + dbTile);
+                if (!tiled) {
+                    for (size_t q = q0; q < q1; q++) {
+                        for (size_t d = d0; d < d1; d++) {
+                            if (d != q) heaps[q - q0].push(exact[q - q0](d), d);
+                        }
+                    }
+                    continue;
+                }
+
+                // A short last group repeats its last query.
+                for (size_t q = q0; q < q1; q += 4) {
+                    size_t n = min<size_t>(4, q1 - q);
+                    const float *rows[4];
+                    for (size_t j = 0; j < 4; j++) rows[j] = rowOf(q + min(j, n - 1));
+                    double out[4];
+                    for (size_t d = d0; d < d1; d++) {
+                        dist4(rows, d, out);
+                        for (size_t j = 0; j < n; j++) {
+                            if (d != q + j) heaps[q + j - q0].push(out[j], d);
+                        }
+                    }
+                }
+            }
+
+            for (size_t q = q0; q < q1; q++) {
+                vector<Scored> best = heaps[q - q0].sorted();
+                if (tiled) {
+                    TopN rescored(g.k);
+                    for (auto &s : best) rescored.push(exact[q - q0](s.index), s.index);
+                    best = rescored.sorted();
+                }
+                for (size_t j = 0; j < best.size(); j++) {
+                    g.neighbors[q * g.k + j] = uint32_t(best[j].index);
+                    g.dists[q * g.k + j] = best[j].dist;
+                }
+            }
+
+            if (progress) {
+                lock_guard<mutex> lock(progressLock);
+                done += q1 - q0;
+                if (!stopped && !progress(done, db.count)) stopped = true;
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++) workers.emplace_back(worker);
+    for (auto &w : workers) w.join();
+    return stopped ? KnnGraph() : g;
+}
+
+bool writeKnnGraph(const string &filename, const KnnGraph &graph) {
+    KnnFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, KNN_MAGIC, sizeof(h.magic));
+    h.version = KNN_GRAPH_VERSION;
+    h.type = graph.type;
+    h.k = graph.k;
+    h.count = graph.count;
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    if (!file) return false;
+    file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char *>(graph.neighbors.data()),
+               graph.neighbors.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char *>(graph.dists.data()),
+               graph.dists.size() * sizeof(double));
+    file.close();
+    return bool(file);
+}
+
+bool readKnnGraph(const string &filename, KnnGraph &graph) {
+    ifstream file(filename, ios::binary);
+    if (!file) return false;
+
+    KnnFileHeader h;
+    if (!file.read(reinterpret_cast<char *>(&h), sizeof(h))) return false;
+    if (memcmp(h.magic, KNN_MAGIC, sizeof(h.magic)) != 0
+        || h.version != KNN_GRAPH_VERSION || h.type > LAST_FEATURE_TYPE) return false;
+
+    file.seekg(0, ios::end);
+    uint64_t size = uint64_t(file.tellg()), slotBytes = sizeof(uint32_t) + sizeof(double);
+    if (size < sizeof(h) || (h.k && h.count > (size - sizeof(h)) / slotBytes / h.k)
+        || size != sizeof(h) + h.count * h.k * slotBytes) return false;
+    file.seekg(sizeof(h), ios::beg);
+
+    KnnGraph g;
+    g.type = FeatureType(h.type);
+    g.k = h.k;
+    g.count = h.count;
+    g.neighbors.resize(g.count * g.k);
+    g.dists.resize(g.count * g.k);
+    if (!file.read(reinterpret_cast<char *>(g.neighbors.data()),
+                   g.neighbors.size() * sizeof(uint32_t))) return false;
+    if (!file.read(reinterpret_cast<char *>(g.dists.data()),
+                   g.dists.size() * sizeof(double))) return false;
+    for (uint32_t nb : g.neighbors) {
+        if (nb != NO_NEIGHBOR && nb >= g.count) return false;
+    }
+
+    graph = std::move(g);
+    return true;
+}
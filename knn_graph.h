@@ -0,0 +1,50 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: knn_graph.h
+//
+// Header file for knn_graph.cpp
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "feature_store.h"
+
+// Precomputed k nearest neighbours of every row in a feature store.
+// Row i's neighbours are neighbors[i*k .. i*k+k), nearest first, with the
+// distances matchFeatures gives them; unused slots (stores with k or
+// fewer rows) hold NO_NEIGHBOR.
+struct KnnGraph {
+    FeatureType type = BASELINE;
+    uint32_t k = 0;
+    uint64_t count = 0;
+    std::vector<uint32_t> neighbors;
+    std::vector<double> dists;
+};
+
+const uint32_t NO_NEIGHBOR = 0xffffffffu;
+const uint32_t KNN_GRAPH_VERSION = 2;
+
+//Neighbours kept per row by the GUI's "Build k-NN Graphs".
+const int DEFAULT_GRAPH_K = 20;
+
+// Receives the rows whose neighbours are known so far; returning false
+// stops the build.
+typedef std::function<bool(size_t done, size_t total)> KnnProgress;
+
+//Compute the k nearest neighbours (excluding itself) of every row using
+//cache-blocked query x database tiles spread across threads. Float rows
+//are compared four queries at a time and the candidates re-scored as
+//matchFeatures scores them, so the graph agrees with a scan. progress is
+//called from the worker threads, one at a time; if it returns false the
+//build stops and an empty graph is returned.
+KnnGraph buildKnnGraph(const FeatureView &db, int k, int threads = 0,
+                       const KnnProgress &progress = nullptr);
+
+//Write a graph to a binary file.
+bool writeKnnGraph(const std::string &filename, const KnnGraph &graph);
+
+//Read a graph written by writeKnnGraph. Returns false if missing or malformed.
+bool readKnnGraph(const std::string &filename, KnnGraph &graph);
@@ -0,0 +1,251 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: manifest_utils.cpp
+//
+// Content manifests for incremental feature extraction. Each store keeps
+// a manifest recording the size, mtime and content hash of every image
+// it was built from, so a rerun only decodes images that changed.
+
+#include "manifest_utils.h"
+#include "csv_utils.h"
+#include "feature_matrix.h"
+#include "feature_store.h"
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+namespace fs = std::filesystem;
+
+const vector<StoreSpec> &defaultStoreSpecs() {
+    static const vector<StoreSpec> specs = {
+        {BASELINE, "baseline"},
+        {COLOR, "hist"},
+        {MULTIHIST, "multihist"},
+        {COLOR_TEXTURE, "ct"},
+        {CUSTOM, "custom"},
+        {GRID_2X2, "grid2"},
+        {GRID_3X3, "grid3"},
+        {PYRAMID, "pyramid"},
+        {DHASH, "dhash"},
+        {PHASH, "phash"},
+    };
+    return specs;
+}
+
+// Hash a file in 1 MB chunks with 64-bit FNV-1a.
+uint64_t hashFile(const string &path) {
+    uint64_t h = 1469598103934665603ULL;
+    ifstream file(path, ios::binary);
+    vector<char> buf(1 << 20);
+    while (file) {
+        file.read(buf.data(), buf.size());
+        streamsize n = file.gcount();
+        for (streamsize i = 0; i < n; i++) {
+            h ^= (unsigned char)buf[i];
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+// Parse all of [p, end) as one number; false if anything is left over.
+template <typename T>
+static bool parseField(const char *p, const char *end, T &v, int base = 10) {
+    auto r = from_chars(p, end, v, base);
+    return r.ec == errc() && r.ptr == end && p != end;
+}
+
+// Read "path,size,mtime,hash" lines. The path may itself hold commas, so
+// the numbers are split off from the right. A line that does not parse is
+// dropped, and its image is hashed again as if it were new.
+Manifest readManifest(const string &filename) {
+    Manifest manifest;
+    ifstream file(filename);
+    string line;
+
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t c3 = line.rfind(',');
+        size_t c2 = c3 == string::npos || c3 == 0 ? string::npos : line.rfind(',', c3 - 1);
+        size_t c1 = c2 == string::npos || c2 == 0 ? string::npos : line.rfind(',', c2 - 1);
+        if (c1 == string::npos || c1 == 0) continue;
+
+        const char *p = line.data();
+        ManifestEntry e;
+        e.path = line.substr(0, c1);
+        if (!parseField(p + c1 + 1, p + c2, e.size) || !parseField(p + c2 + 1, p + c3, e.mtime)
+            || !parseField(p + c3 + 1, p + line.size(), e.hash, 16)) continue;
+        manifest[e.path] = e;
+    }
+    return manifest;
+}
+
+bool writeManifest(const string &filename, const Manifest &manifest) {
+    return replaceFile(filename, [&](const string &tmp) {
+        ofstream file(tmp);
+        if (!file) return false;
+        for (auto &kv : manifest) {
+            const ManifestEntry &e = kv.second;
+            file << e.path << "," << e.size << "," << e.mtime << ","
+                 << hex << e.hash << dec << "\n";
+        }
+        file.close();
+        return bool(file);
+    });
+}
+
+// Existing state of one store: its manifest and its mapped rows by name.
+struct StoreState {
+    Manifest manifest;
+    FeatureStore store;
+    map<string, size_t> rowIndex;
+};
+
+// Decode scale a store is extracted at under opts.
+static DecodeScale storeDecode(const StoreSpec &spec, const ExtractOptions &opts) {
+    return scaleTolerant(spec.type) ? opts.decode : DecodeScale();
+}
+
+UpdateStats updateFeatureStores(const string &dir,
+                                const vector<StoreSpec> &specs,
+                                const ExtractOptions &opts) {
+    UpdateStats stats;
+
+    vector<StoreState> states(specs.size());
+    set<string> known;
+    for (size_t s = 0; s < specs.size(); s++) {
+        states[s].manifest = readManifest(specs[s].stem + ".manifest");
+        // Rows extracted at another decode scale are all recomputed.
+        FeatureStore &store = states[s].store;
+        if (store.open(specs[s].stem + ".bin") && store.view().decode != storeDecode(specs[s], opts)) {
+            store.close();
+        }
+        const FeatureView &v = store.view();
+        for (size_t i = 0; i < v.count; i++) {
+            states[s].rowIndex[string(v.name(i))] = i;
+        }
+        for (auto &kv : states[s].manifest) known.insert(kv.first);
+    }
+
+    // Current directory contents, in the same order as a full extraction.
+    vector<ManifestEntry> files;
+    vector<string> paths;
+    // A directory that cannot be listed must not read as an empty one,
+    // which would drop every row from every store.
+    error_code ec;
+    fs::directory_iterator it(dir, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry &p = *it;
+        error_code fileEc;
+        if (!p.is_regular_file(fileEc)) continue;
+        if (!isImageExtension(p.path().extension().string())) continue;
+
+        ManifestEntry e;
+        e.path = p.path().filename().string();
+        e.size = p.file_size(fileEc);
+        if (fileEc) continue;
+        e.mtime = p.last_write_time(fileEc).time_since_epoch().count();
+        if (fileEc) continue;
+        files.push_back(e);
+        paths.push_back(p.path().string());
+    }
+    if (ec) {
+        stats.listError = "could not list " + dir + ": " + ec.message();
+        return stats;
+    }
+
+    // Decide which stores need each file recomputed.
+    vector<ExtractJob> jobs;
+    vector<int> jobOf(files.size(), -1);
+    vector<vector<bool>> stale(files.size(), vector<bool>(specs.size(), false));
+
+    for (size_t f = 0; f < files.size() && !opts.cancelled(); f++) {
+        ManifestEntry &e = files[f];
+        bool hashed = false;
+        bool seen = known.count(e.path) > 0;
+        vector<FeatureType> types;
+
+        for (size_t s = 0; s < specs.size(); s++) {
+            auto it = states[s].manifest.find(e.path);
+            bool have = it != states[s].manifest.end()
+                && states[s].rowIndex.count(e.path) > 0;
+
+            if (have && it->second.size == e.size && it->second.mtime == e.mtime) {
+                e.hash = it->second.hash;
+                hashed = true;
+                continue;
+            }
+            if (have) {
+                if (!hashed) {
+                    e.hash = hashFile(paths[f]);
+                    hashed = true;
+                }
+                if (it->second.hash == e.hash) continue;
+            }
+            stale[f][s] = true;
+            types.push_back(specs[s].type);
+        }
+
+        if (!hashed) e.hash = hashFile(paths[f]);
+
+        if (types.empty()) {
+            stats.unchanged++;
+        } else {
+            if (seen) stats.modified++;
+            else stats.added++;
+            jobOf[f] = int(jobs.size());
+            jobs.push_back({paths[f], types});
+        }
+    }
+
+    set<string> present;
+    for (auto &e : files) present.insert(e.path);
+    for (auto &name : known) {
+        if (!present.count(name)) stats.removed++;
+    }
+
+    vector<vector<ImageFeature>> results = extractJobsParallel(jobs, opts);
+    if (opts.cancelled()) {
+        stats.cancelled = true;
+        return stats;
+    }
+
+    // Splice fresh and retained rows back together in listing order.
+    for (size_t s = 0; s < specs.size(); s++) {
+        FeatureMatrix rows(specs[s].type);
+        rows.setDecode(storeDecode(specs[s], opts));
+        rows.reserve(files.size());
+        Manifest manifest;
+
+        for (size_t f = 0; f < files.size(); f++) {
+            const ManifestEntry &e = files[f];
+            if (stale[f][s]) {
+                bool found = false;
+                for (auto &feat : results[jobOf[f]]) {
+                    if (feat.type == specs[s].type) {
+                        found = rows.addFeature(feat);
+                        break;
+                    }
+                }
+                if (!found) continue;
+            } else if (!rows.addRow(states[s].store.view(), states[s].rowIndex[e.path])) {
+                continue;
+            }
+            manifest[e.path] = e;
+        }
+
+        // The old store stays mapped until every retained row is copied.
+        // The manifest is only replaced once both stores are, so it never
+        // vouches for a store that was not written in full.
+        states[s].store.close();
+        const FeatureView &v = rows.view();
+        if (replaceFile(specs[s].stem + ".csv", [&](const string &tmp) { return writeFeatureCSV(tmp, v); })
+            && replaceFile(specs[s].stem + ".bin", [&](const string &tmp) { return writeFeatureStore(tmp, v); })) {
+            writeManifest(specs[s].stem + ".manifest", manifest);
+        }
+    }
+
+    return stats;
+}
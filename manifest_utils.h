@@ -0,0 +1,75 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: manifest_utils.h
+//
+// Header file for manifest_utils.cpp
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "feature_utils.h"
+#include "extract_pipeline.h"
+
+// Identity of one source image at the time its features were extracted.
+struct ManifestEntry {
+    string path;      // file name relative to the image directory
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+};
+
+typedef map<string, ManifestEntry> Manifest;
+
+// A feature store on disk: <stem>.csv, <stem>.bin and <stem>.manifest.
+struct StoreSpec {
+    FeatureType type;
+    string stem;
+};
+
+// Counts of images by what an incremental update did with them.
+struct UpdateStats {
+    size_t added = 0;
+    size_t modified = 0;
+    size_t removed = 0;
+    size_t unchanged = 0;
+    bool cancelled = false; // opts.cancel was set; no store was rewritten
+    string listError;       // why dir could not be listed; if set, no store was rewritten
+};
+
+//The stores written by "Extract Features (All)".
+const vector<StoreSpec> &defaultStoreSpecs();
+
+//Write a file through write(tmp) and rename it over filename only once it
+//is complete, so a crash part way leaves the old file in place and a
+//reader never opens a partial one. Returns false, removing tmp, on failure.
+template <typename WriteFn>
+bool replaceFile(const string &filename, WriteFn write) {
+    string tmp = filename + ".tmp";
+    if (!write(tmp) || rename(tmp.c_str(), filename.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+//64-bit FNV-1a hash of a file's contents.
+uint64_t hashFile(const string &path);
+
+//Read a manifest file. A missing file gives an empty manifest.
+Manifest readManifest(const string &filename);
+
+//Write a manifest file.
+bool writeManifest(const string &filename, const Manifest &manifest);
+
+//Bring a set of stores up to date with the images in dir. Only new or
+//modified images are decoded; deleted images are dropped and unchanged
+//rows are copied from the existing .bin store. A store written at a
+//different opts.decode is re-extracted in full. Progress counts the
+//images that had to be extracted.
+UpdateStats updateFeatureStores(const string &dir,
+                                const vector<StoreSpec> &specs,
+                                const ExtractOptions &opts = ExtractOptions());
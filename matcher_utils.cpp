@@ -7,15 +7,20 @@
 // features, returning the top-N closest matches.
 
 #include "matcher_utils.h"
+#include "distance_kernels.h"
 #include <algorithm>
+#include <cfloat>
 #include <cmath>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 
 using namespace std;
 
 // Compute Sum of Squared Differences between two int vectors.
 double computeSSD(const vector<int> &a, const vector<int> &b) {
     double ssd = 0.0;
-    for (int i = 0; i < a.size(); i++) {
+    for (size_t i = 0; i < a.size(); i++) {
         double diff = a[i] - b[i];
         ssd += diff * diff;
     }
@@ -25,7 +30,7 @@ double computeSSD(const vector<int> &a, const vector<int> &b) {
 // Compute histogram intersection distance.
 double histIntersection(const vector<double> &a, const vector<double> &b) {
     double sum = 0;
-    for (int i = 0; i < a.size(); i++) {
+    for (size_t i = 0; i < a.size(); i++) {
         sum += min(a[i], b[i]);
     }
     return 1.0 - sum;
@@ -34,7 +39,7 @@ double histIntersection(const vector<double> &a, const vector<double> &b) {
 // Compute cosine distance between two vectors.
 double cosineDistance(const vector<double> &a, const vector<double> &b) {
     double dot = 0, na = 0, nb = 0;
-    for (int i = 0; i < a.size(); i++) {
+    for (size_t i = 0; i < a.size(); i++) {
         dot += a[i] * b[i];
         na += a[i] * a[i];
         nb += b[i] * b[i];
@@ -45,37 +50,274 @@ double cosineDistance(const vector<double> &a, const vector<double> &b) {
     return 1.0 - dot / (na * nb);
 }
 
-// Match a target feature against a database.
-vector<Match> matchFeatures(const ImageFeature &target,
-                           const vector<ImageFeature> &db,
-                           FeatureType type,
-                           int N) {
+// Scan count rows for the top N, in one pass or in progress-reporting
+// blocks, and attach row names to the results.
+template <typename DistFn, typename NameFn>
+static vector<Match> scanMatches(size_t count, int N, int threads, DistFn dist, size_t skip,
+                                 const MatchProgress &progress, NameFn name) {
+    auto toMatches = [&](const vector<Scored> &scored) {
+        vector<Match> matches;
+        for (auto &s : scored) matches.push_back({string(name(s.index)), s.dist});
+        return matches;
+    };
 
-    vector<Match> matches;
+    size_t n = max(N, 0);
+    if (!progress) return toMatches(scanTopN(count, n, threads, dist, skip));
+
+    return toMatches(scanTopNProgressive(count, n, threads, dist, skip,
+                                         [&](const TopN &best, size_t done) {
+                                             return progress(toMatches(best.sorted()), done, count);
+                                         }));
+}
+
+// Region-weighted histogram intersection over a spatial layout.
+double spatialIntersection(const DistanceKernels &k, const float *a, const float *b,
+                           const SpatialLayout &layout) {
+    size_t bins = layout.regionBins();
+    double sim = 0;
+    for (size_t l = 0; l < layout.grids.size(); l++) {
+        size_t regions = size_t(layout.grids[l]) * layout.grids[l];
+        double levelSim = 0;
+        for (size_t r = 0; r < regions; r++, a += bins, b += bins) {
+            levelSim += 1.0 - k.histIntersectionF32(a, b, bins);
+        }
+        sim += layout.weights[l] * levelSim / regions;
+    }
+    return 1.0 - sim;
+}
+
+vector<double> spatialSuffixMass(const float *a, const SpatialLayout &layout) {
+    size_t bins = layout.regionBins();
+    vector<double> mass;
+    for (size_t l = 0; l < layout.grids.size(); l++) {
+        size_t regions = size_t(layout.grids[l]) * layout.grids[l];
+        for (size_t r = 0; r < regions; r++, a += bins) {
+            double m = 0;
+            for (size_t i = 0; i < bins; i++) m += a[i];
+            mass.push_back(layout.weights[l] * m / regions);
+        }
+    }
+    vector<double> rest(mass.size() + 1, 0.0);
+    for (size_t r = mass.size(); r > 0; r--) rest[r - 1] = rest[r] + mass[r - 1];
+    return rest;
+}
+
+// Same sums in the same order as spatialIntersection, checked against the
+// bound after each region; the slack covers float rounding as in the
+// kernels' own bounded intersection.
+double spatialIntersectionBounded(const DistanceKernels &k, const float *a, const float *b,
+                                  const SpatialLayout &layout, const double *restA,
+                                  double bound, PruneStats &prune) {
+    size_t bins = layout.regionBins();
+    size_t total = layout.dim() / bins;
+    size_t region = 0;
+    double sim = 0;
+    for (size_t l = 0; l < layout.grids.size(); l++) {
+        size_t regions = size_t(layout.grids[l]) * layout.grids[l];
+        double levelSim = 0;
+        for (size_t r = 0; r < regions; r++, a += bins, b += bins) {
+            levelSim += 1.0 - k.histIntersectionF32(a, b, bins);
+            if (++region == total) break;
 
-    for (auto &f : db) {
-        double dist = 1e9;
+            double best = sim + layout.weights[l] * levelSim / regions + restA[region];
+            double lower = 1.0 - best - double(bins) * FLT_EPSILON * max(1.0, best);
+            if (lower > bound) {
+                prune.rows++;
+                prune.values += (total - region) * bins;
+                return lower;
+            }
+        }
+        sim += layout.weights[l] * levelSim / regions;
+    }
+    return 1.0 - sim;
+}
+
+namespace {
+
+// Distance from one target feature to any row of a block of rows, with the
+// per-query tables the bounded kernels need.
+class RowDistance {
+public:
+    //False if the target does not fit the rows.
+    bool init(const ImageFeature &target, const FeatureView &rows) {
+        db = &rows;
+        if (rows.elem == ELEM_U8) {
+            if (target.intFeat.size() != rows.dim) return false;
+            for (int v : target.intFeat) tU8.push_back((uint8_t)std::clamp(v, 0, 255));
+            if (isHashType(rows.type)) {
+                if (rows.dim != HASH_BYTES) return false;
+                tHash = hashWord(tU8.data());
+            }
+        } else {
+            if (target.dblFeat.size() != rows.dim) return false;
+            for (double v : target.dblFeat) tF32.push_back(float(v));
+        }
+
+        layout = spatialLayout(rows.type);
+        if (layout && layout->dim() != rows.dim) return false;
+
+        // The target's remaining histogram mass bounds how much of the
+        // intersection a partly compared row can still gain.
+        if (layout) rest = spatialSuffixMass(tF32.data(), *layout);
+        else if (rows.elem != ELEM_U8 && rows.type != DNN_EMB) rest = suffixMass(tF32.data(), rows.dim);
+        return true;
+    }
+
+    // Distance to row i, stopping early once it cannot beat bound.
+    double operator()(size_t i, double bound, PruneStats &prune) const {
+        const FeatureView &v = *db;
+        if (layout) {
+            return spatialIntersectionBounded(k, tF32.data(), v.f32(i), *layout,
+                                              rest.data(), bound, prune);
+        }
+        if (v.elem == ELEM_SPARSE) return sparse(i, bound, prune);
+        if (isHashType(v.type)) return hammingDistance(tHash, hashWord(v.u8(i)));
+        if (v.type == DNN_EMB) {
+            return k.cosineDistanceF32(tF32.data(), v.f32(i), v.dim);
+        }
 
-        if (type == BASELINE) {
-            dist = computeSSD(target.intFeat, f.intFeat);
+        size_t done;
+        double d = v.type == BASELINE
+            ? k.ssdU8Bounded(tU8.data(), v.u8(i), v.dim, bound, &done)
+            : k.histIntersectionF32Bounded(tF32.data(), v.f32(i), v.dim, rest.data(), bound, &done);
+        if (done < v.dim) {
+            prune.rows++;
+            prune.values += v.dim - done;
         }
-        else if (type == DNN_EMB) {
-            dist = cosineDistance(target.dblFeat, f.dblFeat);
+        return d;
+    }
+
+private:
+    // Rows stored dense within a sparse block take the SIMD kernel.
+    double sparse(size_t i, double bound, PruneStats &prune) const {
+        const FeatureView &v = *db;
+        SparseRow r = v.sparse(i);
+        size_t done, total;
+        double d;
+        if (r.dense) {
+            total = v.dim;
+            d = k.histIntersectionF32Bounded(tF32.data(), r.dense, v.dim, rest.data(), bound, &done);
+        } else {
+            total = r.nnz;
+            d = histIntersectionSparseDense(tF32.data(), v.dim, rest.data(), r.index, r.value, r.nnz,
+                                            bound, &done);
         }
-        else {
-            dist = histIntersection(target.dblFeat, f.dblFeat);
+        if (done < total) {
+            prune.rows++;
+            prune.values += total - done;
         }
+        return d;
+    }
+
+    const DistanceKernels &k = activeKernels();
+    const FeatureView *db = nullptr;
+    const SpatialLayout *layout = nullptr;
+    vector<uint8_t> tU8;
+    uint64_t tHash = 0;
+    vector<float> tF32;
+    vector<double> rest;
+};
+
+}
+
+// Match a target feature against the rows of a feature store view.
+vector<Match> matchFeatures(const ImageFeature &target,
+                           const FeatureView &db,
+                           int N,
+                           int threads,
+                           size_t skip,
+                           const MatchProgress &progress) {
+    RowDistance dist;
+    if (!dist.init(target, db)) return {};
+
+    // Distances stop early once a row cannot beat the current N-th best.
+    return scanMatches(db.count, N, threads,
+                       [&](size_t i, double bound, PruneStats &prune) { return dist(i, bound, prune); },
+                       skip, progress, [&](size_t i) { return db.name(i); });
+}
+
+vector<Scored> scoreRows(const ImageFeature &target, const FeatureView &db, size_t N,
+                         int threads, size_t skip, double bound) {
+    RowDistance dist;
+    if (!dist.init(target, db)) return {};
+
+    return scanTopN(db.count, N, threads,
+                    [&](size_t i, double rowBound, PruneStats &prune) {
+                        return dist(i, min(rowBound, bound), prune);
+                    }, skip);
+}
 
-        matches.push_back({f.name, dist});
+function<double(size_t)> rowScorer(const ImageFeature &target, const FeatureView &db) {
+    auto dist = make_shared<RowDistance>();
+    if (!dist->init(target, db)) return nullptr;
+    return [dist](size_t i) {
+        PruneStats prune;
+        return (*dist)(i, INFINITY, prune);
+    };
+}
+
+vector<size_t> alignRows(const FeatureView &from, const FeatureView &to) {
+    vector<size_t> map(from.count, NO_ROW);
+    bool same = from.count == to.count;
+    for (size_t i = 0; same && i < from.count; i++) same = from.name(i) == to.name(i);
+    if (same) {
+        for (size_t i = 0; i < from.count; i++) map[i] = i;
+        return map;
+    }
+
+    unordered_map<string_view, size_t> rowOf;
+    rowOf.reserve(to.count);
+    for (size_t i = 0; i < to.count; i++) rowOf.emplace(to.name(i), i);
+    for (size_t i = 0; i < from.count; i++) {
+        auto it = rowOf.find(from.name(i));
+        if (it != rowOf.end()) map[i] = it->second;
+    }
+    return map;
+}
+
+// Shortlist on the coarse rows, then rank the shortlist's fine rows.
+vector<Match> matchCascade(const ImageFeature &coarseTarget, const FeatureView &coarse,
+                           const ImageFeature &fineTarget, const FeatureView &fine,
+                           const vector<size_t> &coarseToFine,
+                           int N, size_t shortlist, int threads, size_t skip,
+                           CascadeStats *stats) {
+    RowDistance coarseDist, fineDist;
+    if (coarseToFine.size() != coarse.count || !coarseDist.init(coarseTarget, coarse)
+        || !fineDist.init(fineTarget, fine)) return {};
+
+    PruneStats coarseSaved, fineSaved;
+    vector<Scored> candidates = scanTopN(coarse.count, max<size_t>(shortlist, max(N, 0)), threads,
+                                         [&](size_t i, double bound, PruneStats &prune) {
+                                             return coarseDist(i, bound, prune);
+                                         }, skip, &coarseSaved);
+
+    // Re-rank in fine row order, so ties break as in a full scan of fine.
+    size_t fineSkip = skip < coarseToFine.size() ? coarseToFine[skip] : NO_ROW;
+    vector<size_t> rows;
+    rows.reserve(candidates.size());
+    for (auto &c : candidates) {
+        size_t row = coarseToFine[c.index];
+        if (row != NO_ROW && row != fineSkip) rows.push_back(row);
     }
+    sort(rows.begin(), rows.end());
+    rows.erase(unique(rows.begin(), rows.end()), rows.end());
 
-    sort(matches.begin(), matches.end(),
-         [](const Match &a, const Match &b) {
-             return a.dist < b.dist;
-         });
+    auto ranked = scanTopN(rows.size(), max(N, 0), threads,
+                           [&](size_t j, double bound, PruneStats &prune) {
+                               return fineDist(rows[j], bound, prune);
+                           }, NO_ROW, &fineSaved);
 
-    if (N > matches.size()) N = matches.size();
-    matches.resize(N);
+    if (stats) {
+        *stats = CascadeStats();
+        for (size_t i = 0; i < coarse.count; i++) {
+            if (i != skip) stats->coarseValues += coarse.values(i);
+        }
+        for (size_t row : rows) stats->fineValues += fine.values(row);
+        stats->coarseValues -= coarseSaved.values;
+        stats->fineValues -= fineSaved.values;
+    }
 
+    vector<Match> matches;
+    for (auto &s : ranked) matches.push_back({string(fine.name(rows[s.index])), s.dist});
     return matches;
 }
@@ -14,9 +14,231 @@ struct Match {
 };
 
 #include "feature_utils.h"
+#include "feature_store.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
 
-//Match a target feature against a database of features.
+//Double-precision distance functions on owned feature vectors; the
+//reference the row kernels are benchmarked against.
+double computeSSD(const std::vector<int> &a, const std::vector<int> &b);
+double histIntersection(const std::vector<double> &a, const std::vector<double> &b);
+double cosineDistance(const std::vector<double> &a, const std::vector<double> &b);
+
+struct DistanceKernels;
+
+// Work a shard's bounded distances saved by stopping early.
+struct PruneStats {
+    uint64_t rows = 0;   // rows abandoned
+    uint64_t values = 0; // values those rows did not compare
+};
+
+//Region-weighted intersection distance between two spatial histogram rows:
+//1 minus the weighted mean of each region's histogram intersection, where
+//a level's weight is shared equally among its regions.
+double spatialIntersection(const DistanceKernels &k, const float *a, const float *b,
+                           const SpatialLayout &layout);
+
+//spatialIntersection that stops once the distance must exceed bound and
+//returns a lower bound on it. restA has one entry per region plus one:
+//the weighted mass of a in that region and every later one (see
+//spatialSuffixMass). A row that is not abandoned gets exactly the value
+//spatialIntersection returns.
+double spatialIntersectionBounded(const DistanceKernels &k, const float *a, const float *b,
+                                  const SpatialLayout &layout, const double *restA,
+                                  double bound, PruneStats &prune);
+
+//Weighted per-region suffix masses of a spatial histogram row.
+std::vector<double> spatialSuffixMass(const float *a, const SpatialLayout &layout);
+
+// Distance of one database row, identified by its index.
+struct Scored {
+    double dist;
+    size_t index;
+
+    bool operator<(const Scored &o) const {
+        return dist < o.dist || (dist == o.dist && index < o.index);
+    }
+};
+
+// Bounded max-heap holding the N best (smallest) scores seen so far.
+class TopN {
+public:
+    explicit TopN(size_t n) : n(n) { heap.reserve(n); }
+
+    void push(double dist, size_t index) {
+        Scored s{dist, index};
+        if (heap.size() < n) {
+            heap.push_back(s);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (n > 0 && s < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = s;
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    //Distance a row must beat to enter the heap.
+    double worst() const {
+        return heap.size() < n ? INFINITY : heap.front().dist;
+    }
+
+    void merge(const TopN &other) {
+        for (auto &s : other.heap) push(s.dist, s.index);
+    }
+
+    //Scores in ascending order.
+    std::vector<Scored> sorted() const {
+        std::vector<Scored> out = heap;
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+private:
+    size_t n;
+    std::vector<Scored> heap;
+};
+
+// Rows per shard below which the scan does not spawn another thread.
+const size_t MIN_SHARD_ROWS = 4096;
+
+// Row index meaning "skip nothing".
+const size_t NO_ROW = SIZE_MAX;
+
+//Score rows [0, count) with dist(i) across worker threads, keeping a
+//top-N heap per shard and merging them. Ties are broken by row index, so
+//the result does not depend on the thread count. Row skip is not scored.
+//A dist callable as dist(i, bound, prune) is given the distance the row
+//must beat and may stop early, returning any value above bound and
+//recording the work it saved in prune; the result is unchanged. With saved
+//set, the work saved across all shards is added to it.
+template <typename DistFn>
+std::vector<Scored> scanTopN(size_t count, size_t N, int threads, DistFn dist,
+                             size_t skip = NO_ROW, PruneStats *saved = nullptr) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t shards = std::min<size_t>(threads, std::max<size_t>(1, count / MIN_SHARD_ROWS));
+
+    std::vector<TopN> heaps(shards, TopN(N));
+    std::vector<PruneStats> pruned(shards);
+    auto scanShard = [&](size_t s) {
+        size_t begin = count * s / shards;
+        size_t end = count * (s + 1) / shards;
+        for (size_t i = begin; i < end; i++) {
+            if (i == skip) continue;
+            if constexpr (std::is_invocable_v<DistFn, size_t, double, PruneStats &>) {
+                heaps[s].push(dist(i, heaps[s].worst(), pruned[s]), i);
+            } else {
+                heaps[s].push(dist(i), i);
+            }
+        }
+    };
+
+    {
+        ScopedTimer timer(STAGE_DISTANCE_SCAN);
+        if (shards == 1) {
+            scanShard(0);
+        } else {
+            std::vector<std::thread> workers;
+            for (size_t s = 0; s < shards; s++) workers.emplace_back(scanShard, s);
+            for (auto &w : workers) w.join();
+        }
+    }
+    countMetric(COUNTER_ROWS_SCANNED, count);
+    for (auto &p : pruned) {
+        countMetric(COUNTER_ROWS_ABANDONED, p.rows);
+        countMetric(COUNTER_VALUES_SKIPPED, p.values);
+        if (saved) {
+            saved->rows += p.rows;
+            saved->values += p.values;
+        }
+    }
+
+    ScopedTimer timer(STAGE_TOPN_SELECT);
+    for (size_t s = 1; s < shards; s++) heaps[0].merge(heaps[s]);
+    return heaps[0].sorted();
+}
+
+// Rows scored between progress callbacks of a progressive scan.
+const size_t PROGRESS_ROWS = 65536;
+
+//scanTopN in blocks of PROGRESS_ROWS rows, calling progress(best, done)
+//with the running top-N heap after each block. The scan stops early when
+//progress returns false. The final result is the same as scanTopN's.
+template <typename DistFn, typename ProgressFn>
+std::vector<Scored> scanTopNProgressive(size_t count, size_t N, int threads, DistFn dist,
+                                        size_t skip, ProgressFn progress) {
+    TopN best(N);
+    for (size_t begin = 0; begin < count; begin += PROGRESS_ROWS) {
+        size_t end = std::min(count, begin + PROGRESS_ROWS);
+        size_t blockSkip = skip >= begin && skip < end ? skip - begin : NO_ROW;
+        std::vector<Scored> block;
+        if constexpr (std::is_invocable_v<DistFn, size_t, double, PruneStats &>) {
+            block = scanTopN(end - begin, N, threads,
+                             [&](size_t i, double bound, PruneStats &prune) {
+                                 // Rows that cannot beat the running top N are not needed either.
+                                 return dist(begin + i, std::min(bound, best.worst()), prune);
+                             }, blockSkip);
+        } else {
+            block = scanTopN(end - begin, N, threads,
+                             [&](size_t i) { return dist(begin + i); }, blockSkip);
+        }
+        for (auto &s : block) best.push(s.dist, begin + s.index);
+        if (!progress(best, end)) break;
+    }
+    return best.sorted();
+}
+
+// Receives the running top-N of a long scan and the rows scanned so far;
+// returning false stops the scan.
+typedef std::function<bool(const std::vector<Match> &best, size_t done, size_t total)> MatchProgress;
+
+//Match a target feature against a block of rows: a memory-mapped store
+//or a FeatureMatrix view. Row skip (usually the target's own row) is left
+//out. threads = 0 uses one scan shard per hardware thread. With progress
+//set the rows are scanned in blocks and the partial top-N reported after each.
 std::vector<Match> matchFeatures(const ImageFeature &target,
-                                 const std::vector<ImageFeature> &db,
-                                 FeatureType type,
-                                 int N);
+                                 const FeatureView &db,
+                                 int N,
+                                 int threads = 0,
+                                 size_t skip = NO_ROW,
+                                 const MatchProgress &progress = nullptr);
+
+//The top N rows of db as matchFeatures ranks them, by row index rather
+//than name. A row that cannot come closer than bound may be abandoned and
+//scored anywhere above it, so a caller merging several blocks can pass its
+//running N-th best. Empty if target does not fit db.
+std::vector<Scored> scoreRows(const ImageFeature &target, const FeatureView &db, size_t N,
+                              int threads = 0, size_t skip = NO_ROW, double bound = INFINITY);
+
+//Distance from target to row i of db exactly as matchFeatures scores it,
+//for callers that pick their own rows. db must outlive the scorer. Empty
+//if target does not fit db.
+std::function<double(size_t i)> rowScorer(const ImageFeature &target, const FeatureView &db);
+
+//Row of `to` holding the image of each row of `from`, matched by name, or
+//NO_ROW if `to` lacks it. Stores extracted together share their row order,
+//which is detected and mapped without hashing.
+std::vector<size_t> alignRows(const FeatureView &from, const FeatureView &to);
+
+// Coarse-stage candidates kept for re-ranking unless a query asks otherwise.
+const size_t DEFAULT_SHORTLIST = 200;
+
+// Row values one cascade query actually compared, after early abandoning.
+struct CascadeStats {
+    uint64_t coarseValues = 0; // scanning the coarse rows
+    uint64_t fineValues = 0;   // re-ranking the shortlist's fine rows
+};
+
+//Two-stage match: scan every coarse row (a cheap descriptor such as COLOR)
+//for the `shortlist` nearest to coarseTarget, then rank only the matching
+//rows of fine (an expensive descriptor of the same images) by fineTarget.
+//coarseToFine comes from alignRows(coarse, fine); skip is a coarse row.
+std::vector<Match> matchCascade(const ImageFeature &coarseTarget, const FeatureView &coarse,
+                                const ImageFeature &fineTarget, const FeatureView &fine,
+                                const std::vector<size_t> &coarseToFine,
+                                int N, size_t shortlist, int threads = 0, size_t skip = NO_ROW,
+                                CascadeStats *stats = nullptr);
@@ -0,0 +1,218 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: metrics.cpp
+//
+// Process-wide stage timings and counters. Each histogram has power-of-two
+// microsecond buckets updated with relaxed atomics, so worker threads can
+// record without locking.
+
+#include "metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Bucket i counts durations below 2^i microseconds; the last is unbounded.
+static const int METRIC_BUCKETS = 26;
+
+// Extract histograms, one per FeatureType.
+static const int EXTRACT_TYPES = LAST_FEATURE_TYPE + 1;
+
+namespace {
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[METRIC_BUCKETS];
+    std::atomic<uint64_t> sumNs;
+};
+
+}
+
+static bool initialEnabled() {
+    const char *env = getenv("CBIR_METRICS");
+    return !(env && strcmp(env, "0") == 0);
+}
+
+std::atomic<bool> metricsOn{initialEnabled()};
+std::atomic<uint64_t> metricCounters[COUNTER_COUNT];
+
+static Histogram stageHists[STAGE_COUNT];
+static Histogram extractHists[EXTRACT_TYPES];
+
+static const char *stageName(int stage) {
+    static const char *names[STAGE_COUNT] = {
+        "decode", "extract", "store_load", "csv_parse",
+        "distance_scan", "topn_select", "render", "query",
+    };
+    return names[stage];
+}
+
+const char *metricCounterName(MetricCounter counter) {
+    static const char *names[COUNTER_COUNT] = {
+        "images_decoded", "decode_failures", "queries", "result_cache_hits", "rows_scanned",
+        "rows_abandoned", "values_skipped", "shards_streamed", "shard_bytes",
+    };
+    return names[counter];
+}
+
+void setMetricsEnabled(bool on) {
+    metricsOn.store(on, std::memory_order_relaxed);
+}
+
+void recordDuration(MetricStage stage, int64_t ns, FeatureType type) {
+    Histogram &h = stage == STAGE_EXTRACT && type >= 0 && type <= LAST_FEATURE_TYPE
+                       ? extractHists[type] : stageHists[stage];
+
+    uint64_t us = ns > 0 ? uint64_t(ns) / 1000 : 0;
+    int bucket = 0;
+    while (bucket < METRIC_BUCKETS - 1 && us >= (uint64_t(1) << bucket)) bucket++;
+
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h.sumNs.fetch_add(ns > 0 ? uint64_t(ns) : 0, std::memory_order_relaxed);
+}
+
+uint64_t metricCount(MetricCounter counter) {
+    return metricCounters[counter].load(std::memory_order_relaxed);
+}
+
+// Upper bound in ms of the bucket holding quantile q.
+static double bucketQuantileMs(const uint64_t *buckets, uint64_t count, double q) {
+    uint64_t rank = uint64_t(q * count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank) return double(uint64_t(1) << b) / 1000.0;
+    }
+    return double(uint64_t(1) << (METRIC_BUCKETS - 1)) / 1000.0;
+}
+
+// Consistent-enough copy of one histogram for export.
+struct HistogramCopy {
+    std::string name;
+    const char *stage;
+    const char *descriptor; // extract histograms only
+    uint64_t buckets[METRIC_BUCKETS];
+    uint64_t count;
+    uint64_t sumNs;
+};
+
+static std::vector<HistogramCopy> copyHistograms() {
+    std::vector<HistogramCopy> out;
+    auto add = [&](const Histogram &h, const char *stage, const char *descriptor) {
+        HistogramCopy c;
+        c.stage = stage;
+        c.descriptor = descriptor;
+        c.name = descriptor ? std::string(stage) + "_" + descriptor : std::string(stage);
+        c.count = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            c.buckets[b] = h.buckets[b].load(std::memory_order_relaxed);
+            c.count += c.buckets[b];
+        }
+        c.sumNs = h.sumNs.load(std::memory_order_relaxed);
+        if (c.count > 0) out.push_back(c);
+    };
+
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (s == STAGE_EXTRACT) {
+            for (int t = 0; t <= LAST_FEATURE_TYPE; t++) {
+                add(extractHists[t], stageName(s), featureTypeName(FeatureType(t)));
+            }
+        } else {
+            add(stageHists[s], stageName(s), nullptr);
+        }
+    }
+    return out;
+}
+
+std::vector<MetricSummary> metricSummaries() {
+    std::vector<MetricSummary> out;
+    for (auto &h : copyHistograms()) {
+        MetricSummary s;
+        s.name = h.name;
+        s.count = h.count;
+        s.totalMs = h.sumNs / 1e6;
+        s.meanMs = s.totalMs / h.count;
+        s.p50Ms = bucketQuantileMs(h.buckets, h.count, 0.50);
+        s.p99Ms = bucketQuantileMs(h.buckets, h.count, 0.99);
+        out.push_back(s);
+    }
+    return out;
+}
+
+std::string metricsJson() {
+    std::string out = "{\"enabled\":";
+    out += metricsEnabled() ? "true" : "false";
+
+    out += ",\"counters\":{";
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (c) out += ',';
+        out += "\"" + std::string(metricCounterName(MetricCounter(c))) + "\":" +
+               std::to_string(metricCount(MetricCounter(c)));
+    }
+
+    out += "},\"stages\":{";
+    bool first = true;
+    char buf[160];
+    for (auto &h : copyHistograms()) {
+        if (!first) out += ',';
+        first = false;
+        snprintf(buf, sizeof(buf), "\"%s\":{\"count\":%llu,\"total_ms\":%.3f,\"p50_ms\":%.3f,"
+                 "\"p99_ms\":%.3f,\"buckets_us\":[", h.name.c_str(), (unsigned long long)h.count,
+                 h.sumNs / 1e6, bucketQuantileMs(h.buckets, h.count, 0.50),
+                 bucketQuantileMs(h.buckets, h.count, 0.99));
+        out += buf;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            if (b) out += ',';
+            out += std::to_string(h.buckets[b]);
+        }
+        out += "]}";
+    }
+    out += "}}";
+    return out;
+}
+
+std::string metricsPrometheus() {
+    std::string out;
+    char buf[256];
+
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        const char *name = metricCounterName(MetricCounter(c));
+        snprintf(buf, sizeof(buf), "# TYPE cbir_%s_total counter\ncbir_%s_total %llu\n",
+                 name, name, (unsigned long long)metricCount(MetricCounter(c)));
+        out += buf;
+    }
+
+    out += "# TYPE cbir_stage_seconds histogram\n";
+    for (auto &h : copyHistograms()) {
+        std::string labels = std::string("stage=\"") + h.stage + "\"";
+        if (h.descriptor) labels += std::string(",descriptor=\"") + h.descriptor + "\"";
+
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += h.buckets[b];
+            if (b == METRIC_BUCKETS - 1) {
+                snprintf(buf, sizeof(buf), "cbir_stage_seconds_bucket{%s,le=\"+Inf\"} %llu\n",
+                         labels.c_str(), (unsigned long long)cumulative);
+            } else {
+                snprintf(buf, sizeof(buf), "cbir_stage_seconds_bucket{%s,le=\"%g\"} %llu\n",
+                         labels.c_str(), double(uint64_t(1) << b) / 1e6,
+                         (unsigned long long)cumulative);
+            }
+            out += buf;
+        }
+        snprintf(buf, sizeof(buf), "cbir_stage_seconds_sum{%s} %.9f\ncbir_stage_seconds_count{%s} %llu\n",
+                 labels.c_str(), h.sumNs / 1e9, labels.c_str(), (unsigned long long)h.count);
+        out += buf;
+    }
+    return out;
+}
+
+void resetMetrics() {
+    for (auto *group : {stageHists, extractHists}) {
+        size_t n = group == stageHists ? STAGE_COUNT : EXTRACT_TYPES;
+        for (size_t i = 0; i < n; i++) {
+            for (auto &b : group[i].buckets) b.store(0, std::memory_order_relaxed);
+            group[i].sumNs.store(0, std::memory_order_relaxed);
+        }
+    }
+    for (auto &c : metricCounters) c.store(0, std::memory_order_relaxed);
+}
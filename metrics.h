@@ -0,0 +1,107 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: metrics.h
+//
+// Header file for metrics.cpp
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "feature_utils.h"
+
+// Pipeline stages timed by ScopedTimer.
+enum MetricStage {
+    STAGE_DECODE,        // imread
+    STAGE_EXTRACT,       // one descriptor; broken down by feature type
+    STAGE_STORE_LOAD,    // mapping and validating a binary store
+    STAGE_CSV_PARSE,     // readFeatureCSV / readDNNCSV
+    STAGE_DISTANCE_SCAN, // scoring database rows into per-shard heaps
+    STAGE_TOPN_SELECT,   // merging and sorting the shard heaps
+    STAGE_RENDER,        // formatting results for the GUI or CLI
+    STAGE_QUERY,         // one FeatureCache::query end to end
+    STAGE_COUNT
+};
+
+// Event counters.
+enum MetricCounter {
+    COUNTER_IMAGES_DECODED,
+    COUNTER_DECODE_FAILURES,
+    COUNTER_QUERIES,
+    COUNTER_RESULT_CACHE_HITS,
+    COUNTER_ROWS_SCANNED,
+    COUNTER_ROWS_ABANDONED,  // rows a bounded distance stopped early
+    COUNTER_VALUES_SKIPPED,  // row values those rows left uncompared
+    COUNTER_SHARDS_STREAMED, // shard files mapped by a streaming match
+    COUNTER_SHARD_BYTES,     // bytes of those shards
+    COUNTER_COUNT
+};
+
+// Set from CBIR_METRICS at startup (0 disables); see setMetricsEnabled.
+extern std::atomic<bool> metricsOn;
+extern std::atomic<uint64_t> metricCounters[COUNTER_COUNT];
+
+inline bool metricsEnabled() { return metricsOn.load(std::memory_order_relaxed); }
+void setMetricsEnabled(bool on);
+
+//Add one duration to a stage histogram. type selects the descriptor of
+//STAGE_EXTRACT and is ignored otherwise.
+void recordDuration(MetricStage stage, int64_t ns, FeatureType type = BASELINE);
+
+inline void countMetric(MetricCounter counter, uint64_t n = 1) {
+    if (metricsEnabled()) metricCounters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+// Times its own lifetime into a stage histogram. When metrics are
+// disabled it costs one relaxed load and reads no clock.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(MetricStage stage, FeatureType type = BASELINE)
+        : stage(stage), type(type), on(metricsEnabled()) {
+        if (on) start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        if (!on) return;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        recordDuration(stage, ns, type);
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    MetricStage stage;
+    FeatureType type;
+    bool on;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Aggregate of one histogram, for display.
+struct MetricSummary {
+    std::string name;
+    uint64_t count;
+    double totalMs;
+    double meanMs;
+    double p50Ms; // upper bound of the bucket holding the median
+    double p99Ms;
+};
+
+//Every non-empty histogram, in stage order.
+std::vector<MetricSummary> metricSummaries();
+
+//Current value of a counter.
+uint64_t metricCount(MetricCounter counter);
+
+//Name of a counter as exported ("rows_scanned", ...).
+const char *metricCounterName(MetricCounter counter);
+
+//All histograms and counters as a JSON object.
+std::string metricsJson();
+
+//All histograms and counters in the Prometheus text exposition format.
+std::string metricsPrometheus();
+
+void resetMetrics();
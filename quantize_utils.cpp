@@ -0,0 +1,411 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: quantize_utils.cpp
+//
+// Quantized DNN_EMB stores. SQ8 keeps one byte per dimension; PQ keeps
+// one byte per subspace. Queries are never quantized: distances are
+// computed asymmetrically from the float query to the decoded rows, and
+// an optional exact re-rank recovers most of the lost recall.
+
+#include "quantize_utils.h"
+#include "distance_kernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+
+using namespace std;
+
+static const char QUANT_MAGIC[8] = {'C', 'B', 'I', 'R', 'Q', 'N', 'T', '\0'};
+static const uint32_t QUANT_VERSION = 1;
+
+// Centroids per PQ subspace (one byte per code).
+static const size_t PQ_KSUB = 256;
+
+struct QuantFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t dim;
+    uint64_t count;
+    uint64_t m;
+    uint64_t namesSize;
+};
+
+// Unit-normalized copy of row i.
+static vector<float> unitRow(const FeatureView &db, size_t i) {
+    const float *row = db.f32(i);
+    double norm = sqrt(activeKernels().dotF32(row, row, db.dim));
+    vector<float> out(db.dim);
+    for (size_t j = 0; j < db.dim; j++) out[j] = norm > 0 ? float(row[j] / norm) : 0.0f;
+    return out;
+}
+
+static void copyNames(const FeatureView &db, QuantizedStore &q) {
+    q.nameOffsets.assign(1, 0);
+    q.names.clear();
+    for (size_t i = 0; i < db.count; i++) {
+        string_view n = db.name(i);
+        q.names.insert(q.names.end(), n.begin(), n.end());
+        q.names.push_back('\0');
+        q.nameOffsets.push_back(q.names.size());
+    }
+}
+
+bool isQuantizedPath(const string &path) {
+    auto endsWith = [&](const char *ext) {
+        size_t n = strlen(ext);
+        return path.size() > n && path.compare(path.size() - n, n, ext) == 0;
+    };
+    return endsWith(".sq8") || endsWith(".pq");
+}
+
+void QuantizedStore::decode(size_t i, float *out) const {
+    const uint8_t *c = code(i);
+    if (kind == QUANT_SQ8) {
+        for (size_t j = 0; j < dim; j++) out[j] = vmin[j] + vscale[j] * c[j];
+        return;
+    }
+    size_t dsub = dim / m;
+    for (size_t sp = 0; sp < m; sp++) {
+        memcpy(out + sp * dsub, &centroids[(sp * PQ_KSUB + c[sp]) * dsub], dsub * sizeof(float));
+    }
+}
+
+QuantizedStore quantizeSQ8(const FeatureView &db) {
+    QuantizedStore q;
+    q.kind = QUANT_SQ8;
+    q.dim = db.dim;
+    q.count = db.count;
+    q.m = db.dim;
+
+    vector<float> lo(db.dim, numeric_limits<float>::max());
+    vector<float> hi(db.dim, numeric_limits<float>::lowest());
+    for (size_t i = 0; i < db.count; i++) {
+        vector<float> x = unitRow(db, i);
+        for (size_t j = 0; j < db.dim; j++) {
+            lo[j] = min(lo[j], x[j]);
+            hi[j] = max(hi[j], x[j]);
+        }
+    }
+
+    q.vmin = lo;
+    q.vscale.resize(db.dim);
+    for (size_t j = 0; j < db.dim; j++) {
+        q.vscale[j] = hi[j] > lo[j] ? (hi[j] - lo[j]) / 255.0f : 1.0f;
+    }
+
+    q.codes.resize(db.count * q.m);
+    q.norms.resize(db.count);
+    for (size_t i = 0; i < db.count; i++) {
+        vector<float> x = unitRow(db, i);
+        uint8_t *c = &q.codes[i * q.m];
+        double norm = 0;
+        for (size_t j = 0; j < db.dim; j++) {
+            float v = roundf((x[j] - q.vmin[j]) / q.vscale[j]);
+            c[j] = uint8_t(min(255.0f, max(0.0f, v)));
+            double dec = q.vmin[j] + q.vscale[j] * c[j];
+            norm += dec * dec;
+        }
+        q.norms[i] = float(sqrt(norm));
+    }
+
+    copyNames(db, q);
+    return q;
+}
+
+// Index of the centroid nearest to x (squared L2) among k centroids of size dsub.
+static size_t nearestCentroid(const float *x, const float *cents, size_t k, size_t dsub) {
+    size_t best = 0;
+    float bestDist = numeric_limits<float>::max();
+    for (size_t c = 0; c < k; c++) {
+        const float *ctr = cents + c * dsub;
+        float dist = 0;
+        for (size_t j = 0; j < dsub; j++) {
+            float diff = x[j] - ctr[j];
+            dist += diff * diff;
+        }
+        if (dist < bestDist) {
+            bestDist = dist;
+            best = c;
+        }
+    }
+    return best;
+}
+
+QuantizedStore quantizePQ(const FeatureView &db, size_t m, int iters, size_t trainRows) {
+    QuantizedStore q;
+    q.kind = QUANT_PQ;
+    q.dim = db.dim;
+    q.count = db.count;
+    q.m = m;
+    if (m == 0 || db.dim % m != 0 || db.count == 0) {
+        q.m = 0;
+        q.count = 0;
+        copyNames(FeatureView(), q);
+        return q;
+    }
+
+    size_t dsub = db.dim / m;
+    mt19937 rng(42);
+
+    // Training sample of unit rows.
+    vector<size_t> sample(db.count);
+    for (size_t i = 0; i < db.count; i++) sample[i] = i;
+    shuffle(sample.begin(), sample.end(), rng);
+    sample.resize(min(trainRows, db.count));
+
+    vector<float> train(sample.size() * db.dim);
+    for (size_t s = 0; s < sample.size(); s++) {
+        vector<float> x = unitRow(db, sample[s]);
+        copy(x.begin(), x.end(), &train[s * db.dim]);
+    }
+
+    q.centroids.assign(m * PQ_KSUB * dsub, 0.0f);
+    vector<float> sub(sample.size() * dsub);
+    vector<size_t> assign(sample.size());
+
+    for (size_t sp = 0; sp < m; sp++) {
+        for (size_t s = 0; s < sample.size(); s++) {
+            memcpy(&sub[s * dsub], &train[s * db.dim + sp * dsub], dsub * sizeof(float));
+        }
+
+        float *cents = &q.centroids[sp * PQ_KSUB * dsub];
+        for (size_t c = 0; c < PQ_KSUB; c++) {
+            memcpy(cents + c * dsub, &sub[(c % sample.size()) * dsub], dsub * sizeof(float));
+        }
+
+        for (int it = 0; it < iters; it++) {
+            for (size_t s = 0; s < sample.size(); s++) {
+                assign[s] = nearestCentroid(&sub[s * dsub], cents, PQ_KSUB, dsub);
+            }
+
+            vector<double> sums(PQ_KSUB * dsub, 0.0);
+            vector<size_t> counts(PQ_KSUB, 0);
+            for (size_t s = 0; s < sample.size(); s++) {
+                counts[assign[s]]++;
+                for (size_t j = 0; j < dsub; j++) sums[assign[s] * dsub + j] += sub[s * dsub + j];
+            }
+
+            uniform_int_distribution<size_t> pick(0, sample.size() - 1);
+            for (size_t c = 0; c < PQ_KSUB; c++) {
+                if (counts[c] == 0) {
+                    // Reseed an empty cluster from a random training point.
+                    memcpy(cents + c * dsub, &sub[pick(rng) * dsub], dsub * sizeof(float));
+                    continue;
+                }
+                for (size_t j = 0; j < dsub; j++) cents[c * dsub + j] = float(sums[c * dsub + j] / counts[c]);
+            }
+        }
+    }
+
+    q.codes.resize(db.count * m);
+    q.norms.resize(db.count);
+    for (size_t i = 0; i < db.count; i++) {
+        vector<float> x = unitRow(db, i);
+        double norm = 0;
+        for (size_t sp = 0; sp < m; sp++) {
+            const float *cents = &q.centroids[sp * PQ_KSUB * dsub];
+            size_t c = nearestCentroid(&x[sp * dsub], cents, PQ_KSUB, dsub);
+            q.codes[i * m + sp] = uint8_t(c);
+            for (size_t j = 0; j < dsub; j++) norm += double(cents[c * dsub + j]) * cents[c * dsub + j];
+        }
+        q.norms[i] = float(sqrt(norm));
+    }
+
+    copyNames(db, q);
+    return q;
+}
+
+bool writeQuantizedStore(const string &filename, const QuantizedStore &q) {
+    QuantFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, QUANT_MAGIC, sizeof(h.magic));
+    h.version = QUANT_VERSION;
+    h.kind = q.kind;
+    h.dim = q.dim;
+    h.count = q.count;
+    h.m = q.m;
+    h.namesSize = q.names.size();
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    if (!file) return false;
+
+    auto put = [&](const auto &v) {
+        file.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(v[0]));
+    };
+    file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    put(q.vmin);
+    put(q.vscale);
+    put(q.centroids);
+    put(q.norms);
+    put(q.codes);
+    put(q.nameOffsets);
+    put(q.names);
+    return bool(file);
+}
+
+bool readQuantizedStore(const string &filename, QuantizedStore &q) {
+    ifstream file(filename, ios::binary);
+    if (!file) return false;
+
+    QuantFileHeader h;
+    if (!file.read(reinterpret_cast<char *>(&h), sizeof(h))) return false;
+    if (memcmp(h.magic, QUANT_MAGIC, sizeof(h.magic)) != 0 || h.version != QUANT_VERSION
+        || h.kind > QUANT_PQ || h.dim == 0 || h.m == 0
+        || (h.kind == QUANT_SQ8 ? h.m != h.dim : h.dim % h.m != 0)) return false;
+    file.seekg(0, ios::end);
+    uint64_t fileSize = uint64_t(file.tellg());
+
+    QuantizedStore r;
+    r.kind = QuantKind(h.kind);
+    r.dim = h.dim;
+    r.count = h.count;
+    r.m = h.m;
+
+    // Add up the section sizes, rejecting any header whose sizes overflow.
+    uint64_t expected = sizeof(h);
+    auto section = [&](uint64_t n, uint64_t each) {
+        if (n > fileSize || (each && n > (UINT64_MAX - expected) / each)) return false;
+        expected += n * each;
+        return true;
+    };
+    size_t sq = r.kind == QUANT_SQ8 ? r.dim : 0;
+    size_t cents = r.kind == QUANT_PQ ? r.dim * PQ_KSUB : 0; // m x 256 x dim/m
+    if (!section(sq, 2 * sizeof(float)) || !section(cents, sizeof(float))
+        || !section(r.count, sizeof(float)) || !section(r.count, r.m)
+        || !section(r.count, sizeof(uint64_t)) || !section(1, sizeof(uint64_t))
+        || !section(h.namesSize, 1) || expected != fileSize) return false;
+    file.clear();
+    file.seekg(sizeof(h), ios::beg);
+
+    auto get = [&](auto &v, size_t n) {
+        v.resize(n);
+        return bool(file.read(reinterpret_cast<char *>(v.data()), n * sizeof(v[0])));
+    };
+    if (!get(r.vmin, sq) || !get(r.vscale, sq) || !get(r.centroids, cents)
+        || !get(r.norms, r.count) || !get(r.codes, r.count * r.m)
+        || !get(r.nameOffsets, r.count + 1) || !get(r.names, h.namesSize)) return false;
+
+    // Name offsets must ascend, each name ending in its terminator, and end
+    // at the end of the name blob.
+    if (r.nameOffsets[0] != 0 || r.nameOffsets[r.count] != h.namesSize) return false;
+    for (size_t i = 0; i < r.count; i++) {
+        uint64_t next = r.nameOffsets[i + 1];
+        if (next <= r.nameOffsets[i] || next > h.namesSize || r.names[next - 1] != '\0') return false;
+    }
+
+    q = std::move(r);
+    return true;
+}
+
+vector<Scored> searchQuantized(const QuantizedStore &q, const float *query,
+                               size_t N, int threads) {
+    if (q.count == 0) return {};
+
+    vector<float> x(query, query + q.dim);
+    double qnorm = sqrt(activeKernels().dotF32(x.data(), x.data(), q.dim));
+    for (auto &v : x) v = qnorm > 0 ? float(v / qnorm) : 0.0f;
+
+    // Per-code contributions to the dot product: weights for SQ8, a
+    // 256-entry lookup table per subspace for PQ.
+    vector<float> table;
+    double offset = 0;
+    if (q.kind == QUANT_SQ8) {
+        table.resize(q.dim);
+        for (size_t j = 0; j < q.dim; j++) {
+            table[j] = x[j] * q.vscale[j];
+            offset += double(x[j]) * q.vmin[j];
+        }
+    } else {
+        size_t dsub = q.dim / q.m;
+        table.resize(q.m * PQ_KSUB);
+        for (size_t sp = 0; sp < q.m; sp++) {
+            for (size_t c = 0; c < PQ_KSUB; c++) {
+                const float *ctr = &q.centroids[(sp * PQ_KSUB + c) * dsub];
+                float dot = 0;
+                for (size_t j = 0; j < dsub; j++) dot += x[sp * dsub + j] * ctr[j];
+                table[sp * PQ_KSUB + c] = dot;
+            }
+        }
+    }
+
+    auto dist = [&](size_t i) {
+        const uint8_t *c = q.code(i);
+        float dot = 0;
+        if (q.kind == QUANT_SQ8) {
+            for (size_t j = 0; j < q.m; j++) dot += table[j] * c[j];
+        } else {
+            const float *t = table.data();
+            for (size_t sp = 0; sp < q.m; sp++, t += PQ_KSUB) dot += t[c[sp]];
+        }
+        double norm = q.norms[i];
+        if (norm == 0 || qnorm == 0) return 1.0;
+        return 1.0 - (dot + offset) / norm;
+    };
+
+    return scanTopN(q.count, N, threads, dist);
+}
+
+vector<Scored> searchQuantizedRerank(const QuantizedStore &q, const FeatureView &exact,
+                                     const float *query, size_t N, size_t rerank,
+                                     int threads) {
+    vector<Scored> shortlist = searchQuantized(q, query, max(N, rerank), threads);
+    if (exact.count != q.count || exact.dim != q.dim || exact.elem != ELEM_F32) {
+        if (shortlist.size() > N) shortlist.resize(N);
+        return shortlist;
+    }
+
+    const DistanceKernels &k = activeKernels();
+    TopN best(N);
+    for (auto &s : shortlist) {
+        best.push(k.cosineDistanceF32(query, exact.f32(s.index), exact.dim), s.index);
+    }
+    return best.sorted();
+}
+
+vector<QuantReportRow> quantizedRecallReport(const QuantizedStore &q, const FeatureView &db,
+                                             size_t N, const vector<size_t> &reranks,
+                                             size_t queries) {
+    vector<QuantReportRow> rows;
+    if (db.count == 0 || q.count != db.count) return rows;
+
+    queries = min(queries, db.count);
+    const DistanceKernels &k = activeKernels();
+
+    vector<vector<size_t>> truth(queries);
+    for (size_t s = 0; s < queries; s++) {
+        const float *query = db.f32(s * db.count / queries);
+        for (auto &r : scanTopN(db.count, N, 0, [&](size_t i) {
+                 return k.cosineDistanceF32(query, db.f32(i), db.dim);
+             })) {
+            truth[s].push_back(r.index);
+        }
+    }
+
+    vector<size_t> depths = {0};
+    depths.insert(depths.end(), reranks.begin(), reranks.end());
+    for (size_t depth : depths) {
+        size_t hits = 0, total = 0;
+        auto t0 = chrono::steady_clock::now();
+        vector<vector<Scored>> results(queries);
+        for (size_t s = 0; s < queries; s++) {
+            const float *query = db.f32(s * db.count / queries);
+            results[s] = depth == 0 ? searchQuantized(q, query, N)
+                                    : searchQuantizedRerank(q, db, query, N, depth);
+        }
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count() / queries;
+
+        for (size_t s = 0; s < queries; s++) {
+            for (auto &r : results[s]) {
+                hits += count(truth[s].begin(), truth[s].end(), r.index);
+            }
+            total += truth[s].size();
+        }
+        rows.push_back({depth, total ? double(hits) / total : 1.0, us});
+    }
+    return rows;
+}
@@ -0,0 +1,92 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: quantize_utils.h
+//
+// Header file for quantize_utils.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "feature_store.h"
+#include "matcher_utils.h"
+
+// Compression scheme of a quantized embedding store.
+enum QuantKind {
+    QUANT_SQ8,  // one uint8 per dimension, per-dimension min/scale
+    QUANT_PQ    // one uint8 centroid id per subspace
+};
+
+// Compressed copy of a DNN_EMB store. Rows are unit-normalized before
+// encoding, and row i corresponds to row i of the source store.
+struct QuantizedStore {
+    QuantKind kind = QUANT_SQ8;
+    size_t dim = 0;
+    size_t count = 0;
+    size_t m = 0;                   // code bytes per row
+    std::vector<float> vmin;        // SQ8: per-dimension offset
+    std::vector<float> vscale;      // SQ8: per-dimension step
+    std::vector<float> centroids;   // PQ: m x 256 x (dim / m)
+    std::vector<float> norms;       // norm of each decoded row
+    std::vector<uint8_t> codes;     // count x m
+    std::vector<uint64_t> nameOffsets;
+    std::vector<char> names;
+
+    const uint8_t *code(size_t i) const { return &codes[i * m]; }
+    std::string_view name(size_t i) const {
+        return std::string_view(&names[nameOffsets[i]], nameOffsets[i + 1] - nameOffsets[i] - 1);
+    }
+    //Bytes held per row (codes + norm), excluding names.
+    size_t bytesPerRow() const { return m + sizeof(float); }
+
+    //Row i decoded to dim floats: the unit row, up to quantization error.
+    void decode(size_t i, float *out) const;
+};
+
+//Exact rows re-ranked after a quantized search unless a caller asks otherwise.
+const size_t DEFAULT_QUANT_RERANK = 100;
+
+//True if path names a quantized store (.sq8 or .pq).
+bool isQuantizedPath(const std::string &path);
+
+//Encode a float store with per-dimension int8 scalar quantization.
+QuantizedStore quantizeSQ8(const FeatureView &db);
+
+//Encode a float store with product quantization into m subspaces of 256
+//centroids each, trained by k-means on up to trainRows sampled rows.
+//dim must be divisible by m.
+QuantizedStore quantizePQ(const FeatureView &db, size_t m, int iters = 10,
+                          size_t trainRows = 20000);
+
+//Write a quantized store to a binary file.
+bool writeQuantizedStore(const std::string &filename, const QuantizedStore &q);
+
+//Read a quantized store. Returns false if missing or malformed.
+bool readQuantizedStore(const std::string &filename, QuantizedStore &q);
+
+//Approximate top-N by asymmetric cosine distance: the query stays float
+//and is compared against decoded codes (via lookup tables for PQ).
+std::vector<Scored> searchQuantized(const QuantizedStore &q, const float *query,
+                                    size_t N, int threads = 0);
+
+//Shortlist `rerank` rows with searchQuantized, then re-rank them with the
+//exact cosine distance against the full-precision store.
+std::vector<Scored> searchQuantizedRerank(const QuantizedStore &q, const FeatureView &exact,
+                                          const float *query, size_t N, size_t rerank,
+                                          int threads = 0);
+
+// One row of the quantization recall report (rerank 0 = no re-rank).
+struct QuantReportRow {
+    size_t rerank;
+    double recall;
+    double usPerQuery;
+};
+
+//Recall@N of quantized search, with and without each re-rank depth,
+//against the exact cosine scan for `queries` rows sampled from db.
+std::vector<QuantReportRow> quantizedRecallReport(const QuantizedStore &q, const FeatureView &db,
+                                                  size_t N, const std::vector<size_t> &reranks,
+                                                  size_t queries = 200);
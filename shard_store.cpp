@@ -0,0 +1,239 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: shard_store.cpp
+//
+// Sharded feature stores for databases larger than memory. A store is cut
+// into fixed-size shard files listed by a small text manifest, and a query
+// streams the shards through a bounded window of mappings, reading the
+// next shards ahead while the current one is scanned.
+
+#include "shard_store.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+
+namespace fs = std::filesystem;
+
+// First word and version of a shard manifest.
+static const char *SHARD_MAGIC = "cbir-shards";
+static const int SHARD_VERSION = 1;
+
+bool isShardManifest(const string &path) {
+    const string ext = ".shards";
+    return path.size() > ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// File name of shard s of a stem.
+static string shardPath(const string &stem, size_t s) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%05zu.bin", s);
+    return stem + suffix;
+}
+
+// Rows [begin, end) of a block, sharing its memory.
+static FeatureView sliceRows(const FeatureView &rows, size_t begin, size_t end) {
+    FeatureView v = rows;
+    v.count = end - begin;
+    v.nameOffsets += begin;
+    if (rows.elem == ELEM_SPARSE) v.rowOffsets += begin;
+    else v.rows += begin * rows.stride;
+    return v;
+}
+
+// Bytes row i adds to a store: its name, name offset and row data.
+static size_t storedRowBytes(const FeatureView &rows, size_t i) {
+    size_t data = rows.elem == ELEM_SPARSE
+        ? rows.rowOffsets[i + 1] - rows.rowOffsets[i] + sizeof(uint64_t)
+        : rows.stride;
+    return data + rows.name(i).size() + 1 + sizeof(uint64_t);
+}
+
+bool writeShardedStore(const string &stem, const FeatureView &rows, size_t shardBytes) {
+    // Leave room for the header and the padding of each section.
+    size_t budget = shardBytes > sizeof(FeatureStoreHeader) + 192
+        ? shardBytes - sizeof(FeatureStoreHeader) - 192 : 0;
+
+    vector<ShardInfo> shards;
+    size_t begin = 0;
+    while (begin < rows.count) {
+        size_t end = begin + 1, bytes = storedRowBytes(rows, begin);
+        for (; end < rows.count; end++) {
+            size_t next = storedRowBytes(rows, end);
+            if (bytes + next > budget) break;
+            bytes += next;
+        }
+
+        ShardInfo shard;
+        shard.path = shardPath(stem, shards.size());
+        shard.rows = end - begin;
+        if (!writeFeatureStore(shard.path, sliceRows(rows, begin, end))) return false;
+        std::error_code ec;
+        shard.bytes = fs::file_size(shard.path, ec);
+        if (ec) return false;
+        shards.push_back(shard);
+        begin = end;
+    }
+
+    ofstream file(stem + ".shards");
+    if (!file) return false;
+    file << SHARD_MAGIC << ' ' << SHARD_VERSION << ' ' << int(rows.type) << ' ' << rows.dim << ' '
+         << rows.count << ' ' << rows.decode.factor << ' ' << rows.decode.maxSide << '\n';
+    for (auto &s : shards) {
+        file << s.rows << ',' << s.bytes << ',' << fs::path(s.path).filename().string() << '\n';
+    }
+    file.close();
+    if (!file) return false;
+
+    // Shards past the new last one belong to an older layout.
+    std::error_code ec;
+    for (size_t s = shards.size(); fs::exists(shardPath(stem, s), ec); s++) fs::remove(shardPath(stem, s), ec);
+    return true;
+}
+
+bool readShardManifest(const string &filename, ShardedStore &store) {
+    ifstream file(filename);
+    string line;
+    if (!file || !getline(file, line)) return false;
+
+    ShardedStore st;
+    istringstream header(line);
+    string magic;
+    int version = 0, type = -1;
+    if (!(header >> magic >> version >> type >> st.dim >> st.count >> st.decode.factor >> st.decode.maxSide)
+        || magic != SHARD_MAGIC || version != SHARD_VERSION || type < 0 || type > LAST_FEATURE_TYPE) {
+        return false;
+    }
+    st.type = FeatureType(type);
+
+    fs::path dir = fs::path(filename).parent_path();
+    size_t total = 0;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        istringstream ss(line);
+        ShardInfo shard;
+        char comma1 = 0, comma2 = 0;
+        string name;
+        if (!(ss >> shard.rows >> comma1 >> shard.bytes >> comma2) || comma1 != ',' || comma2 != ','
+            || !getline(ss, name) || name.empty()) {
+            return false;
+        }
+        shard.path = (dir / name).string();
+        total += shard.rows;
+        st.shards.push_back(shard);
+    }
+    if (total != st.count) return false;
+
+    store = std::move(st);
+    return true;
+}
+
+// Map shard s and check it holds what the manifest says.
+static bool openShard(const ShardedStore &store, size_t s, FeatureStore &shard) {
+    const ShardInfo &info = store.shards[s];
+    if (!shard.open(info.path)) return false;
+    const FeatureView &v = shard.view();
+    return v.type == store.type && v.dim == store.dim && v.count == info.rows
+        && shard.mappedBytes() == info.bytes;
+}
+
+size_t findShardedRow(const ShardedStore &store, std::string_view name, ImageFeature *row) {
+    size_t base = 0;
+    for (size_t s = 0; s < store.shards.size(); s++) {
+        FeatureStore shard;
+        if (!openShard(store, s, shard)) return NO_ROW;
+        const FeatureView &v = shard.view();
+        for (size_t i = 0; i < v.count; i++) {
+            if (v.name(i) != name) continue;
+            if (row) {
+                row->name = string(name);
+                row->type = v.type;
+                if (v.elem == ELEM_U8) {
+                    row->intFeat.assign(v.u8(i), v.u8(i) + v.dim);
+                } else {
+                    vector<float> dense(v.dim);
+                    v.expand(i, dense.data());
+                    row->dblFeat.assign(dense.begin(), dense.end());
+                }
+            }
+            return base + i;
+        }
+        base += v.count;
+    }
+    return NO_ROW;
+}
+
+// A merged match with the row it came from, for breaking ties by row.
+struct RankedMatch {
+    Scored score;
+    string name;
+};
+
+vector<Match> matchSharded(const ImageFeature &target, const ShardedStore &store, int N,
+                           size_t budget, int threads, size_t skip, ShardScanStats *stats) {
+    ShardScanStats local;
+    ShardScanStats &st = stats ? *stats : local;
+    st = ShardScanStats();
+    if (N <= 0) return {};
+
+    // Shards mapped and being read ahead, in row order; the front is next
+    // to be scanned.
+    deque<FeatureStore> window;
+    uint64_t mapped = 0;
+    size_t next = 0;
+
+    vector<RankedMatch> best;
+    size_t base = 0;
+    for (size_t s = 0; s < store.shards.size(); s++) {
+        while (next < store.shards.size()
+               && (window.empty() || mapped + store.shards[next].bytes <= budget)) {
+            FeatureStore shard;
+            if (!openShard(store, next, shard)) {
+                st.badShard = next;
+                return {};
+            }
+            shard.advise(MADV_WILLNEED);
+            mapped += shard.mappedBytes();
+            window.push_back(std::move(shard));
+            next++;
+        }
+        st.peakMapped = max(st.peakMapped, mapped);
+
+        FeatureStore shard = std::move(window.front());
+        window.pop_front();
+        const FeatureView &v = shard.view();
+
+        double bound = best.size() < size_t(N) ? INFINITY : best.back().score.dist;
+        size_t localSkip = skip >= base && skip - base < v.count ? skip - base : NO_ROW;
+        vector<Scored> part = scoreRows(target, v, size_t(N), threads, localSkip, bound);
+        if (part.empty() && v.count > (localSkip != NO_ROW)) {
+            // The target does not fit the rows; no shard will do better.
+            return {};
+        }
+
+        for (auto &p : part) {
+            Scored global{p.dist, base + p.index};
+            if (best.size() == size_t(N) && !(global < best.back().score)) continue;
+            best.push_back({global, string(v.name(p.index))});
+        }
+        sort(best.begin(), best.end(), [](const RankedMatch &a, const RankedMatch &b) {
+            return a.score < b.score;
+        });
+        if (best.size() > size_t(N)) best.resize(N);
+
+        st.shards++;
+        st.bytes += shard.mappedBytes();
+        countMetric(COUNTER_SHARDS_STREAMED);
+        countMetric(COUNTER_SHARD_BYTES, shard.mappedBytes());
+        mapped -= shard.mappedBytes();
+        base += v.count;
+    }
+
+    vector<Match> matches;
+    for (auto &b : best) matches.push_back({b.name, b.score.dist});
+    return matches;
+}
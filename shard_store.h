@@ -0,0 +1,81 @@
+//Name: Natasha Nicholas
+//Date: Oct. 17, 2026
+//File: shard_store.h
+//
+// Header file for shard_store.cpp
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "feature_store.h"
+#include "matcher_utils.h"
+
+// One shard file of a sharded store: an ordinary binary feature store
+// holding the next `rows` rows of the whole.
+struct ShardInfo {
+    std::string path;
+    uint64_t rows = 0;
+    uint64_t bytes = 0; // file size
+};
+
+// A feature store split across shard files so it can be matched without
+// being mapped whole. <stem>.shards lists the shards <stem>.00000.bin,
+// <stem>.00001.bin, ... in row order; all share the type, dim and decode
+// recorded in the manifest.
+struct ShardedStore {
+    FeatureType type = BASELINE;
+    size_t dim = 0;
+    size_t count = 0; // rows across all shards
+    DecodeScale decode;
+    std::vector<ShardInfo> shards;
+};
+
+// What a streaming match did besides the matches it returned.
+struct ShardScanStats {
+    size_t shards = 0;        // shards scanned
+    uint64_t bytes = 0;       // bytes of those shards
+    uint64_t peakMapped = 0;  // most shard bytes mapped at once
+    size_t badShard = NO_ROW; // shard missing or not as the manifest says
+};
+
+//Shard size written unless a caller asks otherwise.
+const size_t DEFAULT_SHARD_BYTES = size_t(64) << 20;
+
+//Shard bytes a streaming match keeps mapped unless a caller asks otherwise.
+const size_t DEFAULT_MEMORY_BUDGET = size_t(256) << 20;
+
+//True if path names a shard manifest (ends in .shards).
+bool isShardManifest(const std::string &path);
+
+//Split a block of rows (usually a mapped store) into shards of at most
+//shardBytes each, a shard holding at least one row, and write them with
+//the manifest <stem>.shards. Shards left from an earlier, longer layout
+//of the same stem are removed.
+bool writeShardedStore(const std::string &stem, const FeatureView &rows,
+                       size_t shardBytes = DEFAULT_SHARD_BYTES);
+
+//Read a manifest written by writeShardedStore; shard paths are resolved
+//beside it. Returns false if missing or malformed. The shards themselves
+//are checked as they are opened.
+bool readShardManifest(const std::string &filename, ShardedStore &store);
+
+//Index of the row named name across all shards, or NO_ROW, reading only
+//the shards' name tables. With row set, the row is copied into it.
+size_t findShardedRow(const ShardedStore &store, std::string_view name, ImageFeature *row = nullptr);
+
+//matchFeatures over a sharded store, streaming the shards through at most
+//budget bytes of mappings: while one shard is scanned, the shards after
+//it that fit the budget are mapped and read ahead (MADV_WILLNEED), and
+//each shard is unmapped once scanned. A shard is always mapped even if it
+//alone exceeds the budget; a budget of two or more shards overlaps disk
+//reads with the scan. Per-shard top-N results are merged as they come, and
+//each shard is scanned against the running N-th best, so the result is
+//the same as matching one store of all the rows. skip is a row index
+//across all shards. Empty if a shard cannot be read (see stats->badShard).
+std::vector<Match> matchSharded(const ImageFeature &target, const ShardedStore &store, int N,
+                                size_t budget = DEFAULT_MEMORY_BUDGET, int threads = 0,
+                                size_t skip = NO_ROW, ShardScanStats *stats = nullptr);